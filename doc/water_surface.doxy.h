@@ -70,11 +70,15 @@
  *
  * Increase this number can improve the rendering
  * to the expense of the performances.
+ * This number is only used by documents that draw their own plane:
+ * @ref colored_water_surface now uses @ref water_mesh.
  * @~french
  * Détail de la surface d'eau.
  *
  * Augmenter ce nombre peut améliorer la qualité du rendu au détriment
  * des performances.
+ * Ce nombre ne sert plus qu'aux documents qui dessinent leur propre plan :
+ * @ref colored_water_surface utilise maintenant @ref water_mesh.
  */
 integer WATER_DETAIL = 150;
 
@@ -253,7 +257,9 @@ water_remove(name:text);
  *
  * Specify the extenuation ratio @p r to the water surface named @p name.\n
  * The greater the value will be, The more the waves on the water surface will last.\n
- * The maximum value is 1.0.
+ * The maximum value is 1.0.\n
+ * Once the waves have died out, the water surface is no longer simulated
+ * until the next drop.
 @code
 water_extenuation "water", 0.92
 @endcode
@@ -263,7 +269,9 @@ water_extenuation "water", 0.92
  *
  * Applique le paramètre d'atténuation @p r à la surface d'eau nommée @p name.\n
  * Plus cette valeur sera grande, plus les vagues sur la surface d'eau dureront longtemps.\n
- * La valeur maximum est 1.0.
+ * La valeur maximum est 1.0.\n
+ * Une fois les vagues disparues, la surface d'eau n'est plus simulée
+ * jusqu'à la prochaine goutte.
  *
 @code
 water_extenuation "eau", 0.92
@@ -338,6 +346,994 @@ add_random_drops "eau", 20
 add_random_drops(name:text, n:integer);
 
 
+/**
+ * @~english
+ * Select the solver of a water surface.
+ *
+ * The water surface named @p name is simulated with shaders when
+ * @p backend is @c "gpu" (the default), or on the CPU when @p backend is
+ * @c "cpu". The CPU solver is used automatically when the graphic card
+ * cannot run the simulation shaders. The current waves are preserved when
+ * switching from one solver to the other.
+@code
+water_backend "water", "cpu"
+@endcode
+ *
+ * @~french
+ * Choisit le moteur de simulation d'une surface d'eau.
+ *
+ * La surface d'eau nommée @p name est simulée par des shaders lorsque
+ * @p backend vaut @c "gpu" (par défaut), ou par le processeur lorsque
+ * @p backend vaut @c "cpu". Le moteur processeur est utilisé automatiquement
+ * si la carte graphique ne peut pas exécuter les shaders de simulation.
+ * Les vagues en cours sont conservées lors du changement de moteur.
+@code
+water_backend "eau", "cpu"
+@endcode
+ */
+water_backend(name:text, backend:text);
+
+
+/**
+ * @~english
+ * Add a batch of drops to a water surface.
+ *
+ * Put several drops on the water surface named @p name at once. Each drop
+ * is described by four values @p x, @p y, @p r and @p s, as for
+ * @ref add_drop. All the drops of the batch are added in a single pass,
+ * which is much faster than calling @ref add_drop repeatedly.
+ *
+@code
+add_drops "water", 0.2, 0.3, 1.0, 1.0, 0.7, 0.6, 1.0, -1.0
+@endcode
+ *
+ * @~french
+ * Dépose un lot de gouttes sur une surface d'eau.
+ *
+ * Ajoute plusieurs gouttes à la fois sur la surface d'eau dont le nom est
+ * @p name. Chaque goutte est décrite par quatre valeurs @p x, @p y, @p r
+ * et @p s, comme pour @ref add_drop. Toutes les gouttes du lot sont
+ * ajoutées en une seule passe, ce qui est bien plus rapide que des appels
+ * répétés à @ref add_drop.
+ *
+@code
+add_drops "eau", 0.2, 0.3, 1.0, 1.0, 0.7, 0.6, 1.0, -1.0
+@endcode
+ * @~
+ * @see queue_drop.
+ */
+add_drops(name:text, x:real, y:real, r:real, s:real, ...);
+
+
+/**
+ * @~english
+ * Queue a drop for the next batch.
+ *
+ * Record a drop on the water surface named @p name, with the same
+ * parameters as @ref add_drop. Queued drops are added in a single pass by
+ * @ref add_drops or at the latest when the water surface is updated.
+ *
+ * @~french
+ * Prépare une goutte pour le prochain lot.
+ *
+ * Enregistre une goutte sur la surface d'eau dont le nom est @p name, avec
+ * les mêmes paramètres que @ref add_drop. Les gouttes en attente sont
+ * ajoutées en une seule passe par @ref add_drops, ou au plus tard lors de
+ * la mise à jour de la surface d'eau.
+ */
+queue_drop(name:text, x:real, y:real, r:real, s:real);
+
+
+/**
+ * @~english
+ * Set the speed of the waves of a water surface.
+ *
+ * Run @p n simulation steps for each tick of the clock of the water
+ * surface named @p name (see @ref water_timestep), instead of one. Waves
+ * travel @p n times faster. All the steps are computed in a single pass
+ * setup, which is cheaper than showing the water several times.
+@code
+water_steps "water", 3
+@endcode
+ *
+ * @~french
+ * Règle la vitesse des vagues d'une surface d'eau.
+ *
+ * Exécute @p n étapes de simulation à chaque top de l'horloge de la
+ * surface d'eau nommée @p name (voir @ref water_timestep), au lieu d'une
+ * seule. Les vagues se déplacent @p n fois plus vite. Toutes les étapes sont calculées avec une seule préparation
+ * de l'état graphique, ce qui est moins coûteux que d'afficher la surface
+ * plusieurs fois.
+@code
+water_steps "eau", 3
+@endcode
+ */
+water_steps(name:text, n:integer);
+
+
+/**
+ * @~english
+ * Set the resolution of a water surface.
+ *
+ * The water surface named @p name is simulated on a grid of @p w columns
+ * and @p h rows. The default is 256x256. Small grids are cheaper, for
+ * instance for thumbnails, while large grids give finer waves.
+ * Changing the resolution of an existing water surface makes it flat again.
+@code
+water_surface_resolution "thumbnail", 64, 64
+water_surface_resolution "hero", 1024, 1024
+@endcode
+ *
+ * @~french
+ * Règle la résolution d'une surface d'eau.
+ *
+ * La surface d'eau nommée @p name est simulée sur une grille de @p w
+ * colonnes et @p h lignes. La valeur par défaut est 256x256. Une petite
+ * grille est moins coûteuse, par exemple pour des vignettes, tandis
+ * qu'une grande grille donne des vagues plus fines.
+ * Changer la résolution d'une surface d'eau existante la rend de nouveau
+ * plane.
+@code
+water_surface_resolution "vignette", 64, 64
+water_surface_resolution "principale", 1024, 1024
+@endcode
+ * @~
+ * @see water_grid_width, water_grid_height.
+ */
+water_surface_resolution(name:text, w:integer, h:integer);
+
+
+/**
+ * @~english
+ * Number of columns of the simulation grid of a water surface.
+ * @~french
+ * Nombre de colonnes de la grille de simulation d'une surface d'eau.
+ */
+integer water_grid_width(name:text);
+
+
+/**
+ * @~english
+ * Number of rows of the simulation grid of a water surface.
+ * @~french
+ * Nombre de lignes de la grille de simulation d'une surface d'eau.
+ */
+integer water_grid_height(name:text);
+
+
+/**
+ * @~english
+ * Set the number of threads of the CPU solver.
+ *
+ * Water surfaces simulated on the CPU (see @ref water_backend) split their
+ * grid in bands of rows that are updated in parallel by @p n threads.
+ * The default value 0 uses one thread per processor core.
+@code
+water_threads 4
+@endcode
+ *
+ * @~french
+ * Règle le nombre de threads du moteur processeur.
+ *
+ * Les surfaces d'eau simulées par le processeur (voir @ref water_backend)
+ * découpent leur grille en bandes de lignes mises à jour en parallèle par
+ * @p n threads. La valeur par défaut 0 utilise un thread par cœur.
+@code
+water_threads 4
+@endcode
+ */
+water_threads(n:integer);
+
+
+/**
+ * @~english
+ * Benchmark the water simulation.
+ *
+ * Measure update steps, drops and texture binds per second for grid sizes
+ * from 64x64 to 2048x2048, on the GPU and on the CPU, as well as the cost
+ * of creating and looking up from 1 to 1000 water surfaces. The results
+ * are written in JSON format to @p file. This takes several seconds.
+ *
+ * The CPU measures can also be run without Tao with the @c water_bench
+ * program built from @c water_bench.pro.
+@code
+water_bench "water_bench.json"
+@endcode
+ *
+ * @~french
+ * Mesure les performances de la simulation d'eau.
+ *
+ * Mesure le nombre de mises à jour, de gouttes et d'activations de texture
+ * par seconde pour des grilles de 64x64 à 2048x2048, sur le GPU et sur le
+ * processeur, ainsi que le coût de création et de recherche de 1 à 1000
+ * surfaces d'eau. Les résultats sont écrits au format JSON dans le fichier
+ * @p file. Cette opération prend plusieurs secondes.
+ *
+ * Les mesures sur processeur peuvent aussi être faites sans Tao grâce au
+ * programme @c water_bench construit à partir de @c water_bench.pro.
+@code
+water_bench "water_bench.json"
+@endcode
+ */
+water_bench(file:text);
+
+
+/**
+ * @~english
+ * Timing statistics of a water surface.
+ *
+ * Return a text describing, for the update, drop and draw operations of
+ * the water surface named @p name, the number of calls and the average
+ * and 95th percentile of the CPU and GPU time of the last 64 calls, in
+ * milliseconds. GPU times require the @c GL_ARB_timer_query extension,
+ * and are available a few frames after the calls.
+@code
+text water_stats "water"
+@endcode
+ *
+ * @~french
+ * Statistiques de temps d'une surface d'eau.
+ *
+ * Renvoie un texte indiquant, pour les opérations de mise à jour, d'ajout
+ * de gouttes et d'affichage de la surface d'eau nommée @p name, le nombre
+ * d'appels ainsi que la moyenne et le 95e centile du temps processeur et
+ * GPU des 64 derniers appels, en millisecondes. Les temps GPU nécessitent
+ * l'extension @c GL_ARB_timer_query et sont disponibles quelques images
+ * après les appels.
+@code
+text water_stats "eau"
+@endcode
+ */
+text water_stats(name:text);
+
+
+/**
+ * @~english
+ * Return the handle of a water surface.
+ *
+ * The handle is an integer that identifies the water surface named
+ * @p name for the whole session. All primitives taking a water name also
+ * accept its handle, which avoids looking the name up each time, for
+ * instance in documents showing hundreds of water surfaces.
+@code
+pool -> water_handle "pool"
+water_steps pool, 2
+water_surface pool, 400, 400
+@endcode
+ *
+ * @~french
+ * Renvoie l'identifiant d'une surface d'eau.
+ *
+ * L'identifiant est un entier qui désigne la surface d'eau nommée
+ * @p name pendant toute la session. Toutes les primitives qui prennent le
+ * nom d'une surface d'eau acceptent aussi son identifiant, ce qui évite de
+ * rechercher le nom à chaque fois, par exemple dans des documents qui
+ * affichent des centaines de surfaces d'eau.
+@code
+bassin -> water_handle "bassin"
+water_steps bassin, 2
+water_surface bassin, 400, 400
+@endcode
+ */
+integer water_handle(name:text);
+
+
+/**
+ * @~english
+ * Height of a water surface at a point.
+ *
+ * @p x and @p y range from -1 to 1 across the water surface, like the
+ * coordinates of @ref add_drop. The height is interpolated between the
+ * nearest points of the simulation grid. It can be used to make objects
+ * float on the water, or to move the camera with the waves.
+ *
+ * Heights computed by shaders are copied to memory in the background,
+ * starting with the first call, so that this primitive never waits for
+ * the graphic card. The result is that of one or two frames ago, and is
+ * 0 until the first copy completes.
+@code
+locally
+    translate_z 50 * water_height_at("principale", 0.3, -0.2)
+    sphere 0.3 * 400, -0.2 * 400, 0, 20
+@endcode
+ *
+ * @~french
+ * Hauteur d'une surface d'eau en un point.
+ *
+ * @p x et @p y vont de -1 à 1 sur la surface d'eau, comme les
+ * coordonnées de @ref add_drop. La hauteur est interpolée entre les
+ * points les plus proches de la grille de simulation. Elle permet de faire
+ * flotter des objets sur l'eau, ou de faire bouger la caméra avec les
+ * vagues.
+ *
+ * Les hauteurs calculées par les shaders sont copiées en mémoire en
+ * arrière-plan, à partir du premier appel, de sorte que cette primitive
+ * n'attend jamais la carte graphique. Le résultat est celui d'une ou deux
+ * images plus tôt, et vaut 0 tant que la première copie n'est pas terminée.
+@code
+locally
+    translate_z 50 * water_height_at("principale", 0.3, -0.2)
+    sphere 0.3 * 400, -0.2 * 400, 0, 20
+@endcode
+ */
+real water_height_at(name:text, x:real, y:real);
+
+
+/**
+ * @~english
+ * Select if the normals of a water surface are precomputed.
+ *
+ * When @p enable is true, which is the default, the slope of the water
+ * surface is stored in the blue and alpha channels of its texture while
+ * the waves are computed. The shader of @ref water_surface then gets the
+ * normal of each pixel with a single texture lookup, instead of computing
+ * it from three lookups, which is much faster for water surfaces covering
+ * a large part of the screen.
+ *
+ * Custom shaders can check the setting with <tt>water_normals name</tt>,
+ * which returns 1 if the texture holds the slope, and 0 otherwise.
+@code
+water_normals "principale", false
+@endcode
+ *
+ * @~french
+ * Choisit si les normales d'une surface d'eau sont précalculées.
+ *
+ * Quand @p enable est vrai, ce qui est le cas par défaut, la pente de la
+ * surface d'eau est stockée dans les canaux bleu et alpha de sa texture
+ * pendant le calcul des vagues. Le shader de @ref water_surface obtient
+ * alors la normale de chaque pixel avec une seule lecture de texture, au
+ * lieu de la calculer à partir de trois lectures, ce qui est beaucoup plus
+ * rapide pour les surfaces d'eau qui couvrent une grande partie de l'écran.
+ *
+ * Les shaders personnalisés peuvent tester ce réglage avec
+ * <tt>water_normals nom</tt>, qui renvoie 1 si la texture contient la
+ * pente, et 0 sinon.
+@code
+water_normals "principale", false
+@endcode
+ */
+water_normals(name:text, enable:boolean);
+
+
+/**
+ * @~english
+ * Draw the surface mesh of a water.
+ *
+ * Draws a surface of size (@p w, @p h) centered on the origin, like
+ * <tt>plane 0, 0, w, h, lines, columns</tt>, for use with
+ * @ref water_shader. Vertices are dense near the camera and sparser far
+ * from it, in nested rings that double their spacing each time, so that
+ * large water surfaces remain cheap to draw. The finest spacing is one
+ * point of the simulation grid, or coarser if the camera is high above
+ * the water. The mesh stays in the graphic card, and is only rebuilt
+ * when the camera moves by a couple of points of the grid.
+@code
+water_shader "principale"
+water_mesh "principale", 2000, 2000
+@endcode
+ *
+ * @~french
+ * Dessine le maillage de la surface d'une eau.
+ *
+ * Dessine une surface de taille (@p w, @p h) centrée sur l'origine, comme
+ * <tt>plane 0, 0, w, h, lignes, colonnes</tt>, à utiliser avec
+ * @ref water_shader. Les sommets sont denses près de la caméra et plus
+ * espacés loin d'elle, en anneaux emboîtés dont l'espacement double à
+ * chaque fois, de sorte que les grandes surfaces d'eau restent peu
+ * coûteuses à dessiner. L'espacement le plus fin est d'un point de la
+ * grille de simulation, ou plus si la caméra est haut au-dessus de l'eau.
+ * Le maillage reste dans la carte graphique, et n'est reconstruit que
+ * lorsque la caméra se déplace de quelques points de la grille.
+@code
+water_shader "principale"
+water_mesh "principale", 2000, 2000
+@endcode
+ */
+water_mesh(name:text, w:real, h:real);
+
+
+/**
+ * @~english
+ * Set the rate of the simulation of a water surface.
+ *
+ * Each water surface has its own clock, which ticks every @p t seconds,
+ * 1/60 by default. When the water surface is shown, it runs one tick of
+ * simulation (see @ref water_steps) for each tick elapsed since it was
+ * last shown, so that waves move at the same speed whatever the frame
+ * rate. When the document is too slow to keep up, at most 4 ticks are
+ * run at once, and waves slow down instead of making each frame slower.
+ * With @p t set to 0, the water surface runs exactly one tick each time
+ * it is shown, as in earlier versions.
+@code
+water_timestep "water", 1/30
+@endcode
+ *
+ * @~french
+ * Règle la cadence de la simulation d'une surface d'eau.
+ *
+ * Chaque surface d'eau a sa propre horloge, qui bat toutes les @p t
+ * secondes, 1/60 par défaut. Quand la surface d'eau est affichée, elle
+ * exécute un top de simulation (voir @ref water_steps) pour chaque top
+ * écoulé depuis son dernier affichage, de sorte que les vagues se
+ * déplacent à la même vitesse quelle que soit la fréquence d'affichage.
+ * Si le document est trop lent pour suivre, au plus 4 tops sont exécutés
+ * à la fois, et les vagues ralentissent au lieu de rendre chaque image
+ * plus lente. Avec @p t égal à 0, la surface d'eau exécute exactement un
+ * top à chaque affichage, comme dans les versions précédentes.
+@code
+water_timestep "eau", 1/30
+@endcode
+ */
+water_timestep(name:text, t:real);
+
+
+/**
+ * @~english
+ * Save the state of a water surface.
+ *
+ * Writes the heights and velocities of the water surface named @p name in
+ * the binary file @p file, which can later be given to @ref water_load.
+ * The file holds a short header followed by four floating-point numbers
+ * per point of the simulation grid, in the byte order of the computer.
+@code
+key "s" -> water_save "water", "settled.water"
+@endcode
+ *
+ * @~french
+ * Enregistre l'état d'une surface d'eau.
+ *
+ * Écrit les hauteurs et vitesses de la surface d'eau nommée @p name dans
+ * le fichier binaire @p file, qui peut ensuite être passé à
+ * @ref water_load. Le fichier contient un court en-tête suivi de quatre
+ * nombres flottants par point de la grille de simulation, dans l'ordre
+ * des octets de l'ordinateur.
+@code
+key "s" -> water_save "eau", "calme.water"
+@endcode
+ */
+water_save(name:text, file:text);
+
+
+/**
+ * @~english
+ * Restore the state of a water surface.
+ *
+ * Replaces the waves of the water surface named @p name with those saved
+ * by @ref water_save in @p file. The simulation grid takes the size of the
+ * saved one. The file is mapped in memory and given as is to the graphic
+ * card, so that a presentation can start with lively water immediately.
+ * Returns false if the file cannot be read or is not a water snapshot,
+ * or if the water is an ocean (see @ref water_ocean), whose waves are
+ * computed from the wind.
+@code
+key "l" -> water_load "water", "settled.water"
+@endcode
+ *
+ * @~french
+ * Restaure l'état d'une surface d'eau.
+ *
+ * Remplace les vagues de la surface d'eau nommée @p name par celles
+ * enregistrées par @ref water_save dans @p file. La grille de simulation
+ * prend la taille de celle enregistrée. Le fichier est projeté en mémoire
+ * et transmis tel quel à la carte graphique, de sorte qu'une présentation
+ * peut démarrer immédiatement avec une eau animée. Renvoie faux si le
+ * fichier ne peut pas être lu ou n'est pas un état de surface d'eau, ou
+ * si la surface est un océan (voir @ref water_ocean), dont les vagues sont
+ * calculées à partir du vent.
+@code
+key "l" -> water_load "eau", "calme.water"
+@endcode
+ */
+water_load(name:text, file:text);
+
+
+/**
+ * @~english
+ * Record the events of a water surface.
+ *
+ * Writes every batch of drops and every update of the water surface named
+ * @p name in the binary file @p file, with the simulation step at which it
+ * happened, until @p file is an empty text or the water surface is
+ * removed. The log can be given to @ref water_replay to run exactly the
+ * same work again, for instance to compare the performance of two
+ * computers or the images of two graphic drivers.
+@code
+water_record "water", "bench.wlog"
+@endcode
+ *
+ * @~french
+ * Enregistre les événements d'une surface d'eau.
+ *
+ * Écrit chaque lot de gouttes et chaque mise à jour de la surface d'eau
+ * nommée @p name dans le fichier binaire @p file, avec l'étape de
+ * simulation à laquelle il a eu lieu, jusqu'à ce que @p file soit un texte
+ * vide ou que la surface d'eau soit supprimée. Le journal peut être passé
+ * à @ref water_replay pour refaire exactement le même travail, par exemple
+ * pour comparer les performances de deux ordinateurs ou les images de
+ * deux pilotes graphiques.
+@code
+water_record "eau", "bench.wlog"
+@endcode
+ */
+water_record(name:text, file:text);
+
+
+/**
+ * @~english
+ * Replay the events of a water surface.
+ *
+ * Each time the water surface named @p name is shown, the drops and the
+ * update of one recorded frame are read from @p file, instead of following
+ * the clock of the water (see @ref water_timestep). Other drops are
+ * ignored until the end of the log, or until @p file is an empty text.
+ * To obtain the same images, start from the same state as the recording,
+ * for instance with @ref water_load.
+@code
+water_replay "water", "bench.wlog"
+@endcode
+ *
+ * @~french
+ * Rejoue les événements d'une surface d'eau.
+ *
+ * À chaque affichage de la surface d'eau nommée @p name, les gouttes et la
+ * mise à jour d'une image enregistrée sont lues dans @p file, au lieu de
+ * suivre l'horloge de la surface d'eau (voir @ref water_timestep). Les
+ * autres gouttes sont ignorées jusqu'à la fin du journal, ou jusqu'à ce
+ * que @p file soit un texte vide. Pour obtenir les mêmes images, il faut
+ * partir du même état que l'enregistrement, par exemple avec
+ * @ref water_load.
+@code
+water_replay "eau", "bench.wlog"
+@endcode
+ */
+water_replay(name:text, file:text);
+
+
+/**
+ * @~english
+ * Seed the random drops of a water surface.
+ *
+ * After this call, @ref add_random_drops on the water surface named
+ * @p name gives the same drops for the same @p seed, on all computers.
+@code
+water_seed "water", 42
+@endcode
+ *
+ * @~french
+ * Initialise les gouttes aléatoires d'une surface d'eau.
+ *
+ * Après cet appel, @ref add_random_drops sur la surface d'eau nommée
+ * @p name donne les mêmes gouttes pour la même valeur de @p seed, sur tous
+ * les ordinateurs.
+@code
+water_seed "eau", 42
+@endcode
+ */
+water_seed(name:text, seed:integer);
+
+
+/**
+ * @~english
+ * Select the texture format of a water surface.
+ *
+ * The simulation state of the water surface named @p name is stored in
+ * textures of format @p format, which may be:
+ *  - @c "rgba16f" (default): half floats, with the gradients of the surface
+ *    in the blue and alpha channels, used to compute normals.
+ *  - @c "rg16f": half floats, heights and velocities only. This halves the
+ *    memory traffic of the simulation, but normals are then computed by the
+ *    render shader.
+ *  - @c "rg32f": single floats, heights and velocities only, for long
+ *    simulations where half floats lose too much precision.
+ *
+ * Two-channel formats fall back to @c "rgba16f" when the graphic card
+ * does not support them. The current waves are preserved.
+@code
+water_format "water", "rg16f"
+@endcode
+ *
+ * @~french
+ * Choisit le format des textures d'une surface d'eau.
+ *
+ * L'état de la simulation de la surface d'eau nommée @p name est stocké
+ * dans des textures au format @p format, qui peut être :
+ *  - @c "rgba16f" (par défaut) : flottants 16 bits, avec les gradients de
+ *    la surface dans les canaux bleu et alpha, utilisés pour les normales.
+ *  - @c "rg16f" : flottants 16 bits, hauteurs et vitesses seulement. Le
+ *    trafic mémoire de la simulation est divisé par deux, mais les normales
+ *    sont alors calculées par le shader de rendu.
+ *  - @c "rg32f" : flottants 32 bits, hauteurs et vitesses seulement, pour
+ *    les longues simulations où les flottants 16 bits sont trop imprécis.
+ *
+ * Les formats à deux canaux sont remplacés par @c "rgba16f" si la carte
+ * graphique ne les accepte pas. Les vagues en cours sont conservées.
+@code
+water_format "eau", "rg16f"
+@endcode
+ */
+water_format(name:text, format:text);
+
+
+/**
+ * @~english
+ * Pack small waters in shared textures.
+ *
+ * Waters of at most 256x256 texels that are shown after this call share
+ * two textures of @p size x @p size texels, instead of each having its
+ * own textures and frame buffer. All the waters of the atlas are updated
+ * together in a single pass when the first of them is drawn, which saves
+ * most of the cost of decks with many small water surfaces.
+ *
+ * Waters simulated on the CPU, in another format than @c "rgba16f", or
+ * queried with @ref water_height_at keep their own textures, as well as
+ * those that do not fit in the atlas. The value 0 (default) disables the
+ * atlas, and waters keep their waves in their own textures.
+ *
+ * Only waters drawn by @ref water_mesh join the atlas, as with
+ * @ref water_surface: the mesh selects the water in the atlas on top of
+ * the texture transform of the unit, and restores it afterwards. Render
+ * shaders must read the water texture through the texture matrix of its
+ * unit. Waters shown with other geometry keep their own textures.
+@code
+water_atlas 2048
+@endcode
+ *
+ * @~french
+ * Regroupe les petites surfaces d'eau dans des textures partagées.
+ *
+ * Les surfaces d'eau d'au plus 256x256 texels affichées après cet appel
+ * partagent deux textures de @p size x @p size texels, au lieu d'avoir
+ * chacune leurs textures et leur frame buffer. Toutes les surfaces de
+ * l'atlas sont mises à jour ensemble en une seule passe lorsque la
+ * première d'entre elles est dessinée, ce qui réduit fortement le coût des
+ * présentations comportant beaucoup de petites surfaces d'eau.
+ *
+ * Les surfaces simulées par le processeur, dans un autre format que
+ * @c "rgba16f" ou interrogées par @ref water_height_at gardent leurs
+ * propres textures, de même que celles qui ne tiennent pas dans l'atlas.
+ * La valeur 0 (par défaut) désactive l'atlas, et les surfaces gardent
+ * leurs vagues dans leurs propres textures.
+ *
+ * Seules les surfaces dessinées par @ref water_mesh rejoignent l'atlas,
+ * comme avec @ref water_surface : le maillage choisit la surface dans
+ * l'atlas en plus de la transformation de texture de l'unité, puis
+ * restaure celle-ci. Les shaders de rendu doivent lire la texture de l'eau
+ * à travers la matrice de texture de son unité. Les surfaces affichées
+ * avec une autre géométrie gardent leurs propres textures.
+@code
+water_atlas 2048
+@endcode
+ */
+water_atlas(size:integer);
+
+
+/**
+ * @~english
+ * Select the equations solved for a water surface.
+ *
+ * The water surface named @p name is simulated with the equations named
+ * @p solver, which may be:
+ *  - @c "wave" (default): the wave equation. Waves move by less than a
+ *    texel per step and are reflected by the edges.
+ *  - @c "swe": the shallow water equations, which move both water and its
+ *    momentum. Waves become steeper in shallow water, carry water along
+ *    and interact with each other, at a few times the cost of a step of the
+ *    wave equation. Their speed depends on @ref water_depth.
+ *  - @c "ocean": an open sea raised by the wind, see @ref water_ocean.
+ *
+ * Shallow waters need the @c "rgba16f" format, and stay out of the atlas
+ * of @ref water_atlas. They run on the CPU when the graphic card cannot
+ * compile their shader. Changing solver makes the surface flat.
+@code
+water_solver "water", "swe"
+@endcode
+ *
+ * @~french
+ * Choisit les équations résolues pour une surface d'eau.
+ *
+ * La surface d'eau nommée @p name est simulée avec les équations nommées
+ * @p solver, qui peuvent être :
+ *  - @c "wave" (par défaut) : l'équation d'onde. Les vagues avancent
+ *    de moins d'un texel par pas et sont réfléchies par les bords.
+ *  - @c "swe" : les équations de Saint-Venant (eau peu profonde), qui
+ *    déplacent l'eau et sa quantité de mouvement. Les vagues se raidissent
+ *    en eau peu profonde, entraînent l'eau et interagissent entre elles,
+ *    pour quelques fois le coût d'un pas de l'équation d'onde. Leur
+ *    vitesse dépend de @ref water_depth.
+ *  - @c "ocean" : une mer ouverte levée par le vent, voir @ref water_ocean.
+ *
+ * Les surfaces en eau peu profonde nécessitent le format @c "rgba16f" et
+ * restent hors de l'atlas de @ref water_atlas. Elles sont simulées par le
+ * processeur si la carte graphique ne peut pas compiler leur shader.
+ * Changer d'équations rend la surface plane.
+@code
+water_solver "eau", "swe"
+@endcode
+ */
+water_solver(name:text, solver:text);
+
+
+/**
+ * @~english
+ * Set the rest depth of a shallow water surface.
+ *
+ * The water surface named @p name is @p depth deep at rest, in the units
+ * of the strength of drops: a drop of strength 10 raises water as much as
+ * the default depth of 10. Waves of the shallow water solver move faster
+ * in deeper water, by @c sqrt(depth)/10 texels per step. The depth is
+ * at most 25, where waves move by half a texel per step.
+ *
+ * Drops deeper than the water leave the bottom dry for a while.
+@code
+water_depth "water", 20
+@endcode
+ *
+ * @~french
+ * Fixe la profondeur au repos d'une surface en eau peu profonde.
+ *
+ * La surface d'eau nommée @p name a une profondeur @p depth au repos,
+ * dans les unités de la force des gouttes : une goutte de force 10 élève
+ * l'eau autant que la profondeur par défaut de 10. Les vagues des
+ * équations de Saint-Venant avancent plus vite en eau plus profonde, de
+ * @c sqrt(depth)/10 texels par pas. La profondeur vaut au plus 25, où
+ * les vagues avancent d'un demi-texel par pas.
+ *
+ * Les gouttes plus profondes que l'eau assèchent le fond un moment.
+@code
+water_depth "eau", 20
+@endcode
+ */
+water_depth(name:text, depth:real);
+
+
+/**
+ * @~english
+ * Turn a water surface into an open ocean.
+ *
+ * The water surface named @p name shows the waves raised by a wind of
+ * @p wind m/s blowing towards @p direction degrees on a square patch of
+ * sea of @p length meters. The waves follow a Phillips spectrum, with the
+ * height of a fully developed sea for this wind. Each frame, the spectrum
+ * is moved to the current time and transformed back into heights by an
+ * FFT on the CPU, so that the cost does not depend on the number of waves.
+ * Heights are in units of the patch size, and the patch tiles seamlessly.
+ *
+ * The grid of the water must be a power of two in each direction, for
+ * example 256x256. Drops are ignored, and the ocean follows the clock of
+ * @ref water_timestep. The same seed gives the same waves, see
+ * @ref water_seed. Use @ref water_solver to go back to another solver.
+@code
+water_ocean "water", 10, 45, 250
+@endcode
+ *
+ * @~french
+ * Transforme une surface d'eau en mer ouverte.
+ *
+ * La surface d'eau nommée @p name montre les vagues levées par un vent de
+ * @p wind m/s soufflant vers la direction @p direction (en degrés) sur un
+ * carré de mer de @p length mètres de côté. Les vagues suivent un spectre
+ * de Phillips, avec la hauteur d'une mer totalement développée pour ce
+ * vent. À chaque image, le spectre est amené à l'instant courant puis
+ * transformé en hauteurs par une FFT sur le processeur, si bien que le
+ * coût ne dépend pas du nombre de vagues. Les hauteurs sont exprimées en
+ * unités de la taille du carré, qui se raccorde sans couture.
+ *
+ * La grille de la surface doit être une puissance de deux dans chaque
+ * direction, par exemple 256x256. Les gouttes sont ignorées, et la mer
+ * suit l'horloge de @ref water_timestep. La même graine donne les mêmes
+ * vagues, voir @ref water_seed. Utilisez @ref water_solver pour revenir à
+ * un autre solveur.
+@code
+water_ocean "eau", 10, 45, 250
+@endcode
+ */
+water_ocean(name:text, wind:real, direction:real, length:real);
+
+
+/**
+ * @~english
+ * Select what happens to waves at the edges of a water surface.
+ *
+ * The boundary @p boundary of the water surface named @p name may be:
+ *  - @c "wall" (default): waves are reflected by the edges.
+ *  - @c "periodic": waves leaving an edge come back from the other side,
+ *    and drops near an edge also rise on the other side. The water then
+ *    tiles seamlessly, and @ref water_repeat shows several copies of it
+ *    over the surface, so that a small simulation covers a large lake.
+ *
+ * Periodic waters keep their own textures instead of using the atlas of
+ * @ref water_atlas. Heights given by @ref water_height_at repeat outside
+ * of [-1, 1].
+@code
+water_boundary "water", "periodic"
+water_repeat "water", 8
+@endcode
+ *
+ * @~french
+ * Choisit ce qui arrive aux vagues sur les bords d'une surface d'eau.
+ *
+ * Le bord @p boundary de la surface d'eau nommée @p name peut être :
+ *  - @c "wall" (par défaut) : les vagues sont réfléchies par les bords.
+ *  - @c "periodic" : les vagues qui sortent par un bord reviennent par le
+ *    bord opposé, et les gouttes proches d'un bord apparaissent aussi de
+ *    l'autre côté. La surface se raccorde alors sans couture, et
+ *    @ref water_repeat en montre plusieurs copies, si bien qu'une petite
+ *    simulation couvre un grand lac.
+ *
+ * Les surfaces périodiques gardent leurs propres textures au lieu
+ * d'utiliser l'atlas de @ref water_atlas. Les hauteurs données par
+ * @ref water_height_at se répètent en dehors de [-1, 1].
+@code
+water_boundary "eau", "periodic"
+water_repeat "eau", 8
+@endcode
+ */
+water_boundary(name:text, boundary:text);
+
+
+/**
+ * @~english
+ * Repeat a periodic water surface.
+ *
+ * The water surface named @p name is shown @p count times along each
+ * side of its surface, when its boundary is @c "periodic". The default
+ * is 1. The copies are drawn by @ref water_mesh, whose mesh should have
+ * enough vertices for the waves of all copies. Other geometry shows one
+ * copy for texture coordinates from 0 to 1, and more copies when its
+ * texture coordinates are scaled, since the texture of a periodic water
+ * repeats.
+@code
+water_repeat "water", 8
+@endcode
+ *
+ * @~french
+ * Répète une surface d'eau périodique.
+ *
+ * La surface d'eau nommée @p name est affichée @p count fois le long de
+ * chaque côté de sa surface, lorsque son bord est @c "periodic". La
+ * valeur par défaut est 1. Les copies sont dessinées par
+ * @ref water_mesh, dont le maillage doit avoir assez de sommets pour les
+ * vagues de toutes les copies. Une autre géométrie montre une copie pour
+ * des coordonnées de texture de 0 à 1, et davantage lorsque ses
+ * coordonnées de texture sont agrandies, car la texture d'une surface
+ * périodique se répète.
+@code
+water_repeat "eau", 8
+@endcode
+ */
+water_repeat(name:text, count:real);
+
+
+/**
+ * @~english
+ * Select where a water surface has no water.
+ *
+ * The dark texels of the image @p file are dry on the water surface named
+ * @p name: islands, piers or shores. The image is scaled to the
+ * simulation grid, its top row being the top of the surface. Dry texels
+ * stay flat, and reflect waves like the edges of the water. Tiles that
+ * are all dry are never simulated. An empty @p file removes the mask,
+ * with the polygons of @ref water_mask_polygon.
+ *
+ * Masked waters keep their own textures instead of using the atlas of
+ * @ref water_atlas. Changing the mask flattens the water.
+@code
+water_mask "water", "islands.png"
+@endcode
+ *
+ * @~french
+ * Choisit où une surface d'eau n'a pas d'eau.
+ *
+ * Les texels sombres de l'image @p file sont secs sur la surface d'eau
+ * nommée @p name : îles, jetées ou rivages. L'image est mise à l'échelle
+ * de la grille de simulation, sa ligne du haut étant le haut de la
+ * surface. Les texels secs restent plats, et réfléchissent les vagues
+ * comme les bords de la surface. Les tuiles entièrement sèches ne sont
+ * jamais simulées. Un @p file vide supprime le masque, avec les polygones
+ * de @ref water_mask_polygon.
+ *
+ * Les surfaces masquées gardent leurs propres textures au lieu d'utiliser
+ * l'atlas de @ref water_atlas. Changer le masque aplatit la surface.
+@code
+water_mask "eau", "iles.png"
+@endcode
+ */
+water_mask(name:text, file:text);
+
+
+/**
+ * @~english
+ * Add a vertex to a dry polygon.
+ *
+ * The vertex @p x, @p y, in the coordinates of @ref add_drop, is added to
+ * the polygon that the next @ref water_mask_polygon adds to the mask of
+ * the water surface named @p name.
+ *
+ * @~french
+ * Ajoute un sommet à un polygone sec.
+ *
+ * Le sommet @p x, @p y, dans les coordonnées de @ref add_drop, est ajouté
+ * au polygone que le prochain @ref water_mask_polygon ajoute au masque de
+ * la surface d'eau nommée @p name.
+ */
+water_mask_vertex(name:text, x:real, y:real);
+
+
+/**
+ * @~english
+ * Add a dry polygon to a water surface.
+ *
+ * The vertices given by @ref water_mask_vertex since the last call make a
+ * polygon, whose texels are dry on the water surface named @p name, as
+ * with @ref water_mask. Polygons that cross themselves are filled with the
+ * even-odd rule. Polygons need at least three vertices.
+@code
+water_mask_vertex "water", -0.2, -0.2
+water_mask_vertex "water", 0.2, -0.2
+water_mask_vertex "water", 0.0, 0.3
+water_mask_polygon "water"
+@endcode
+ *
+ * @~french
+ * Ajoute un polygone sec à une surface d'eau.
+ *
+ * Les sommets donnés par @ref water_mask_vertex depuis le dernier appel
+ * forment un polygone, dont les texels sont secs sur la surface d'eau
+ * nommée @p name, comme avec @ref water_mask. Les polygones qui se
+ * croisent eux-mêmes sont remplis selon la règle pair-impair. Les
+ * polygones ont au moins trois sommets.
+@code
+water_mask_vertex "eau", -0.2, -0.2
+water_mask_vertex "eau", 0.2, -0.2
+water_mask_vertex "eau", 0.0, 0.3
+water_mask_polygon "eau"
+@endcode
+ */
+water_mask_polygon(name:text);
+
+
+/**
+ * @~english
+ * Choose the numeric precision of a water surface.
+ *
+ * Water surfaces simulated on the CPU (see @ref water_backend) store
+ * their heights and velocities as 32-bit floats when @p precision is
+ * @c "float" (default), or as 16-bit fixed-point integers when
+ * @p precision is @c "int16". Fixed-point waters use half the memory, and
+ * move twice as many texels per vector instruction, but their heights are
+ * limited to about +/- 1/64 and small ripples fade slightly sooner. They
+ * only pay off on large grids: a 64x64 water runs about as fast as with
+ * floats, and the gain grows with the size of the grid, up to about twice
+ * as fast for 2048x2048 texels.
+ * Shallow water surfaces and surfaces simulated by shaders always use
+ * floats.
+@code
+water_precision "water", "int16"
+@endcode
+ *
+ * @~french
+ * Choisit la précision numérique d'une surface d'eau.
+ *
+ * Les surfaces d'eau simulées par le processeur (voir @ref water_backend)
+ * stockent leurs hauteurs et vitesses en flottants 32 bits lorsque
+ * @p precision vaut @c "float" (par défaut), ou en entiers à virgule fixe
+ * de 16 bits lorsque @p precision vaut @c "int16". La virgule fixe utilise
+ * moitié moins de mémoire et traite deux fois plus de texels par
+ * instruction vectorielle, mais les hauteurs sont limitées à environ
+ * +/- 1/64 et les petites rides s'estompent un peu plus tôt. Elle n'est
+ * rentable que sur les grandes grilles : une surface de 64x64 va à peu
+ * près aussi vite qu'en flottants, et le gain croît avec la taille de la
+ * grille, jusqu'à environ deux fois plus vite pour 2048x2048 texels. Les surfaces d'eau peu
+ * profonde et celles simulées par des shaders utilisent toujours des
+ * flottants.
+@code
+water_precision "eau", "int16"
+@endcode
+ */
+water_precision(name:text, precision:text);
+
+
 /**
  * @}
  */
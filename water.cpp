@@ -37,12 +37,44 @@
 // If not, see <https://www.gnu.org/licenses/>.
 // *****************************************************************************
 #include "water.h"
+#include "water_atlas.h"
 #include "water_factory.h"
+#include "water_pass.h"
 #include "tao/graphic_state.h"
+#include <QFile>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 
 DLL_PUBLIC Tao::GraphicState * graphic_state = NULL;
 #define tao WaterFactory::instance()->tao
 
+bool Water::rgFormats = false;
+
+// Amplitude under which a water surface is considered flat
+static const float WATER_QUIET = 1e-5f;
+
+// Gravity of the shallow water solver, in heights per step squared.
+// Waves move by sqrt(WATER_GRAVITY * depth) texels per step.
+static const float WATER_GRAVITY = 10.0f;
+
+
+struct WaterSnapshot
+// ----------------------------------------------------------------------------
+//   Header of a snapshot file, followed by RGBA float texels
+// ----------------------------------------------------------------------------
+//   Texels are stored in the native byte order, row by row like in the
+//   textures. Older snapshots only have RG texels, without the momentum
+//   along y of shallow waters.
+{
+    char        magic[8];       // "TAOWATER"
+    quint32     version;
+    quint32     width, height;
+    quint32     channels;       // Height, velocity, gradients or momentum
+};
+static const char    WATER_MAGIC[8] = { 'T','A','O','W','A','T','E','R' };
+static const quint32 WATER_VERSION = 1;
+
 
 
 // ============================================================================
@@ -51,21 +83,31 @@ DLL_PUBLIC Tao::GraphicState * graphic_state = NULL;
 //
 // ============================================================================
 
-// Shaders setting
-bool                  Water::failed = false;
-QGLShaderProgram*     Water::dropShader = NULL;
-QGLShaderProgram*     Water::updateShader = NULL;
-std::map<text, GLint> Water::uniforms;
-
 Water::Water(int w, int h)
 // ----------------------------------------------------------------------------
 //   Construction
 // ----------------------------------------------------------------------------
     : pcontext(NULL), ping(0), pong(0),
-      width(w), height(h), ratio(0.95), strength(1.0), frame(0), pass(0)
+      width(w), height(h), ratio(0.95), strength(1.0), substeps(1),
+      timestep(1.0 / 60), sleepy(true), normals(true), depth(0.01f),
+      repeat(1.0f),
+      resources(NULL), serial(0), failed(false), frame(0), pass(0),
+      format(RGBA16F), solver(WAVE), boundary(WALL), precision(FLOAT32),
+      atlas(NULL), atlasRegion(0),
+      cpu(NULL), ocean(NULL), dirty(false), accumulator(0.0),
+      stepIndex(0), generator(0), seeded(false), feeding(false),
+      maskTexture(0), probed(false), stale(false),
+      amplitude(0.0), sinceCheck(0), asleep(false), measuring(false),
+      meshed(false), shown(false), custom(false),
+      updateTimer("update"), dropTimer("drop"), drawTimer("draw")
 {
+    tiles.resize(width, height);
     checkGLContext();
 
+    // Fall back to the CPU solver if shaders or FBOs are not usable
+    if (failed)
+        useCPU(true);
+
     IFTRACE(water_surface)
             debug() << "Creation successfull" << "\n";
 
@@ -84,6 +126,11 @@ Water::~Water()
 //   Destruction
 // ----------------------------------------------------------------------------
 {
+    if (atlas)
+        atlas->detach(this, false);
+    WaterResources::forget(this);
+    delete cpu;
+    delete ocean;
 }
 
 
@@ -92,21 +139,59 @@ void Water::Draw()
 //   Draw : Do nothing
 // ----------------------------------------------------------------------------
 {
+    // A water shown without water_mesh is drawn by other geometry, which
+    // does not know its region in the atlas nor its copies
+    if (shown && !custom)
+    {
+        custom = true;
+        IFTRACE(water_surface)
+                debug() << "Shown without water_mesh"
+                        << (boundary == PERIODIC && repeat != 1.0f
+                            ? ", drawn without copies" : "") << "\n";
+        if (atlas)
+            atlas->detach(this);
+    }
+    shown = true;
+
+    // Results of the CPU solver are uploaded only once per frame
+    bool host = cpu || ocean;
+    if (host)
+        checkGLContext();
+    drawTimer.begin(host);
+    if (host)
+        upload();
+
     // Use GL state to transfer textures in Tao
     GL.Enable(GL_TEXTURE_2D);
-    switch(pass)
+    if (atlas)
     {
-    case 0: break;
-    case 1: GL.BindTexture(GL_TEXTURE_2D, pong); break;
-    case 2: GL.BindTexture(GL_TEXTURE_2D, ping); break;
-    default:
-        XL_ASSERT(!"Invalid value");
+        // The first water drawn runs the steps of all waters of the atlas
+        atlas->flush();
+        atlas->bind();
+    }
+    else
+    {
+        switch(pass)
+        {
+        case 0: break;
+        case 1: GL.BindTexture(GL_TEXTURE_2D, pong); break;
+        case 2: GL.BindTexture(GL_TEXTURE_2D, ping); break;
+        default:
+            XL_ASSERT(!"Invalid value");
+        }
+        wrapTexture();
     }
 
     // We don't want to use Tao filter settings (notably mipmap settings)
     // So we force textures to GL_LINEAR.
     GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    drawTimer.end();
+
+    // Read heights once per frame, after all steps of the frame
+    if (probed && stale)
+        readBack();
 }
 
 
@@ -128,94 +213,92 @@ void Water::drop(double x, double y, double radius, double strength)
 //   Add a drop to the water
 // ----------------------------------------------------------------------------
 {
-    if(failed)
-        return;
+    DropList list;
+    list.push_back(Drop(x, y, radius, strength));
+    drops(list);
+}
 
-    IFTRACE(water_surface)
-            debug() << "Add drop" << "\n";
 
-    checkGLContext();
+void Water::drops(const DropList &list)
+// ----------------------------------------------------------------------------
+//   Add a batch of drops to the water
+// ----------------------------------------------------------------------------
+//   The drop shader evaluates up to DROPS_PER_PASS drops in a single pass,
+//   so the cost depends on the number of drops, not on the number of passes.
+//   Passes only draw covered tiles, including those of the new drops.
+{
+    if (list.empty())
+        return;
 
-    // Assure we have a correct state before make changes
-    GL.Sync();
+    // While replaying, only drops of the log reach the water
+    if (log.replaying() && !feeding)
+        return;
+    if (log.recording())
+        log.drops(stepIndex, &list[0].x, list.size());
 
-    // Save current settings
-    glPushAttrib(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT |
-                 GL_TEXTURE_BIT | GL_VIEWPORT_BIT);
+    // The ocean only depends on the wind
+    if (ocean)
+        return;
+
+    IFTRACE(water_surface)
+            debug() << "Add " << list.size() << " drops" << "\n";
 
-    // Prepare to draw into buffer
-    GL.BindFramebuffer(GL_FRAMEBUFFER, frame);
+    // Drops wake the water up
+    asleep = false;
+    for (DropList::const_iterator d = list.begin(); d != list.end(); d++)
+        tiles.activate((*d).x, (*d).y, (*d).radius);
 
-    // Switch to correct buffer and bind
-    // the other as a texture
-    switch(pass)
+    if(cpu)
     {
-    case 0:
-        GL.DrawBuffer(GL_COLOR_ATTACHMENT0);
-        break;
-    case 1:
-        GL.DrawBuffer(GL_COLOR_ATTACHMENT0);
-        GL.Enable(GL_TEXTURE_2D);
-        GL.BindTexture(GL_TEXTURE_2D, pong);
-        break;
-    case 2:
-        GL.DrawBuffer(GL_COLOR_ATTACHMENT1);
-        GL.Enable(GL_TEXTURE_2D);
-        GL.BindTexture(GL_TEXTURE_2D, ping);
-        break;
-    default:
-        XL_ASSERT(!"Invalid value");
+        dropTimer.begin(false);
+        for (DropList::const_iterator d = list.begin(); d != list.end(); d++)
+            cpu->drop((*d).x, (*d).y, (*d).radius, (*d).strength);
+        dirty = true;
+        dropTimer.end();
+        return;
     }
 
-    // Clear color
-    GL.ClearColor(0.0, 0.0, 0.0, 1.0);
-    GL.Clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    GL.Viewport(0, 0, width, height);
+    if(failed)
+        return;
 
-    // Bind drop shader
-    GL.UseProgram(dropShader->programId());
+    if (atlas)
+    {
+        dropTimer.begin(true);
+        atlas->drops(this, list);
+        dropTimer.end();
+        return;
+    }
 
-    // Set uniforms
-    GLfloat center[2] = {(float) x, (float) y};
-    GL.Uniform2fv(uniforms["dropCenter"], 1, center);
-    GL.Uniform(uniforms["dropRadius"], (float) radius);
-    GL.Uniform(uniforms["dropStrength"], (float) strength);
+    checkGLContext();
+    dropTimer.begin(true);
 
-    GL.Begin(GL_QUADS);
-    GL.TexCoord( 0 , 0);
-    GL.Vertex  (-width/2, -height/2);
-    GL.TexCoord( 1 , 0);
-    GL.Vertex  ( width/2, -height/2);
-    GL.TexCoord( 1,  1);
-    GL.Vertex  ( width/2,  height/2);
-    GL.TexCoord( 0,  1);
-    GL.Vertex  (-width/2,  height/2);
-    GL.End();
+    // Draw into buffer with the drop shader
+    WaterPass scope(frame, width, height, resources->dropShader->programId());
+    GLint dropsLocation = resources->dropsLocation;
+    GLint countLocation = resources->dropCountLocation;
 
-    GL.UseProgram(0);
+    const uint perPass = WaterResources::DROPS_PER_PASS;
+    const WaterRectList &rects = tiles.rects();
+    for (uint first = 0; first < list.size(); first += perPass)
+    {
+        uint count = list.size() - first;
+        if (count > perPass)
+            count = perPass;
 
-    GL.BindTexture(GL_TEXTURE_2D, 0);
-    GL.Disable(GL_TEXTURE_2D);
+        // No need to clear, tiles not covered are flat in both textures
+        bindPingPong();
 
-    GL.BindFramebuffer(GL_FRAMEBUFFER, 0);
+        // Set uniforms (each drop is laid out as a vec4)
+        GL.Uniform4fv(dropsLocation, count, &list[first].x);
+        GL.Uniform(countLocation, (float) count);
+        GL.Uniform(resources->dropPeriodicLocation,
+                   boundary == PERIODIC ? 1.0f : 0.0f);
 
-    // Ping pong technique
-    switch(pass)
-    {
-    case 0:
-    case 1:
-        pass = 2;
-        break;
-    case 2:
-        pass = 1;
-        break;
-    default:
-        XL_ASSERT(!"Invalid value");
+        drawRects(rects, 1, width, height);
+        swapPingPong();
     }
 
-    // Restore settings
-    glPopAttrib();
+    dropTimer.end();
 }
 
 
@@ -224,445 +307,1496 @@ void Water::randomDrops(int n)
 //   Add some random drops
 // ----------------------------------------------------------------------------
 {
+    DropList list;
+    list.reserve(n);
     for(int i = 0; i < n; i++)
     {
-        double x = XL::xl_random(0.0, 1.0) * 2 - 1;
-        double y = XL::xl_random(0.0, 1.0) * 2 - 1;
-        drop(x, y, 1.0, (i & 1) ? 1.0 : -1.0);
+        double x = random() * 2 - 1;
+        double y = random() * 2 - 1;
+        list.push_back(Drop(x, y, 1.0, (i & 1) ? 1.0 : -1.0));
     }
+    drops(list);
 }
 
 
-void Water::update()
+void Water::seed(quint64 s)
 // ----------------------------------------------------------------------------
-//   Update the water
+//   Make random drops reproducible, starting from the given seed
 // ----------------------------------------------------------------------------
 {
-    if(failed)
-        return;
+    generator = s ? s : 0x9E3779B97F4A7C15ULL;
+    seeded = true;
+}
 
-    IFTRACE(water_surface)
-            debug() << "Update water" << "\n";
 
-    checkGLContext();
+double Water::random()
+// ----------------------------------------------------------------------------
+//   Return a random number in [0, 1)
+// ----------------------------------------------------------------------------
+//   Seeded waters use their own xorshift64* generator, so that the same
+//   seed gives the same drops on all machines and in all runs.
+{
+    if (!seeded)
+        return XL::xl_random(0.0, 1.0);
+
+    generator ^= generator >> 12;
+    generator ^= generator << 25;
+    generator ^= generator >> 27;
+    quint64 bits = generator * 0x2545F4914F6CDD1DULL;
+    return (bits >> 11) * (1.0 / 9007199254740992.0);
+}
 
-    // Assure we have a correct state before make changes
-    GL.Sync();
 
-    // Save current settings
-    glPushAttrib(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_TEXTURE_BIT | GL_VIEWPORT_BIT);
+void Water::queueDrop(double x, double y, double radius, double strength)
+// ----------------------------------------------------------------------------
+//   Record a drop that will be added with the next batch
+// ----------------------------------------------------------------------------
+{
+    queued.push_back(Drop(x, y, radius, strength));
+}
 
-    // Prepare to draw into buffer
-    GL.BindFramebuffer(GL_FRAMEBUFFER, frame);
 
-    // Switch to correct buffer and bind
-    // the other as a texture
-    switch(pass)
-    {
-    case 0:
-        GL.DrawBuffer(GL_COLOR_ATTACHMENT0);
-        break;
-    case 1:
-        GL.DrawBuffer(GL_COLOR_ATTACHMENT0);
-        GL.Enable(GL_TEXTURE_2D);
-        GL.BindTexture(GL_TEXTURE_2D, pong);
-        break;
-    case 2:
-        GL.DrawBuffer(GL_COLOR_ATTACHMENT1);
-        GL.Enable(GL_TEXTURE_2D);
-        GL.BindTexture(GL_TEXTURE_2D, ping);
-        break;
-    default:
-        XL_ASSERT(!"Invalid value");
-    }
+void Water::flushDrops()
+// ----------------------------------------------------------------------------
+//   Add all queued drops in a single batch
+// ----------------------------------------------------------------------------
+{
+    if (queued.empty())
+        return;
+    DropList list;
+    list.swap(queued);
+    drops(list);
+}
 
-    // Clear color
-    GL.ClearColor(0.0, 0.0, 0.0, 1.0);
-    GL.Clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    GL.Viewport(0, 0, width, height);
+void Water::update(int steps)
+// ----------------------------------------------------------------------------
+//   Update the water by running the given number of solver steps
+// ----------------------------------------------------------------------------
+//   All steps share the same state setup: only the ping-pong textures are
+//   swapped between two steps. Only covered tiles are updated, that is
+//   active tiles and those that waves may reach during these steps.
+{
+    // Drops and steps share a single state synchronisation
+    WaterPass::Batch batch;
 
-    // Bind update shader
-    GL.UseProgram(updateShader->programId());
+    // Queued drops must not wait for the next frame
+    flushDrops();
 
-    // Set uniforms
-    GLfloat delta[2] = { 1.0f / width, 1.0f / height};
-    GL.Uniform2fv(uniforms["updateDelta"], 1, delta);
-    GL.Uniform(uniforms["updateRatio"], ratio);
+    if (log.recording())
+        log.update(stepIndex, steps);
+    if (steps > 0)
+        stepIndex += steps;
 
-    GL.Begin(GL_QUADS);
-    GL.TexCoord( 0 , 0);
-    GL.Vertex  (-width/2, -height/2);
-    GL.TexCoord( 1 , 0);
-    GL.Vertex  ( width/2, -height/2);
-    GL.TexCoord( 1,  1);
-    GL.Vertex  ( width/2,  height/2);
-    GL.TexCoord( 0,  1);
-    GL.Vertex  (-width/2,  height/2);
-    GL.End();
+    IFTRACE(water_surface)
+            debug() << "Update water, " << steps << " steps" << "\n";
 
-    GL.UseProgram(0);
+    // The ocean is computed once for the time of the last step
+    if (ocean)
+    {
+        if (steps <= 0)
+            return;
+        double tick = timestep > 0.0 ? timestep : 1.0 / 60;
+        updateTimer.begin(false);
+        ocean->time += steps * tick / std::max(substeps, 1);
+        ocean->compute();
+        dirty = true;
+        updateTimer.end();
+        return;
+    }
 
-    GL.BindTexture(GL_TEXTURE_2D, 0);
-    GL.Disable(GL_TEXTURE_2D);
+    // Calm waters keep showing their flat texture until the next drop
+    if(steps <= 0 || asleep)
+        return;
 
-    GL.BindFramebuffer(GL_FRAMEBUFFER, 0);
+    // Waters of an atlas are all updated together when first drawn
+    if (atlas)
+    {
+        atlas->queue(this, steps);
+        return;
+    }
 
-    // Ping pong technique
-    switch(pass)
+    // Shallow waters run on the CPU without their shader
+    if (solver == SWE && !cpu && !failed)
     {
-    case 0:
-    case 1:
-        pass = 2;
-        break;
-    case 2:
-        pass = 1;
-        break;
-    default:
-        XL_ASSERT(!"Invalid value");
+        checkGLContext();
+        if (!failed && !resources->shallowShader)
+            useCPU(true);
     }
 
-    // Restore settings
-    glPopAttrib();
+    tiles.grow(steps);
 
-}
+    if(cpu)
+    {
+        updateTimer.begin(false);
+        configureCPU();
+        const WaterRectList &retired = tiles.retired();
+        for (uint r = 0; r < retired.size(); r++)
+            cpu->clear(retired[r]);
+        for (int s = 0; s < steps; s++)
+            cpu->update(ratio, tiles.rects());
+        dirty = true;
+        updateTimer.end();
+        settle(steps);
+        return;
+    }
 
+    if(failed)
+        return;
 
-void Water::checkGLContext()
-// ----------------------------------------------------------------------------
-//   Re-create context-dependent resources if GL context has changed
-// ----------------------------------------------------------------------------
-{
-    tao->makeGLContextCurrent();
-    if (pcontext != QGLContext::currentContext())
+    checkGLContext();
+    updateTimer.begin(true);
+    clearRects(tiles.retired());
     {
-        IFTRACE(water_surface)
-                debug() << "Context has changed" << "\n";
+        const WaterRectList &rects = tiles.rects();
 
-        pcontext = QGLContext::currentContext();
+        // Draw into buffer with the update shader
+        bool shallow = solver == SWE;
+        QGLShaderProgram *program = shallow ? resources->shallowShader
+                                            : resources->updateShader;
+        WaterPass scope(frame, width, height, program->programId());
 
-        // Synchronise state
-        GL.Sync();
+        // Dry texels are read from the mask on the second texture unit
+        bool masked = maskTexture != 0;
+        if (masked)
+        {
+            GL.ActiveTexture(GL_TEXTURE1);
+            GL.BindTexture(GL_TEXTURE_2D, maskTexture);
+            GL.ActiveTexture(GL_TEXTURE0);
+        }
+
+        // Set uniforms
+        GLfloat delta[2] = { 1.0f / width, 1.0f / height};
+        if (shallow)
+        {
+            GL.Uniform2fv(resources->shallowDeltaLocation, 1, delta);
+            GL.Uniform(resources->shallowRatioLocation, ratio);
+            GL.Uniform(resources->shallowDepthLocation, depth);
+            GL.Uniform(resources->shallowGravityLocation, WATER_GRAVITY);
+            GL.Uniform(resources->shallowPeriodicLocation,
+                       boundary == PERIODIC ? 1.0f : 0.0f);
+            GL.Uniform(resources->shallowMaskLocation, 1);
+            GL.Uniform(resources->shallowMaskedLocation,
+                       masked ? 1.0f : 0.0f);
+        }
+        else
+        {
+            GL.Uniform2fv(resources->updateDeltaLocation, 1, delta);
+            GL.Uniform(resources->updateRatioLocation, ratio);
+            GL.Uniform(resources->updateMaskLocation, 1);
+            GL.Uniform(resources->updateMaskedLocation,
+                       masked ? 1.0f : 0.0f);
+        }
 
-        createShaders();     // Create all shaders
-        createTexture(ping); // Create ping texture
-        createTexture(pong); // Create pong texture
-        createBuffer();      // Create fbo
+        // No need to clear, tiles not covered are flat in both textures
+        for (int s = 0; s < steps; s++)
+        {
+            bindPingPong();
+            drawRects(rects, 1, width, height);
+            swapPingPong();
+        }
 
-        // Reset pass
-        pass = 0;
+        if (masked)
+        {
+            GL.ActiveTexture(GL_TEXTURE1);
+            GL.BindTexture(GL_TEXTURE_2D, 0);
+            GL.ActiveTexture(GL_TEXTURE0);
+        }
     }
+    updateTimer.end();
+    settle(steps);
 }
 
 
-void Water::createTexture(uint& texId)
+void Water::advance()
 // ----------------------------------------------------------------------------
-//   Create a texture to attach to the fbo
+//   Run one tick of the simulation for each timestep elapsed
 // ----------------------------------------------------------------------------
+//   Waves move at the same speed whatever the rate of evaluation of the
+//   document. After a long pause, or if simulating is slower than real time,
+//   at most MAX_CATCH_UP ticks are run and the remaining time is dropped,
+//   so that a slow frame does not make the next one even slower.
 {
-    // Don't need to create texture if already failed
-    if(failed)
+    if (log.replaying())
+    {
+        replayFrame();
         return;
+    }
 
-    // Create texture for ping pong technic
-    GL.GenTextures(1, &texId);
-    GL.BindTexture(GL_TEXTURE_2D, texId);
+    if (timestep <= 0.0)
+    {
+        update(substeps);
+        return;
+    }
 
-    GL.TexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F_ARB, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    int ticks = 1;
+    if (clock.isValid())
+    {
+        accumulator += clock.nsecsElapsed() * 1e-9;
+        ticks = (int) (accumulator / timestep);
+        if (ticks > MAX_CATCH_UP)
+        {
+            IFTRACE(water_surface)
+                    debug() << "Dropping " << ticks - MAX_CATCH_UP
+                            << " ticks" << "\n";
+            ticks = MAX_CATCH_UP;
+            accumulator = fmod(accumulator, timestep);
+        }
+        else
+        {
+            accumulator -= ticks * timestep;
+        }
+    }
+    clock.start();
 
-    GL.BindTexture(GL_TEXTURE_2D, 0);
+    // Even without any tick due, queued drops must be added
+    update(ticks * substeps);
+}
 
-    tao->showGlErrors();
 
-    IFTRACE(water_surface)
-                debug() << "Create texture: " << texId << "\n";
+bool Water::record(text file)
+// ----------------------------------------------------------------------------
+//   Start logging drops and updates in a file, or stop if file is empty
+// ----------------------------------------------------------------------------
+{
+    if (file.empty())
+    {
+        log.stop();
+        return true;
+    }
+    return log.record(file);
 }
 
 
-void Water::createBuffer()
+bool Water::replay(text file)
 // ----------------------------------------------------------------------------
-//   Create frame buffer
+//   Run the events of a log, one recorded frame each time water is shown
 // ----------------------------------------------------------------------------
+//   Replay ends at the end of the log, or with an empty file name
 {
-    if(frame)
-        GL.DeleteFramebuffers(1, &frame);
+    if (file.empty())
+    {
+        log.stop();
+        return true;
+    }
+    return log.replay(file);
+}
+
 
-    // Check if graphic card has really two color attachments
-    // because we need it to make ping-pong technics
-    GLint max_color_attachments = 0;
-    GL.Get(GL_MAX_COLOR_ATTACHMENTS, &max_color_attachments);
-    if(max_color_attachments < 2)
+void Water::replayFrame()
+// ----------------------------------------------------------------------------
+//   Feed the events of the log up to the next update
+// ----------------------------------------------------------------------------
+//   The step index of each event is checked, to report logs replayed on a
+//   water that does not start where the recording started.
+{
+    WaterEvent event;
+    const float *data;
+    queued.clear();
+    feeding = true;
+    while (log.next(event, data))
     {
-        failed = true;
         IFTRACE(water_surface)
-                    debug() << "No enough color attachments available for this module. " << "\n";
+            if (event.step != stepIndex)
+                debug() << "Replay at step " << stepIndex
+                        << ", recorded at " << event.step << "\n";
+        stepIndex = event.step;
+
+        if (event.kind == WaterEvent::UPDATE)
+        {
+            update(event.count);
+            break;
+        }
+
+        DropList list;
+        list.reserve(event.count);
+        for (uint d = 0; d < event.count; d++, data += 4)
+            list.push_back(Drop(data[0], data[1], data[2], data[3]));
+        drops(list);
     }
+    feeding = false;
+}
 
-    // Don't need to create fbo if already failed
-    if(failed)
-        return;
 
-    // Create fbo and attach textures to it
-    GL.GenFramebuffers(1, &frame); // Generate one frame buffer and store the ID in frame
-    GL.BindFramebuffer(GL_FRAMEBUFFER, frame); // Bind our frame buffer
-    GL.FramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                            GL_TEXTURE_2D, ping, 0);
-    GL.FramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
-                            GL_TEXTURE_2D, pong, 0);
-    checkFramebufferStatus();
-    GL.BindFramebuffer(GL_FRAMEBUFFER, 0);
+void Water::settle(int steps)
+// ----------------------------------------------------------------------------
+//   Deactivate calm tiles, and put the water to sleep once all are calm
+// ----------------------------------------------------------------------------
+//   The amplitude of covered tiles is measured every QUIET_CHECK steps.
+//   Tiles that are not covered are flat, so the water can sleep as soon
+//   as no tile remains active. Waters that are not sleepy, e.g. in
+//   benchmarks, are never measured and keep all their tiles active.
+{
+    sinceCheck += steps;
+    if (!sleepy || sinceCheck < QUIET_CHECK || !measurable())
+        return;
 
-    tao->showGlErrors();
+    sinceCheck = 0;
+    if (!measure() || !tiles.empty())
+        return;
 
     IFTRACE(water_surface)
-                debug() << "Create frame buffer: " << frame << "\n";
+            debug() << "Going to sleep, amplitude " << amplitude << "\n";
+
+    flatten();
+    asleep = true;
 }
 
 
-void Water::createShaders()
+bool Water::measurable()
 // ----------------------------------------------------------------------------
-//   Create shader programs
+//   Check if the amplitude of tiles can be measured
 // ----------------------------------------------------------------------------
+//   Without the reduce shader or fences, or for huge grids, waters never
+//   go to sleep
 {
-    IFTRACE(water_surface)
-                debug() << "Create shaders" << "\n";
-
-    createDropShader();
-    createUpdateShader();
+    if (cpu)
+        return true;
+    return resources && resources->reduceShader && pass != 0 &&
+           WaterReadback::fences &&
+           tiles.size <= WaterResources::REDUCE_BLOCK &&
+           tiles.columns <= WaterResources::REDUCE_SIZE &&
+           tiles.rows <= WaterResources::REDUCE_SIZE;
 }
 
 
-void Water::createDropShader()
+bool Water::measure()
 // ----------------------------------------------------------------------------
-//   Create shader used to add drops
+//   Settle tiles on their latest measured amplitude, false if none is new
 // ----------------------------------------------------------------------------
+//   The CPU solver is measured right away. On the GPU, the reduce shader
+//   computes one maximum per covered tile, which is read back through a
+//   pixel buffer and only collected once the GPU completed it, usually at
+//   the next check. Tiles then settle on the amplitude they had when the
+//   measure started, and the next measure starts.
 {
-    if(!failed)
+    int count = tiles.columns * tiles.rows;
+    const WaterRectList &rects = tiles.rects();
+    if (cpu)
     {
-        IFTRACE(water_surface)
-                debug() << "Create drop shader" << "\n";
-
-        delete dropShader;
-
-        dropShader = new QGLShaderProgram(pcontext);
-        bool ok = false;
-
-        // Basic vertex shader
-        static string vSrc =
-                "/********************************************************************************\n"
-                "**                                                                               \n"
-                "** Copyright (C) 2011 Taodyne.                                                   \n"
-                "** All rights reserved.                                                          \n"
-                "** Contact: Taodyne (contact@taodyne.com)                                        \n"
-                "**                                                                               \n"
-                "** This file is part of the Tao3D application, developped by Taodyne.\n"
-                "** It can be only used in the software and these modules.                        \n"
-                "**                                                                               \n"
-                "** If you have questions regarding the use of this file, please contact          \n"
-                "** Taodyne at contact@taodyne.com.                                               \n"
-                "**                                                                               \n"
-                "********************************************************************************/\n"
-                "varying vec2 coord;"
-                "void main()"
-                "{"
-                "   coord = gl_Vertex.xy * 0.5 + 0.5;"
-                "   gl_Position = vec4(gl_Vertex.xyz, 1.0);"
-                "}";
-
-        static string fSrc =
-                "/********************************************************************************\n"
-                "**                                                                               \n"
-                "** Copyright (C) 2011 Taodyne.                                                   \n"
-                "** All rights reserved.                                                          \n"
-                "** Contact: Taodyne (contact@taodyne.com)                                        \n"
-                "**                                                                               \n"
-                "** This file is part of the Tao3D application, developped by Taodyne.\n"
-                "** It can be only used in the software and these modules.                        \n"
-                "**                                                                               \n"
-                "** If you have questions regarding the use of this file, please contact          \n"
-                "** Taodyne at contact@taodyne.com.                                               \n"
-                "**                                                                               \n"
-                "********************************************************************************/\n"
-                "const float PI = 3.141592653589793;"
-                "uniform sampler2D texture;"
-                "uniform vec2 center;"
-                "uniform float radius;"
-                "uniform float strength;"
-                "uniform int   textureId;"
-                "varying vec2 coord;"
-                "void main() {"
-                "   vec4 info = texture2D(texture, coord);"
-
-                "   float drop = max(0.0, 1.0 - length(center * 0.5 + 0.5 - coord) / (radius / 100.0));"
-                "   drop = 0.5 - cos(drop * PI) * 0.5;"
-                "   info.r += drop * (strength / 1000.0);"
-                "   gl_FragColor = vec4(info.rgb, 1.0);"
-                "}";
-
-
-        if (dropShader->addShaderFromSourceCode(QGLShader::Vertex, vSrc.c_str()))
+        staging.assign(count, 0.0f);
+        for (uint r = 0; r < rects.size(); r++)
         {
-            if (dropShader->addShaderFromSourceCode(QGLShader::Fragment, fSrc.c_str()))
-            {
-                ok = true;
-            }
-            else
+            WaterRect tile = rects[r];
+            int ty = tile.y0 / tiles.size;
+            for (int x = rects[r].x0; x < rects[r].x1; x += tiles.size)
             {
-                std::cerr << "Drop shader" << "\n";
-                std::cerr << "Error loading fragment shader code: " << "\n";
-                std::cerr << dropShader->log().toStdString();
+                tile.x0 = x;
+                tile.x1 = std::min(x + tiles.size, width);
+                staging[ty * tiles.columns + x / tiles.size] =
+                    cpu->amplitude(tile);
             }
         }
-        else
-        {
-            std::cerr << "Drop shader" << "\n";
-            std::cerr << "Error loading vertex shader code: " << "\n";
-            std::cerr << dropShader->log().toStdString();
-        }
+        tiles.sample();
+        amplitude = tiles.settle(&staging[0], WATER_QUIET);
+        measuring = false;
+        return true;
+    }
 
-        if (!ok)
-        {
-            delete dropShader;
-            dropShader = NULL;
-            failed = true;
-        }
-        else
-        {
-            dropShader->link();
+    // Settle on the measure started at a previous check, if complete
+    bool done = measures.collect() && measuring;
+    if (done && measures.size() == (uint) count)
+        amplitude = tiles.settle(measures.values(), WATER_QUIET);
+    else
+        done = false;
+    if (measures.pending() || tiles.empty())
+        return done;
 
-            // Save uniform locations
-            uint id = dropShader->programId();
-            uniforms["dropCenter"]    = GL.GetUniformLocation(id, "center");
-            uniforms["dropRadius"]    = GL.GetUniformLocation(id, "radius");
-            uniforms["dropStrength"]  = GL.GetUniformLocation(id, "strength");
-        }
+    // Start the next measure
+    {
+        WaterPass scope(resources->reduceFrame, tiles.columns, tiles.rows,
+                        resources->reduceShader->programId());
+        GL.DrawBuffer(GL_COLOR_ATTACHMENT0);
+        GL.Enable(GL_TEXTURE_2D);
+        GL.BindTexture(GL_TEXTURE_2D, pass == 2 ? ping : pong);
+
+        GLfloat delta[2] = { 1.0f / width, 1.0f / height };
+        GLfloat block[2] = { (float) tiles.size, (float) tiles.size };
+        GL.Uniform2fv(resources->reduceDeltaLocation, 1, delta);
+        GL.Uniform2fv(resources->reduceBlockLocation, 1, block);
+        drawRects(rects, tiles.size, tiles.columns, tiles.rows);
+
+        GL.Sync();
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        measures.request(tiles.columns, tiles.rows);
     }
+    tiles.sample();
+    measuring = true;
+    return done;
 }
 
 
-void Water::createUpdateShader()
+void Water::flatten()
 // ----------------------------------------------------------------------------
-//   Create shader used to update water
+//   Make the surface exactly flat
 // ----------------------------------------------------------------------------
+//   Residual ripples below the threshold are removed, so that the texture
+//   shown while sleeping does not depend on when the water fell asleep.
 {
-    if(!failed)
+    if (cpu)
     {
-        IFTRACE(water_surface)
-                debug() << "Create update shader" << "\n";
-
-        delete updateShader;
-
-        updateShader = new QGLShaderProgram(pcontext);
-        bool ok = false;
-
-        // Basic vertex shader
-        static string vSrc =
-                "/********************************************************************************\n"
-                "**                                                                               \n"
-                "** Copyright (C) 2011 Taodyne.                                                   \n"
-                "** All rights reserved.                                                          \n"
-                "** Contact: Taodyne (contact@taodyne.com)                                        \n"
-                "**                                                                               \n"
-                "** This file is part of the Tao3D application, developped by Taodyne.\n"
-                "** It can be only used in the software and these modules.                        \n"
-                "**                                                                               \n"
-                "** If you have questions regarding the use of this file, please contact          \n"
-                "** Taodyne at contact@taodyne.com.                                               \n"
-                "**                                                                               \n"
-                "********************************************************************************/\n"
-                "varying vec2 coord;"
-                "void main()"
-                "{"
-                "   coord = gl_Vertex.xy * 0.5 + 0.5;"
-                "   gl_Position = vec4(gl_Vertex.xyz, 1.0);"
-                "}";
-
-        static string fSrc =
-                "/********************************************************************************\n"
-                "**                                                                               \n"
-                "** Copyright (C) 2011 Taodyne.                                                   \n"
-                "** All rights reserved.                                                          \n"
-                "** Contact: Taodyne (contact@taodyne.com)                                        \n"
-                "**                                                                               \n"
-                "** This file is part of the Tao3D application, developped by Taodyne.\n"
-                "** It can be only used in the software and these modules.                        \n"
-                "**                                                                               \n"
-                "** If you have questions regarding the use of this file, please contact          \n"
-                "** Taodyne at contact@taodyne.com.                                               \n"
-                "**                                                                               \n"
-                "********************************************************************************/\n"
-                "uniform sampler2D texture;"
-                "uniform float ratio;"
-                "uniform vec2 delta;"
-                ""
-                "varying vec2 coord;"
-                "void main() {"
-                "  /* get vertex info */"
-                "  vec4 info = texture2D(texture, coord);"
-                "  "
-                "  /* calculate average neighbor height */"
-                "  vec2 dx = vec2(delta.x, 0.0);"
-                "  vec2 dy = vec2(0.0, delta.y);"
-                "  float average = ("
-                "    texture2D(texture, coord - dx).r +"
-                "    texture2D(texture, coord - dy).r +"
-                "    texture2D(texture, coord + dx).r +"
-                "    texture2D(texture, coord + dy).r"
-                "  ) * 0.25;"
-                "  "
-                "  /* change the velocity to move toward the average */"
-                "  info.g += (average - info.r) * 2.0;"
-                "  "
-                "  /* attenuate the velocity a little so waves do not last forever */"
-                "  info.g *= ratio;"
-                "  "
-                "  /* move the vertex along the velocity */"
-                "  info.r += info.g;"
-                ""
-                "  gl_FragColor = vec4(info.rgb, 1.0);"
-                "}";
-
-
-        if (updateShader->addShaderFromSourceCode(QGLShader::Vertex, vSrc.c_str()))
-        {
-            if (updateShader->addShaderFromSourceCode(QGLShader::Fragment, fSrc.c_str()))
-            {
-                ok = true;
-            }
-            else
-            {
-                std::cerr << "Update shader" << "\n";
-                std::cerr << "Error loading fragment shader code: " << "\n";
-                std::cerr << updateShader->log().toStdString();
-            }
-        }
-        else
-        {
-            std::cerr << "Update shader" << "\n";
-            std::cerr << "Error loading vertex shader code: " << "\n";
-            std::cerr << updateShader->log().toStdString();
-        }
+        cpu->clear();
+        dirty = true;
+    }
+    else
+    {
+        WaterRectList all(1);
+        all[0].x0 = all[0].y0 = 0;
+        all[0].x1 = width;
+        all[0].y1 = height;
+        clearRects(all);
+    }
+    tiles.clear();
+}
+
+
+void Water::clearRects(const WaterRectList &rects)
+// ----------------------------------------------------------------------------
+//   Flatten rectangles in both ping-pong textures
+// ----------------------------------------------------------------------------
+{
+    if (rects.empty())
+        return;
+
+    WaterPass scope(frame, width, height, resources->clearShader->programId());
+    GL.DrawBuffer(GL_COLOR_ATTACHMENT0);
+    drawRects(rects, 1, width, height);
+    GL.DrawBuffer(GL_COLOR_ATTACHMENT1);
+    drawRects(rects, 1, width, height);
+    stale = true;
+}
+
+
+void Water::bindPingPong()
+// ----------------------------------------------------------------------------
+//   Switch to correct buffer and bind the other as a texture
+// ----------------------------------------------------------------------------
+{
+    switch(pass)
+    {
+    case 0:
+        GL.DrawBuffer(GL_COLOR_ATTACHMENT0);
+        break;
+    case 1:
+        GL.DrawBuffer(GL_COLOR_ATTACHMENT0);
+        GL.Enable(GL_TEXTURE_2D);
+        GL.BindTexture(GL_TEXTURE_2D, pong);
+        break;
+    case 2:
+        GL.DrawBuffer(GL_COLOR_ATTACHMENT1);
+        GL.Enable(GL_TEXTURE_2D);
+        GL.BindTexture(GL_TEXTURE_2D, ping);
+        break;
+    default:
+        XL_ASSERT(!"Invalid value");
+    }
+}
+
+
+void Water::swapPingPong()
+// ----------------------------------------------------------------------------
+//   Ping pong technique
+// ----------------------------------------------------------------------------
+{
+    switch(pass)
+    {
+    case 0:
+    case 1:
+        pass = 2;
+        break;
+    case 2:
+        pass = 1;
+        break;
+    default:
+        XL_ASSERT(!"Invalid value");
+    }
+    stale = true;
+}
+
+
+void Water::drawRects(const WaterRectList &rects, int unit, int w, int h)
+// ----------------------------------------------------------------------------
+//   Draw one quad per rectangle, in a viewport of w x h
+// ----------------------------------------------------------------------------
+//   Texel coordinates of rectangles are divided by 'unit', rounding up the
+//   end, so that one pixel per tile is drawn when 'unit' is the tile size.
+{
+    GL.Begin(GL_QUADS);
+    for (uint r = 0; r < rects.size(); r++)
+    {
+        const WaterRect &rect = rects[r];
+        double x0 = 2.0 * (rect.x0 / unit) / w - 1.0;
+        double x1 = 2.0 * ((rect.x1 + unit - 1) / unit) / w - 1.0;
+        double y0 = 2.0 * (rect.y0 / unit) / h - 1.0;
+        double y1 = 2.0 * ((rect.y1 + unit - 1) / unit) / h - 1.0;
+        GL.Vertex(x0, y0);
+        GL.Vertex(x1, y0);
+        GL.Vertex(x1, y1);
+        GL.Vertex(x0, y1);
+    }
+    GL.End();
+}
+
+
+void Water::checkGLContext()
+// ----------------------------------------------------------------------------
+//   Re-create context-dependent resources if GL context has changed
+// ----------------------------------------------------------------------------
+//   Shaders are shared by all waters of a context, and only built once.
+//   Comparing serials rather than context pointers also catches a new
+//   context allocated where a destroyed one used to be.
+{
+    tao->makeGLContextCurrent();
+    WaterResources *current = WaterResources::current();
+    if (serial != current->serial)
+    {
+        IFTRACE(water_surface)
+                debug() << "Context has changed" << "\n";
+
+        pcontext = QGLContext::currentContext();
+        resources = current;
+        serial = current->serial;
+        failed = current->failed;
+
+        // Synchronise state
+        GL.Sync();
+
+        createTextures();
+
+        // Reset pass
+        pass = 0;
+
+        // New textures need the CPU state again
+        if (cpu)
+            dirty = true;
+
+        // The mask texture belonged to the previous context
+        maskTexture = 0;
+        uploadMask();
+
+        // Let the water settle again on the new textures
+        wake();
+
+        // Timer queries and readback buffers belonged to the previous context
+        updateTimer.reset();
+        dropTimer.reset();
+        drawTimer.reset();
+        readback.reset();
+        measures.reset();
+        mesh.reset();
+    }
+}
+
+
+void Water::stats(std::ostream &out)
+// ----------------------------------------------------------------------------
+//   Print timing statistics of the water operations
+// ----------------------------------------------------------------------------
+{
+    updateTimer.report(out);
+    dropTimer.report(out);
+    drawTimer.report(out);
+}
+
+
+float Water::heightAt(double x, double y)
+// ----------------------------------------------------------------------------
+//   Height of the surface at x, y, without waiting for the GPU
+// ----------------------------------------------------------------------------
+//   The CPU solver is sampled directly. Shader heights are read back
+//   asynchronously, starting with the first query, so the result lags one
+//   or two frames behind, and is 0 until the first read completes.
+{
+    // Periodic waters repeat outside of [-1, 1]
+    if (boundary == PERIODIC)
+    {
+        x -= 2.0 * floor((x + 1.0) * 0.5);
+        y -= 2.0 * floor((y + 1.0) * 0.5);
+    }
+
+    if (ocean)
+        return WaterReadback::sample(ocean->surface(), width, height,
+                                     width, x, y);
+    if (cpu)
+        return cpu->sample(x, y);
+
+    if (!probed)
+    {
+        if (atlas)
+            atlas->detach(this);
+        probed = true;
+        stale = true;
+    }
+    tao->makeGLContextCurrent();
+    readback.collect();
+    return readback.sample(x, y);
+}
+
+
+void Water::drawMesh(double w, double h)
+// ----------------------------------------------------------------------------
+//   Draw the surface mesh, with the resolution of the simulation grid
+// ----------------------------------------------------------------------------
+//   Render shaders map coordinates with the texture matrix of unit 0.
+//   The mapping of the water is applied on top of the texture transform
+//   of the user, which is restored once the mesh is drawn.
+{
+    shown = false;
+    meshed = true;
+
+    checkGLContext();
+    GL.ActiveTexture(GL_TEXTURE0);
+    GL.MatrixMode(GL_TEXTURE);
+    GL.PushMatrix();
+    mapTexture();
+    GL.MatrixMode(GL_MODELVIEW);
+
+    mesh.draw(width, height, w, h);
+
+    GL.ActiveTexture(GL_TEXTURE0);
+    GL.MatrixMode(GL_TEXTURE);
+    GL.PopMatrix();
+    GL.MatrixMode(GL_MODELVIEW);
+}
+
+
+void Water::mapTexture()
+// ----------------------------------------------------------------------------
+//   Map texture coordinates in [0, 1] to the simulation of the water
+// ----------------------------------------------------------------------------
+//   Waters of an atlas select their region, periodic waters are repeated
+//   over the surface. The current matrix must be the texture matrix.
+{
+    if (atlas)
+        atlas->map(this);
+    else if (boundary == PERIODIC)
+        GL.Scale(repeat, repeat, 1.0);
+}
+
+
+void Water::readBack()
+// ----------------------------------------------------------------------------
+//   Queue an asynchronous read of the latest heights
+// ----------------------------------------------------------------------------
+{
+    if (cpu || failed)
+        return;
+
+    checkGLContext();
+    if (pass == 0)
+        return;
+
+    WaterPass scope(frame, width, height, 0);
+    GL.Sync();
+    glReadBuffer(pass == 2 ? GL_COLOR_ATTACHMENT0 : GL_COLOR_ATTACHMENT1);
+    readback.request(width, height);
+    stale = false;
+}
+
+
+void Water::resize(int w, int h)
+// ----------------------------------------------------------------------------
+//   Change the resolution of the simulation grid
+// ----------------------------------------------------------------------------
+//   The water surface becomes flat again
+{
+    if (w == width && h == height)
+        return;
 
-        if (!ok)
+    IFTRACE(water_surface)
+            debug() << "Resize to " << w << "x" << h << "\n";
+
+    if (atlas)
+        atlas->detach(this, false);
+
+    width = w;
+    height = h;
+    tiles.resize(width, height);
+    asleep = false;
+    sinceCheck = 0;
+
+    if (cpu)
+    {
+        delete cpu;
+        cpu = new WaterCPU(width, height);
+        configureCPU();
+        dirty = true;
+    }
+
+    // The ocean keeps its wind if the FFT fits the new grid
+    if (ocean)
+    {
+        WaterOcean *old = ocean;
+        ocean = NULL;
+        solver = WAVE;
+        if (WaterOcean::fits(width, height))
         {
-            delete updateShader;
-            updateShader = NULL;
-            failed = true;
+            ocean = new WaterOcean(width, height);
+            ocean->time = old->time;
+            ocean->wind = old->wind;
+            ocean->direction = old->direction;
+            ocean->length = old->length;
+            ocean->spectrum(seeded ? generator : 1);
+            ocean->compute();
+            solver = OCEAN;
+            dirty = true;
         }
+        delete old;
+    }
+
+    // Textures of another context are re-created by checkGLContext
+    tao->makeGLContextCurrent();
+    if (pcontext == QGLContext::currentContext())
+    {
+        GL.Sync();
+        GL.DeleteTextures(1, &ping);
+        GL.DeleteTextures(1, &pong);
+        createTextures();
+        pass = 0;
+    }
+
+    // The mask is rasterized again for the new grid
+    applyMask();
+}
+
+
+void Water::useCPU(bool enable)
+// ----------------------------------------------------------------------------
+//   Switch between the shader and the CPU simulation
+// ----------------------------------------------------------------------------
+//   The current state is carried over through the ping-pong textures,
+//   so that waves are not lost when changing backend.
+{
+    if (enable == (cpu != NULL))
+        return;
+
+    IFTRACE(water_surface)
+            debug() << "Use " << (enable ? WaterCPU::kernel() : "GPU")
+                    << " solver" << "\n";
+
+    if (enable)
+    {
+        if (atlas)
+            atlas->detach(this);
+        cpu = new WaterCPU(width, height);
+        configureCPU();
+        if (!mask.dry.empty())
+            cpu->mask(&mask.dry[0]);
+        dirty = true;
+        if (pass == 0)
+            return;
+
+        // Read back the latest state computed by the shaders,
+        // with the momentum along y of shallow waters
+        int channels = solver == SWE ? 4 : 2;
+        download(channels);
+        cpu->unpack(&staging[0], channels);
+    }
+    else
+    {
+        // Keep the CPU solver if shaders cannot be used
+        if (failed)
+            return;
+
+        upload();
+        delete cpu;
+        cpu = NULL;
+        dirty = false;
+    }
+}
+
+
+void Water::configureCPU()
+// ----------------------------------------------------------------------------
+//   Give the solver, depth, boundary and precision to the CPU solver
+// ----------------------------------------------------------------------------
+{
+    cpu->shallow = solver == SWE;
+    cpu->depth = depth;
+    cpu->gravity = WATER_GRAVITY;
+    cpu->periodic = boundary == PERIODIC;
+    cpu->useFixed(precision == INT16 && solver == WAVE);
+}
+
+
+void Water::wrapTexture()
+// ----------------------------------------------------------------------------
+//   Set the wrap mode of the bound ping-pong texture for the boundary
+// ----------------------------------------------------------------------------
+//   Neighbours read by the update shaders past the edges are those of the
+//   other side when the texture repeats, and renders tile seamlessly
+{
+    GLenum wrap = boundary == PERIODIC ? GL_REPEAT : GL_CLAMP_TO_EDGE;
+    GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+    GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+}
+
+
+bool Water::useMask(text file)
+// ----------------------------------------------------------------------------
+//   Use an image as the mask, where dark texels have no water
+// ----------------------------------------------------------------------------
+//   An empty file name removes the mask, with its polygons
+{
+    if (file == "")
+        mask.clear();
+    else if (!mask.load(file))
+        return false;
+
+    IFTRACE(water_surface)
+            debug() << "Use mask " << file << "\n";
+
+    applyMask();
+    return true;
+}
+
+
+void Water::maskVertex(double x, double y)
+// ----------------------------------------------------------------------------
+//   Add a vertex to the polygon being built, in drop coordinates
+// ----------------------------------------------------------------------------
+{
+    maskVertices.push_back(x);
+    maskVertices.push_back(y);
+}
+
+
+void Water::maskPolygon()
+// ----------------------------------------------------------------------------
+//   Add the polygon of the vertices recorded by maskVertex to the mask
+// ----------------------------------------------------------------------------
+{
+    if (maskVertices.size() >= 6)
+    {
+        IFTRACE(water_surface)
+                debug() << "Mask polygon of " << maskVertices.size() / 2
+                        << " vertices" << "\n";
+        mask.polygon(maskVertices);
+        applyMask();
+    }
+    maskVertices.clear();
+}
+
+
+void Water::applyMask()
+// ----------------------------------------------------------------------------
+//   Rasterize the mask for the grid, and give it to all backends
+// ----------------------------------------------------------------------------
+//   Tiles that are all dry are never simulated, neither by the shaders nor
+//   on the CPU. Waves are removed, so that no wave is left on dry texels.
+{
+    bool wasMasked = !mask.dry.empty();
+    mask.rasterize(width, height);
+    if (!wasMasked && mask.dry.empty())
+        return;
+    if (atlas)
+        atlas->detach(this);
+
+    const uchar *dry = mask.dry.empty() ? NULL : &mask.dry[0];
+    tiles.mask(dry);
+    if (cpu)
+        cpu->mask(dry);
+
+    // Textures of another context get the mask when re-created
+    tao->makeGLContextCurrent();
+    bool current = pcontext == QGLContext::currentContext() && !failed;
+    if (current)
+        uploadMask();
+    if (cpu || current)
+        flatten();
+    wake();
+}
+
+
+void Water::uploadMask()
+// ----------------------------------------------------------------------------
+//   Copy the dry texels into the mask texture, in red
+// ----------------------------------------------------------------------------
+//   Nearest filtering keeps reads of the update shaders at texel centers
+//   exactly wet or dry. The texture is deleted when the mask is empty.
+{
+    if (mask.dry.empty())
+    {
+        if (maskTexture)
+            GL.DeleteTextures(1, &maskTexture);
+        maskTexture = 0;
+        return;
+    }
+
+    std::vector<uchar> rgba(4 * width * height, 0);
+    for (int i = 0; i < width * height; i++)
+        rgba[4 * i] = mask.dry[i] ? 255 : 0;
+
+    if (!maskTexture)
+        GL.GenTextures(1, &maskTexture);
+    GL.BindTexture(GL_TEXTURE_2D, maskTexture);
+    GL.TexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0,
+                  GL_RGBA, GL_UNSIGNED_BYTE, &rgba[0]);
+    wrapTexture();
+    GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    GL.BindTexture(GL_TEXTURE_2D, 0);
+
+    IFTRACE(water_surface)
+            debug() << "Upload mask: " << maskTexture << "\n";
+}
+
+
+void Water::upload()
+// ----------------------------------------------------------------------------
+//   Copy the CPU simulation into the next ping-pong texture
+// ----------------------------------------------------------------------------
+{
+    checkGLContext();
+    if (!dirty)
+        return;
+
+    staging.resize(4 * width * height);
+    if (ocean)
+        ocean->pack(&staging[0], gradients());
+    else
+        cpu->pack(&staging[0], gradients());
+
+    // Write the texture that is not currently displayed
+    GL.BindTexture(GL_TEXTURE_2D, pass == 2 ? pong : ping);
+    GL.Sync();
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height,
+                    GL_RGBA, GL_FLOAT, &staging[0]);
+    GL.BindTexture(GL_TEXTURE_2D, 0);
+
+    // Ping pong technique
+    pass = (pass == 2) ? 1 : 2;
+    dirty = false;
+}
+
+
+void Water::download(int channels)
+// ----------------------------------------------------------------------------
+//   Read the latest state computed by the shaders as texels into staging
+// ----------------------------------------------------------------------------
+//   Texels have 2 (RG) or 4 (RGBA) floats
+{
+    if (atlas)
+        atlas->detach(this);
+    checkGLContext();
+    staging.assign(channels * width * height, 0.0f);
+    if (failed || pass == 0)
+        return;
+
+    GL.BindTexture(GL_TEXTURE_2D, pass == 2 ? ping : pong);
+    GL.Sync();
+    glGetTexImage(GL_TEXTURE_2D, 0, channels == 4 ? GL_RGBA : GL_RG,
+                  GL_FLOAT, &staging[0]);
+    GL.BindTexture(GL_TEXTURE_2D, 0);
+}
+
+
+bool Water::save(text file)
+// ----------------------------------------------------------------------------
+//   Write the current heights and velocities in a snapshot file
+// ----------------------------------------------------------------------------
+//   Texels are those of the texture, so that they can be uploaded as is.
+//   Blue and alpha are 0 when they hold neither gradients nor momentum.
+{
+    if (cpu || ocean)
+    {
+        staging.resize(4 * width * height);
+        if (ocean)
+            ocean->pack(&staging[0], gradients());
         else
-        {
-            updateShader->link();
+            cpu->pack(&staging[0], gradients());
+    }
+    else
+    {
+        download(4);
+        if (!gradients() && solver == WAVE)
+            for (uint t = 0; t < staging.size(); t += 4)
+                staging[t + 2] = staging[t + 3] = 0.0f;
+    }
 
-            // Save uniform locations
-            uint id = updateShader->programId();
-            uniforms["updateDelta"] = GL.GetUniformLocation(id, "delta");
-            uniforms["updateRatio"] = GL.GetUniformLocation(id, "ratio");
-        }
+    WaterSnapshot header;
+    memcpy(header.magic, WATER_MAGIC, sizeof(header.magic));
+    header.version = WATER_VERSION;
+    header.width = width;
+    header.height = height;
+    header.channels = 4;
+
+    QFile out(QString::fromStdString(file));
+    qint64 size = staging.size() * sizeof(float);
+    bool ok = out.open(QIODevice::WriteOnly) &&
+        out.write((const char *) &header, sizeof(header)) == sizeof(header) &&
+        out.write((const char *) &staging[0], size) == size;
+
+    IFTRACE(water_surface)
+            debug() << (ok ? "Saved " : "Failed to save ") << file << "\n";
+    return ok;
+}
+
+
+bool Water::load(text file)
+// ----------------------------------------------------------------------------
+//   Replace the state of the water with that of a snapshot file
+// ----------------------------------------------------------------------------
+//   The file is mapped in memory and its texels are given as is to the
+//   CPU solver or to the texture. The grid takes the size of the snapshot.
+//   The ocean is computed from its spectrum, and cannot be restored.
+{
+    if (solver == OCEAN)
+    {
+        IFTRACE(water_surface)
+                debug() << "Cannot load " << file << " in an ocean" << "\n";
+        return false;
+    }
+
+    QFile in(QString::fromStdString(file));
+    if (!in.open(QIODevice::ReadOnly) || in.size() < (qint64) sizeof(WaterSnapshot))
+    {
+        IFTRACE(water_surface)
+                debug() << "Cannot open snapshot " << file << "\n";
+        return false;
+    }
+
+    uchar *data = in.map(0, in.size());
+    const WaterSnapshot *header = (const WaterSnapshot *) data;
+    if (!data ||
+        memcmp(header->magic, WATER_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != WATER_VERSION ||
+        (header->channels != 2 && header->channels != 4) ||
+        header->width == 0 || header->height == 0 ||
+        in.size() != (qint64) (sizeof(WaterSnapshot) + sizeof(float) *
+                               header->channels * header->width *
+                               header->height))
+    {
+        IFTRACE(water_surface)
+                debug() << "Invalid snapshot " << file << "\n";
+        return false;
+    }
+
+    resize(header->width, header->height);
+    const float *texels = (const float *) (data + sizeof(WaterSnapshot));
+    if (cpu)
+    {
+        cpu->unpack(texels, header->channels);
+        dirty = true;
+    }
+    else
+    {
+        checkGLContext();
+        if (failed)
+            return false;
+        restore(texels, header->channels);
+    }
+
+    // Waves may be anywhere in the snapshot
+    wake();
+
+    IFTRACE(water_surface)
+            debug() << "Loaded " << file << "\n";
+    return true;
+}
+
+
+void Water::restore(const float *texels, int channels)
+// ----------------------------------------------------------------------------
+//   Write texels into the texture that is not displayed, and show it
+// ----------------------------------------------------------------------------
+//   RGBA texels are uploaded as is. Older RG texels go through a CPU solver,
+//   which recomputes the gradients that the render shader expects in blue
+//   and alpha, or sets the momentum along y of shallow waters to 0.
+{
+    if (atlas)
+        atlas->detach(this, false);
+
+    std::vector<float> rgba;
+    if (channels != 4)
+    {
+        WaterCPU state(width, height);
+        state.shallow = solver == SWE;
+        state.periodic = boundary == PERIODIC;
+        state.unpack(texels, channels);
+        rgba.resize(4 * width * height);
+        state.pack(&rgba[0], gradients());
+        texels = &rgba[0];
+    }
+
+    GL.BindTexture(GL_TEXTURE_2D, pass == 2 ? pong : ping);
+    GL.Sync();
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height,
+                    GL_RGBA, GL_FLOAT, texels);
+    GL.BindTexture(GL_TEXTURE_2D, 0);
+    pass = (pass == 2) ? 1 : 2;
+    stale = true;
+}
+
+
+void Water::wake()
+// ----------------------------------------------------------------------------
+//   Mark all tiles active, as when waves may be anywhere
+// ----------------------------------------------------------------------------
+{
+    tiles.activateAll();
+    asleep = false;
+    sinceCheck = 0;
+}
+
+
+bool Water::useFormat(text name)
+// ----------------------------------------------------------------------------
+//   Select the internal format of the ping-pong textures
+// ----------------------------------------------------------------------------
+//   RG16F halves the bandwidth of RGBA16F, but has no room for gradients.
+//   RG32F keeps more precision for long simulations. Waves are carried
+//   over to the new textures. Shallow waters need RGBA16F for momentum.
+{
+    Format f;
+    if (name == "rgba16f")
+        f = RGBA16F;
+    else if (name == "rg16f")
+        f = RG16F;
+    else if (name == "rg32f")
+        f = RG32F;
+    else
+        return false;
+    if (f == format)
+        return true;
+    if (solver == SWE && f != RGBA16F)
+        return false;
+
+    IFTRACE(water_surface)
+            debug() << "Use format " << name << "\n";
+
+    if (atlas)
+        atlas->detach(this);
+
+    checkGLContext();
+    bool carry = !cpu && !failed && pass != 0;
+    if (carry)
+        download(4);
+
+    format = f;
+    GL.Sync();
+    GL.DeleteTextures(1, &ping);
+    GL.DeleteTextures(1, &pong);
+    createTextures();
+    pass = 0;
+
+    if (cpu)
+        dirty = true;
+    else if (carry && !failed)
+        restore(&staging[0], 4);
+    wake();
+    return true;
+}
+
+
+bool Water::packable()
+// ----------------------------------------------------------------------------
+//   Check if the water may share the textures of an atlas
+// ----------------------------------------------------------------------------
+//   Atlases hold shader waters in the default format. Only water_mesh maps
+//   texture coordinates to the region of a water, so waters also shown with
+//   other geometry keep their own textures, as do those read back by
+//   heightAt. Periodic waters need textures that repeat, and masked waters
+//   a mask texture, which the atlas cannot do.
+{
+    return (meshed && !custom &&
+            !cpu && !failed && !probed && mask.empty() &&
+            format == RGBA16F && solver == WAVE && boundary == WALL);
+}
+
+
+bool Water::gradients()
+// ----------------------------------------------------------------------------
+//   Check if blue and alpha hold gradients for the render shader
+// ----------------------------------------------------------------------------
+//   Shallow waters keep their momentum there instead
+{
+    return normals && format == RGBA16F && solver == WAVE;
+}
+
+
+bool Water::useSolver(text name)
+// ----------------------------------------------------------------------------
+//   Select the equations solved by the simulation, "wave" or "swe"
+// ----------------------------------------------------------------------------
+//   The shallow water solver keeps the height above the rest depth in red,
+//   and its momentum along x and y in green and blue, so it needs RGBA16F.
+//   The ocean is computed on the CPU and uploaded like the CPU solver, on
+//   grids whose sizes are powers of two. Velocities and momentum do not
+//   mean the same: the water becomes flat.
+{
+    Solver s;
+    if (name == "wave")
+        s = WAVE;
+    else if (name == "swe")
+        s = SWE;
+    else if (name == "ocean")
+        s = OCEAN;
+    else
+        return false;
+    if (s == solver)
+        return true;
+    if (s == OCEAN && !WaterOcean::fits(width, height))
+        return false;
+
+    IFTRACE(water_surface)
+            debug() << "Use solver " << name << "\n";
+
+    if (atlas)
+        atlas->detach(this, false);
+    if (s == SWE)
+        useFormat("rgba16f");
+    solver = s;
+
+    delete ocean;
+    ocean = NULL;
+    if (solver == OCEAN)
+    {
+        ocean = new WaterOcean(width, height);
+        ocean->spectrum(seeded ? generator : 1);
+        ocean->compute();
+        dirty = true;
+        asleep = false;
+        return true;
     }
+
+    checkGLContext();
+    if (cpu || !failed)
+        flatten();
+    asleep = true;
+    return true;
+}
+
+
+const char *Water::solverName()
+// ----------------------------------------------------------------------------
+//   Name of the equations solved by the simulation
+// ----------------------------------------------------------------------------
+{
+    static const char *names[] = { "wave", "swe", "ocean" };
+    return names[solver];
+}
+
+
+bool Water::useBoundary(text name)
+// ----------------------------------------------------------------------------
+//   Select what happens to waves at the edges, "wall" or "periodic"
+// ----------------------------------------------------------------------------
+//   Periodic waters wrap neighbours and drops around the edges, in the
+//   update and drop shaders through repeating textures, on the CPU and in
+//   the tiles. A small periodic water can then tile a large surface.
+{
+    Boundary b;
+    if (name == "wall")
+        b = WALL;
+    else if (name == "periodic")
+        b = PERIODIC;
+    else
+        return false;
+    if (b == boundary)
+        return true;
+
+    IFTRACE(water_surface)
+            debug() << "Use boundary " << name << "\n";
+
+    if (atlas)
+        atlas->detach(this);
+    boundary = b;
+    tiles.periodic = boundary == PERIODIC;
+    if (cpu)
+        configureCPU();
+
+    // Shores of the mask now wrap around the edges
+    applyMask();
+
+    // Textures of another context get the wrap mode when re-created
+    tao->makeGLContextCurrent();
+    if (pcontext == QGLContext::currentContext() && ping && pong)
+    {
+        GL.BindTexture(GL_TEXTURE_2D, ping);
+        wrapTexture();
+        GL.BindTexture(GL_TEXTURE_2D, pong);
+        wrapTexture();
+        GL.BindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // Waves near the edges now reach the other side
+    wake();
+    return true;
+}
+
+
+const char *Water::boundaryName()
+// ----------------------------------------------------------------------------
+//   Name of the boundary of the water
+// ----------------------------------------------------------------------------
+{
+    static const char *names[] = { "wall", "periodic" };
+    return names[boundary];
+}
+
+
+bool Water::usePrecision(text name)
+// ----------------------------------------------------------------------------
+//   Select the storage of the CPU wave solver, "float" or "int16"
+// ----------------------------------------------------------------------------
+//   Int16 heights and velocities halve the memory traffic of the update,
+//   for many waters on small CPUs, and give the same waves on all machines.
+//   Heights are then within +/- 1/64, in steps of 1/2^21. Waters simulated
+//   in shaders and shallow waters keep floats.
+{
+    Precision p;
+    if (name == "float")
+        p = FLOAT32;
+    else if (name == "int16")
+        p = INT16;
+    else
+        return false;
+    if (p == precision)
+        return true;
+
+    IFTRACE(water_surface)
+            debug() << "Use precision " << name << "\n";
+
+    precision = p;
+    if (cpu)
+    {
+        configureCPU();
+        dirty = true;
+    }
+    return true;
+}
+
+
+const char *Water::precisionName()
+// ----------------------------------------------------------------------------
+//   Name of the storage of the CPU wave solver
+// ----------------------------------------------------------------------------
+{
+    static const char *names[] = { "float", "int16" };
+    return names[precision];
+}
+
+
+bool Water::useOcean(double wind, double direction, double length)
+// ----------------------------------------------------------------------------
+//   Select the ocean solver, for the given wind over a square patch
+// ----------------------------------------------------------------------------
+//   The direction is where the wind blows to, in degrees from the x axis.
+//   Waters of the same seed get the same waves for the same wind.
+{
+    if (wind < 0.0 || length <= 0.0 || !useSolver("ocean"))
+        return false;
+
+    IFTRACE(water_surface)
+            debug() << "Ocean wind " << wind << "m/s, " << direction
+                    << " degrees, over " << length << "m" << "\n";
+
+    const double PI = 3.141592653589793;
+    ocean->wind = wind;
+    ocean->direction = direction * PI / 180.0;
+    ocean->length = length;
+    ocean->spectrum(seeded ? generator : 1);
+    ocean->compute();
+    dirty = true;
+    return true;
+}
+
+
+const char *Water::formatName()
+// ----------------------------------------------------------------------------
+//   Name of the format actually used by the textures
+// ----------------------------------------------------------------------------
+{
+    static const char *names[] = { "rgba16f", "rg16f", "rg32f" };
+    return names[format];
+}
+
+
+void Water::createTextures()
+// ----------------------------------------------------------------------------
+//   Create the ping-pong textures and attach them to our frame buffer
+// ----------------------------------------------------------------------------
+//   Two-channel formats fall back to RGBA16F if the driver does not have
+//   them, or cannot render into them.
+{
+    if (format != RGBA16F && !rgFormats)
+    {
+        IFTRACE(water_surface)
+                debug() << "No RG textures, using rgba16f" << "\n";
+        format = RGBA16F;
+    }
+
+    createTexture(ping);
+    createTexture(pong);
+    createBuffer();
+
+    if (failed && format != RGBA16F && resources && !resources->failed)
+    {
+        IFTRACE(water_surface)
+                debug() << "Cannot render to " << formatName()
+                        << ", using rgba16f" << "\n";
+        GL.DeleteTextures(1, &ping);
+        GL.DeleteTextures(1, &pong);
+        format = RGBA16F;
+        failed = false;
+        createTexture(ping);
+        createTexture(pong);
+        createBuffer();
+    }
+}
+
+
+void Water::createTexture(uint& texId)
+// ----------------------------------------------------------------------------
+//   Create a texture to attach to the fbo
+// ----------------------------------------------------------------------------
+{
+    // Create texture for ping pong technic
+    // (also needed by the CPU solver if shaders failed)
+    GL.GenTextures(1, &texId);
+    GL.BindTexture(GL_TEXTURE_2D, texId);
+
+    // Start flat, rather than from whatever the driver left in memory
+    std::vector<uchar> flat(4 * width * height, 0);
+    static const GLenum internal[] = { GL_RGBA16F_ARB, GL_RG16F, GL_RG32F };
+    GL.TexImage2D(GL_TEXTURE_2D, 0, internal[format], width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &flat[0]);
+    wrapTexture();
+    GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+    GL.BindTexture(GL_TEXTURE_2D, 0);
+
+    tao->showGlErrors();
+
+    IFTRACE(water_surface)
+                debug() << "Create texture: " << texId << "\n";
+}
+
+
+void Water::createBuffer()
+// ----------------------------------------------------------------------------
+//   Attach the ping-pong textures to our frame buffer
+// ----------------------------------------------------------------------------
+//   The frame buffer itself is created once per context by the registry
+{
+    // Don't need a fbo if already failed
+    if(failed)
+        return;
+
+    frame = resources->framebuffer(this);
+    GL.BindFramebuffer(GL_FRAMEBUFFER, frame); // Bind our frame buffer
+    GL.FramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_TEXTURE_2D, ping, 0);
+    GL.FramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
+                            GL_TEXTURE_2D, pong, 0);
+    checkFramebufferStatus();
+    GL.BindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    tao->showGlErrors();
+
+    IFTRACE(water_surface)
+                debug() << "Attach frame buffer: " << frame << "\n";
 }
 
 
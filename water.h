@@ -42,12 +42,37 @@
 #include "tao/module_api.h"
 #include "tao/tao_gl.h"
 #include "basics.h" // XLR
+#include "water_cpu.h"
+#include "water_log.h"
+#include "water_mask.h"
+#include "water_mesh.h"
+#include "water_ocean.h"
+#include "water_readback.h"
+#include "water_resources.h"
+#include "water_stats.h"
+#include "water_tiles.h"
+#include <QElapsedTimer>
 #include <QGLContext>
 #include <QGLShaderProgram>
 
 using namespace std;
 using namespace Tao;
 
+struct Drop
+// ----------------------------------------------------------------------------
+//   A drop to add to a water surface
+// ----------------------------------------------------------------------------
+//   The four floats are passed as is to a vec4 of the drop shader
+{
+    Drop(double x, double y, double radius, double strength)
+        : x(x), y(y), radius(radius), strength(strength) {}
+    float x, y, radius, strength;
+};
+typedef std::vector<Drop> DropList;
+
+class WaterAtlas;
+
+
 struct Water
 {
     Water(int w = 256, int h = 256);
@@ -56,19 +81,127 @@ struct Water
     virtual void    Draw();
 
     void            drop(double x, double y, double radius, double strength);
+    void            drops(const DropList &list);
     void            randomDrops(int n);
-    void            update();
+    void            seed(quint64 s);
+    void            update(int steps = 1);
+
+    // Run the steps due on the simulation clock since the last call
+    void            advance();
+
+    // Drops recorded by queueDrop are added in one batch by flushDrops
+    void            queueDrop(double x, double y,
+                              double radius, double strength);
+    void            flushDrops();
 
     void            extenuation(float r);
+    void            resize(int w, int h);
+
+    // Run the simulation on the CPU instead of shaders
+    void            useCPU(bool enable);
+
+    // Internal format of the ping-pong textures
+    enum Format { RGBA16F, RG16F, RG32F };
+    bool            useFormat(text name);
+    const char *    formatName();
+    bool            gradients();
+
+    // Equations solved by the simulation
+    enum Solver { WAVE, SWE, OCEAN };
+    bool            useSolver(text name);
+    const char *    solverName();
+
+    // Open ocean for a wind in m/s and degrees, over a patch in meters
+    bool            useOcean(double wind, double direction, double length);
+
+    // Edges reflect waves, or wrap around so that the surface tiles
+    enum Boundary { WALL, PERIODIC };
+    bool            useBoundary(text name);
+    const char *    boundaryName();
+
+    // Storage of heights and velocities of the CPU wave solver
+    enum Precision { FLOAT32, INT16 };
+    bool            usePrecision(text name);
+    const char *    precisionName();
+
+    // Islands and shores where there is no water, from an image or polygons
+    bool            useMask(text file);
+    void            maskVertex(double x, double y);
+    void            maskPolygon();
+
+    // Simulate the whole grid again, until it settles
+    void            wake();
+
+    // Check if the water may share the textures of an atlas
+    bool            packable();
+
+    // Write or read heights and velocities in a binary snapshot file
+    bool            save(text file);
+    bool            load(text file);
+
+    // Log drops and updates, or replay a log instead of the clock
+    bool            record(text file);
+    bool            replay(text file);
+
+    // Print timing statistics of update, drop and draw
+    void            stats(std::ostream &out);
+
+    // Height at x, y in drop coordinates, as of one or two frames ago
+    float           heightAt(double x, double y);
+
+    // Draw a w x h surface mesh, finer near the camera
+    void            drawMesh(double w, double h);
 
 private:
+    friend class WaterAtlas;
+
     // Re-create shaders if GL context has changed
     void            checkGLContext();
 
-    void            createShaders();
-    void            createDropShader();
-    void            createUpdateShader();
+    // Random number in [0, 1), from the seeded generator if any
+    double          random();
 
+    // Run the events of one recorded frame
+    void            replayFrame();
+
+    // Give the settings of the water to the CPU solver
+    void            configureCPU();
+
+    // Wrap mode of the bound texture for the boundary
+    void            wrapTexture();
+
+    // Multiply the texture matrix by the mapping of the water texture
+    void            mapTexture();
+
+    // Give the dry texels of the mask to the tiles, CPU and shaders
+    void            applyMask();
+    void            uploadMask();
+
+    // Copy the CPU simulation into the next ping-pong texture
+    void            upload();
+
+    // Copy the latest heights and velocities as RG or RGBA texels
+    void            download(int channels = 2);
+
+    // Write RG or RGBA texels into the next ping-pong texture
+    void            restore(const float *texels, int channels);
+
+    // Start reading the latest heights back into CPU memory
+    void            readBack();
+
+    // Track the amplitude of waves, and sleep when it becomes negligible
+    void            settle(int steps);
+    bool            measurable();
+    bool            measure();
+    void            flatten();
+
+    void            bindPingPong();
+    void            swapPingPong();
+    void            drawRects(const WaterRectList &rects,
+                              int unit, int w, int h);
+    void            clearRects(const WaterRectList &rects);
+
+    void            createTextures();
     void            createTexture(uint& texId);
     void            createBuffer();
 
@@ -85,17 +218,80 @@ public:
     // Water settings
     float    ratio;
     float    strength;
+    int      substeps;          // Solver steps for each tick
+    double   timestep;          // Seconds per tick, 0 for one per water_show
+    bool     sleepy;            // Calm waters may go to sleep
+    bool     normals;           // Gradients in blue and alpha for normals
+    float    depth;             // Rest depth of shallow water, in heights
+    float    repeat;            // Copies of periodic waters along each side
+
+    static bool rgFormats;      // GL_ARB_texture_rg is available
 
 private:
-   // FBO settings
-   uint frame;
+   // Resources shared with other waters of the same context
+   WaterResources *   resources;
+   uint               serial;
+   bool               failed;
+   uint               frame;
 
    uint pass;
+   Format             format;
+   Solver             solver;
+   Boundary           boundary;
+   Precision          precision;
+
+   // Atlas holding the simulation instead of ping and pong, if any
+   WaterAtlas *       atlas;
+   uint               atlasRegion;
+
+   // CPU backend, NULL when the simulation runs in shaders
+   WaterCPU *         cpu;
+   WaterOcean *       ocean;        // Spectrum of the ocean solver, if any
+   bool               dirty;
+   std::vector<float> staging;
+
+   // Simulation clock, elapsed time not yet simulated
+   enum { MAX_CATCH_UP = 4 };   // Ticks per call, beyond that time is lost
+   QElapsedTimer      clock;
+   double             accumulator;
+
+   // Recorded events, step index, generator of random drops
+   WaterLog           log;
+   quint64            stepIndex;
+   quint64            generator;
+   bool               seeded;
+   bool               feeding;      // Replay is running the events
+
+   // Drops waiting for the next batch
+   DropList           queued;
+
+   // Dry texels, as a texture for the update shaders, polygon being built
+   WaterMask          mask;
+   uint               maskTexture;
+   std::vector<float> maskVertices;
+
+   // Heights read back for heightAt, only once a water was queried
+   WaterReadback      readback;
+   bool               probed;
+   bool               stale;        // Textures changed since last read
+
+   // Quiescence: tiles where waves are not negligible, largest amplitude
+   enum { QUIET_CHECK = 16 };   // Steps between two measures
+   WaterTiles         tiles;
+   float              amplitude;
+   int                sinceCheck;
+   bool               asleep;
+   WaterReadback      measures;     // Tile maxima of the reduce shader
+   bool               measuring;    // A measure of the GPU tiles started
+
+   // Surface mesh drawn by water_mesh, which maps texture coordinates
+   WaterMesh          mesh;
+   bool               meshed;       // Drawn by water_mesh at least once
+   bool               shown;        // Shown, and not drawn by water_mesh yet
+   bool               custom;       // Shown without water_mesh
 
-   // Shaders settings
-   static bool  failed;
-   static QGLShaderProgram *dropShader, *updateShader;
-   static std::map<text, GLint> uniforms;
+   // Timing statistics
+   WaterTimer         updateTimer, dropTimer, drawTimer;
 };
 
 
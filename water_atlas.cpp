@@ -0,0 +1,473 @@
+// *****************************************************************************
+// water_atlas.cpp                                                 Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//   Small water surfaces sharing the same simulation textures.
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2015,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+#include "water_atlas.h"
+#include "water_factory.h"
+#include "water_pass.h"
+#include "tao/graphic_state.h"
+#include <algorithm>
+
+#define tao WaterFactory::instance()->tao
+
+
+
+// ============================================================================
+//
+//   Waters of the atlas
+//
+// ============================================================================
+
+WaterAtlas::WaterAtlas(int size)
+// ----------------------------------------------------------------------------
+//   Create an empty atlas, textures are created with the first water
+// ----------------------------------------------------------------------------
+    : extent(size), resources(NULL), serial(0), failed(false),
+      ping(0), pong(0), frame(0), pass(2)
+{
+    IFTRACE(water_surface)
+            debug() << "Create " << size << "x" << size << "\n";
+}
+
+
+WaterAtlas::~WaterAtlas()
+// ----------------------------------------------------------------------------
+//   Give waters back their own textures, and delete ours if we can
+// ----------------------------------------------------------------------------
+{
+    bool current = resources &&
+        resources->context == QGLContext::currentContext();
+    for (uint s = 0; s < regions.size(); s++)
+        if (regions[s].water)
+            detach(regions[s].water, current);
+
+    if (current && !failed)
+    {
+        GL.DeleteTextures(1, &ping);
+        GL.DeleteTextures(1, &pong);
+    }
+    WaterResources::forget(this);
+
+    IFTRACE(water_surface)
+            debug() << "Delete" << "\n";
+}
+
+
+bool WaterAtlas::attach(Water *water)
+// ----------------------------------------------------------------------------
+//   Give a rectangle of the atlas to a water, and copy its waves there
+// ----------------------------------------------------------------------------
+{
+    if (water->atlas)
+        return water->atlas == this;
+    if (!water->packable() ||
+        water->width > MAX_WATER || water->height > MAX_WATER ||
+        !checkGLContext())
+        return false;
+
+    water->checkGLContext();
+    if (water->failed)
+        return false;
+
+    int s = allocate(water->width + 2 * GUARD, water->height + 2 * GUARD);
+    if (s < 0)
+        return false;
+
+    Region &region = regions[s];
+    region.water = water;
+    region.pending = 0;
+    water->atlas = this;
+    water->atlasRegion = s;
+
+    // Copy the latest texture of the water inside its rectangle
+    {
+        WaterPass scope(water->frame, water->width, water->height, 0);
+        GL.BindTexture(GL_TEXTURE_2D, pass == 2 ? ping : pong);
+        GL.Sync();
+        glReadBuffer(water->pass == 1 ? GL_COLOR_ATTACHMENT1
+                                      : GL_COLOR_ATTACHMENT0);
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0,
+                            region.x + GUARD, region.y + GUARD,
+                            0, 0, water->width, water->height);
+    }
+
+    // Guards must hold the edges before the water is first drawn
+    touch(region, NULL, 0);
+    water->wake();
+
+    IFTRACE(water_surface)
+            debug() << "Attach " << (void *) water
+                    << " at " << region.x << "," << region.y << "\n";
+    return true;
+}
+
+
+void WaterAtlas::detach(Water *water, bool keep)
+// ----------------------------------------------------------------------------
+//   Return a water to its own textures, copying its waves back if 'keep'
+// ----------------------------------------------------------------------------
+{
+    if (water->atlas != this)
+        return;
+
+    Region &region = regions[water->atlasRegion];
+    if (keep && region.pending)
+        flush();
+
+    if (keep && checkGLContext())
+    {
+        water->checkGLContext();
+        if (!water->failed)
+        {
+            // Write the texture of the water that is not displayed
+            WaterPass scope(frame, extent, extent, 0);
+            GL.BindTexture(GL_TEXTURE_2D,
+                           water->pass == 2 ? water->pong : water->ping);
+            GL.Sync();
+            glReadBuffer(pass == 2 ? GL_COLOR_ATTACHMENT0
+                                   : GL_COLOR_ATTACHMENT1);
+            glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
+                                region.x + GUARD, region.y + GUARD,
+                                water->width, water->height);
+            water->pass = (water->pass == 2) ? 1 : 2;
+            water->stale = true;
+        }
+    }
+
+    IFTRACE(water_surface)
+            debug() << "Detach " << (void *) water << "\n";
+
+    region.water = NULL;
+    region.pending = 0;
+    water->atlas = NULL;
+    water->wake();
+}
+
+
+void WaterAtlas::queue(Water *water, int steps)
+// ----------------------------------------------------------------------------
+//   Record steps of a water, to be run with those of the other waters
+// ----------------------------------------------------------------------------
+{
+    regions[water->atlasRegion].pending += steps;
+}
+
+
+void WaterAtlas::drops(Water *water, const DropList &list)
+// ----------------------------------------------------------------------------
+//   Add drops to one water of the atlas
+// ----------------------------------------------------------------------------
+//   Steps queued for that water are run first, to keep the order of calls
+{
+    Region &region = regions[water->atlasRegion];
+    if (region.pending)
+        flush();
+    if (!checkGLContext())
+        return;
+    touch(region, &list[0], list.size());
+}
+
+
+void WaterAtlas::flush()
+// ----------------------------------------------------------------------------
+//   Run the queued steps of all waters, with one quad per water in a pass
+// ----------------------------------------------------------------------------
+//   The number of passes is the largest number of queued steps. In passes
+//   beyond its own steps, a water is copied rather than updated.
+{
+    int steps = 0;
+    for (uint s = 0; s < regions.size(); s++)
+        if (regions[s].water)
+            steps = std::max(steps, regions[s].pending);
+    if (steps == 0)
+        return;
+
+    if (checkGLContext())
+    {
+        IFTRACE(water_surface)
+                debug() << "Update, " << steps << " steps" << "\n";
+
+        WaterPass scope(frame, extent, extent,
+                        resources->atlasUpdateShader->programId());
+        GLfloat delta[2] = { 1.0f / extent, 1.0f / extent };
+        GL.Uniform2fv(resources->atlasDeltaLocation, 1, delta);
+
+        for (int step = 0; step < steps; step++)
+        {
+            bindPingPong();
+            GL.Sync();
+            glBegin(GL_QUADS);
+            for (uint s = 0; s < regions.size(); s++)
+            {
+                const Region &region = regions[s];
+                if (region.water)
+                    quad(region, region.water->ratio,
+                         step < region.pending ? 1.0f : 0.0f, 0.0f, 0.0f);
+            }
+            glEnd();
+            pass = (pass == 2) ? 1 : 2;
+        }
+    }
+
+    for (uint s = 0; s < regions.size(); s++)
+        regions[s].pending = 0;
+}
+
+
+void WaterAtlas::bind()
+// ----------------------------------------------------------------------------
+//   Bind the latest texture
+// ----------------------------------------------------------------------------
+{
+    if (!checkGLContext())
+        return;
+
+    GL.BindTexture(GL_TEXTURE_2D, pass == 2 ? ping : pong);
+}
+
+
+void WaterAtlas::map(Water *water)
+// ----------------------------------------------------------------------------
+//   Multiply the texture matrix to select the region of the water
+// ----------------------------------------------------------------------------
+//   Coordinates in [0, 1] select the inside of the region, so that render
+//   shaders can transform them by the texture matrix.
+{
+    const Region &region = regions[water->atlasRegion];
+    float e = extent;
+    GL.Translate((region.x + GUARD) / e, (region.y + GUARD) / e, 0.0);
+    GL.Scale(water->width / e, water->height / e, 1.0);
+}
+
+
+
+// ============================================================================
+//
+//   Packing and passes
+//
+// ============================================================================
+
+int WaterAtlas::allocate(int w, int h)
+// ----------------------------------------------------------------------------
+//   Find room for a w x h rectangle, or return -1 if the atlas is full
+// ----------------------------------------------------------------------------
+//   Free regions are reused first. Otherwise, rectangles are packed on
+//   shelves, rows as high as their first rectangle, choosing the lowest
+//   shelf where the rectangle fits, or starting a new one above the others.
+{
+    for (uint s = 0; s < regions.size(); s++)
+    {
+        Region &region = regions[s];
+        if (!region.water && region.roomW >= w && region.roomH >= h)
+        {
+            region.w = w;
+            region.h = h;
+            return s;
+        }
+    }
+
+    int best = -1;
+    for (uint b = 0; b < shelves.size(); b++)
+        if (shelves[b].h >= h && shelves[b].x + w <= extent &&
+            (best < 0 || shelves[b].h < shelves[best].h))
+            best = b;
+
+    if (best < 0)
+    {
+        int top = 0;
+        if (!shelves.empty())
+            top = shelves.back().y + shelves.back().h;
+        if (top + h > extent || w > extent)
+            return -1;
+        Shelf shelf = { top, h, 0 };
+        shelves.push_back(shelf);
+        best = shelves.size() - 1;
+    }
+
+    Shelf &shelf = shelves[best];
+    Region region = { NULL, shelf.x, shelf.y, w, h, w, shelf.h, 0 };
+    shelf.x += w;
+    regions.push_back(region);
+    return regions.size() - 1;
+}
+
+
+void WaterAtlas::quad(const Region &region, float a, float b, float c, float d)
+// ----------------------------------------------------------------------------
+//   Draw the quad of a region, guards included, with values for the shaders
+// ----------------------------------------------------------------------------
+//   Texture coordinates of unit 1 are the texel centers of the inside of
+//   the region, where shaders clamp their reads. Unit 2 has per-water values.
+{
+    float e = extent;
+    float x0 = region.x + GUARD + 0.5f;
+    float y0 = region.y + GUARD + 0.5f;
+    float x1 = region.x + region.w - GUARD - 0.5f;
+    float y1 = region.y + region.h - GUARD - 0.5f;
+    glMultiTexCoord4f(GL_TEXTURE1, x0 / e, y0 / e, x1 / e, y1 / e);
+    glMultiTexCoord4f(GL_TEXTURE2, a, b, c, d);
+
+    x0 = 2.0f * region.x / e - 1.0f;
+    y0 = 2.0f * region.y / e - 1.0f;
+    x1 = 2.0f * (region.x + region.w) / e - 1.0f;
+    y1 = 2.0f * (region.y + region.h) / e - 1.0f;
+    glVertex2f(x0, y0);
+    glVertex2f(x1, y0);
+    glVertex2f(x1, y1);
+    glVertex2f(x0, y1);
+}
+
+
+void WaterAtlas::touch(const Region &region, const Drop *drops, uint n)
+// ----------------------------------------------------------------------------
+//   Run the drop shader over one region, and copy the result back in place
+// ----------------------------------------------------------------------------
+//   Only this region is written to the other texture, so it is copied back
+//   into the latest one, which remains valid for all waters. Without drops,
+//   this only writes the guards as a copy of the edges.
+{
+    WaterPass scope(frame, extent, extent,
+                    resources->atlasDropShader->programId());
+
+    const uint perPass = WaterResources::DROPS_PER_PASS;
+    float e = extent;
+    uint first = 0;
+    do
+    {
+        uint count = std::min(n - first, perPass);
+        bindPingPong();
+        if (count)
+            GL.Uniform4fv(resources->atlasDropsLocation, count,
+                          &drops[first].x);
+        GL.Uniform(resources->atlasDropCountLocation, (float) count);
+
+        GL.Sync();
+        glBegin(GL_QUADS);
+        quad(region, (region.x + GUARD) / e, (region.y + GUARD) / e,
+             (region.w - 2 * GUARD) / e, (region.h - 2 * GUARD) / e);
+        glEnd();
+        glReadBuffer(pass == 2 ? GL_COLOR_ATTACHMENT1 : GL_COLOR_ATTACHMENT0);
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, region.x, region.y,
+                            region.x, region.y, region.w, region.h);
+        first += count;
+    } while (first < n);
+}
+
+
+void WaterAtlas::bindPingPong()
+// ----------------------------------------------------------------------------
+//   Draw into the older texture, reading the latest one
+// ----------------------------------------------------------------------------
+{
+    GL.DrawBuffer(pass == 2 ? GL_COLOR_ATTACHMENT1 : GL_COLOR_ATTACHMENT0);
+    GL.Enable(GL_TEXTURE_2D);
+    GL.BindTexture(GL_TEXTURE_2D, pass == 2 ? ping : pong);
+}
+
+
+bool WaterAtlas::checkGLContext()
+// ----------------------------------------------------------------------------
+//   Re-create the textures if the GL context has changed
+// ----------------------------------------------------------------------------
+//   Waves are lost, as they are for waters with their own textures. If the
+//   atlas cannot be used in the new context, its waters leave it.
+{
+    tao->makeGLContextCurrent();
+    WaterResources *current = WaterResources::current();
+    if (serial == current->serial)
+        return !failed;
+
+    IFTRACE(water_surface)
+            debug() << "Context has changed" << "\n";
+
+    resources = current;
+    serial = current->serial;
+    failed = current->failed ||
+        !current->atlasUpdateShader || !current->atlasDropShader;
+    pass = 2;
+
+    if (!failed)
+    {
+        GL.Sync();
+        std::vector<uchar> flat(4 * extent * extent, 0);
+        uint *textures[2] = { &ping, &pong };
+        for (int t = 0; t < 2; t++)
+        {
+            GL.GenTextures(1, textures[t]);
+            GL.BindTexture(GL_TEXTURE_2D, *textures[t]);
+            GL.TexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F_ARB, extent, extent,
+                          0, GL_RGBA, GL_UNSIGNED_BYTE, &flat[0]);
+            GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        }
+        GL.BindTexture(GL_TEXTURE_2D, 0);
+
+        frame = resources->framebuffer(this);
+        GL.BindFramebuffer(GL_FRAMEBUFFER, frame);
+        GL.FramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                GL_TEXTURE_2D, ping, 0);
+        GL.FramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
+                                GL_TEXTURE_2D, pong, 0);
+        GLenum status = (GLenum) GL.CheckFramebufferStatus(GL_FRAMEBUFFER);
+        GL.BindFramebuffer(GL_FRAMEBUFFER, 0);
+        tao->showGlErrors();
+
+        if (status != GL_FRAMEBUFFER_COMPLETE_EXT)
+        {
+            IFTRACE(water_surface)
+                    debug() << "Incomplete frame buffer " << status << "\n";
+            GL.DeleteTextures(1, &ping);
+            GL.DeleteTextures(1, &pong);
+            failed = true;
+        }
+    }
+
+    if (failed)
+        for (uint s = 0; s < regions.size(); s++)
+            if (regions[s].water)
+                detach(regions[s].water, false);
+
+    return !failed;
+}
+
+
+std::ostream & WaterAtlas::debug()
+// ----------------------------------------------------------------------------
+//   Convenience method to log with a common prefix
+// ----------------------------------------------------------------------------
+{
+    std::cerr << "[WaterAtlas] " << (void*)this << " ";
+    return std::cerr;
+}
@@ -0,0 +1,110 @@
+#ifndef WATER_ATLAS_H
+#define WATER_ATLAS_H
+// *****************************************************************************
+// water_atlas.h                                                   Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//      Small water surfaces sharing the same simulation textures.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2014,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "water.h"
+#include "tao/tao_gl.h"
+#include <vector>
+
+
+class WaterAtlas
+// ----------------------------------------------------------------------------
+//   Small waters packed in shared ping-pong textures, updated in one pass
+// ----------------------------------------------------------------------------
+//   Each water gets a rectangle of the atlas, surrounded by a guard border
+//   of one texel. The atlas shaders clamp their reads to the inside of the
+//   rectangle, and write the guard as a copy of the edge, so that waters
+//   never see each other, and render as if their texture had its own
+//   GL_CLAMP_TO_EDGE borders.
+//   Steps are queued, and all waters are advanced when the first of them
+//   is drawn. Each pass draws one quad per water, and waters that have no
+//   step left in a pass are copied, so that the atlas stays consistent.
+{
+public:
+    WaterAtlas(int size);
+    ~WaterAtlas();
+
+    // Move a water in or out of the atlas, keeping its waves
+    bool                attach(Water *water);
+    void                detach(Water *water, bool keep = true);
+
+    void                queue(Water *water, int steps);
+    void                drops(Water *water, const DropList &list);
+    void                flush();
+
+    // Bind the latest texture, map texture coordinates to a water
+    void                bind();
+    void                map(Water *water);
+
+    int                 size()          { return extent; }
+
+public:
+    enum { GUARD = 1, MAX_WATER = 256 };
+
+private:
+    struct Region
+    {
+        Water *         water;          // NULL if the region is free
+        int             x, y, w, h;     // Texels used, guards included
+        int             roomW, roomH;   // Texels available
+        int             pending;        // Steps queued since last flush
+    };
+    struct Shelf
+    {
+        int             y, h, x;        // Next free texel is at x
+    };
+
+    bool                checkGLContext();
+    int                 allocate(int w, int h);
+    void                quad(const Region &region, float a, float b,
+                             float c, float d);
+    void                touch(const Region &region, const Drop *drops, uint n);
+    void                bindPingPong();
+    std::ostream &      debug();
+
+private:
+    int                 extent;
+    WaterResources *    resources;
+    uint                serial;
+    bool                failed;
+    uint                ping, pong, frame;
+    uint                pass;           // 2: latest in ping, 1: in pong
+
+    std::vector<Region> regions;
+    std::vector<Shelf>  shelves;
+};
+
+#endif
@@ -0,0 +1,421 @@
+// *****************************************************************************
+// water_bench.cpp                                                 Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//   Benchmark harness and CPU benchmark suites for the water simulation.
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2015,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+#include "water_bench.h"
+#include "water_cpu.h"
+#include "water_ocean.h"
+#include "water_pool.h"
+#include "water_tiles.h"
+#include <QElapsedTimer>
+#include <algorithm>
+#include <cmath>
+
+
+const int WaterBench::sizes[]  = { 64, 128, 256, 512, 1024, 2048, 0 };
+const int WaterBench::counts[] = { 1, 10, 100, 1000, 0 };
+
+
+
+// ============================================================================
+//
+//   Harness
+//
+// ============================================================================
+
+WaterBench::WaterBench(double minTime)
+// ----------------------------------------------------------------------------
+//   Create a benchmark running each measure for at least minTime seconds
+// ----------------------------------------------------------------------------
+    : minTime(minTime)
+{}
+
+
+double WaterBench::measure(std::string name, std::string backend,
+                           int width, int height, int waters,
+                           Operation &op)
+// ----------------------------------------------------------------------------
+//   Run an operation in batches of increasing size until minTime elapsed
+// ----------------------------------------------------------------------------
+{
+    // Warm up caches, shaders and lazy allocations
+    op.run();
+    op.finish();
+
+    QElapsedTimer timer;
+    timer.start();
+    long iterations = 0;
+    long batch = 1;
+    double seconds = 0.0;
+    for (;;)
+    {
+        for (long i = 0; i < batch; i++)
+            op.run();
+        op.finish();
+        iterations += batch;
+        seconds = timer.nsecsElapsed() * 1e-9;
+        if (seconds >= minTime)
+            break;
+        batch *= 2;
+    }
+
+    Result r;
+    r.name = name;
+    r.backend = backend;
+    r.width = width;
+    r.height = height;
+    r.waters = waters;
+    r.iterations = iterations;
+    r.seconds = seconds;
+    results.push_back(r);
+
+    std::cerr << "[WaterBench] " << name << " " << backend << " "
+              << width << "x" << height << " x" << waters << ": "
+              << iterations / seconds << "/s\n";
+    return iterations / seconds;
+}
+
+
+void WaterBench::accuracy(std::string backend, int width, int height,
+                          int steps, const float *heights,
+                          const float *reference, int stride)
+// ----------------------------------------------------------------------------
+//   Record the largest and RMS height error, and the amplitude of reference
+// ----------------------------------------------------------------------------
+{
+    Accuracy a;
+    a.backend = backend;
+    a.width = width;
+    a.height = height;
+    a.steps = steps;
+    a.maxError = a.rmsError = a.amplitude = 0.0;
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            double h = reference[y * stride + x];
+            double e = heights[y * stride + x] - h;
+            a.maxError = std::max(a.maxError, fabs(e));
+            a.rmsError += e * e;
+            a.amplitude = std::max(a.amplitude, fabs(h));
+        }
+    }
+    a.rmsError = sqrt(a.rmsError / (width * height));
+    accuracies.push_back(a);
+
+    std::cerr << "[WaterBench] accuracy " << backend << " "
+              << width << "x" << height << " after " << steps << " steps: "
+              << a.maxError << " max, " << a.rmsError << " rms, "
+              << a.amplitude << " amplitude\n";
+}
+
+
+void WaterBench::json(std::ostream &out)
+// ----------------------------------------------------------------------------
+//   Emit results as a JSON document
+// ----------------------------------------------------------------------------
+{
+    out << "{\n"
+        << "  \"kernel\": \"" << WaterCPU::kernel() << "\",\n"
+        << "  \"fixed_kernel\": \"" << WaterCPU::fixedKernel() << "\",\n"
+        << "  \"threads\": " << WaterPool::instance()->threads() << ",\n"
+        << "  \"results\": [";
+    for (unsigned i = 0; i < results.size(); i++)
+    {
+        Result &r = results[i];
+        out << (i ? ",\n" : "\n")
+            << "    { \"name\": \"" << r.name << "\""
+            << ", \"backend\": \"" << r.backend << "\""
+            << ", \"width\": " << r.width
+            << ", \"height\": " << r.height
+            << ", \"waters\": " << r.waters
+            << ", \"iterations\": " << r.iterations
+            << ", \"seconds\": " << r.seconds
+            << ", \"per_second\": " << r.iterations / r.seconds
+            << " }";
+    }
+    out << "\n  ],\n"
+        << "  \"accuracy\": [";
+    for (unsigned i = 0; i < accuracies.size(); i++)
+    {
+        Accuracy &a = accuracies[i];
+        out << (i ? ",\n" : "\n")
+            << "    { \"backend\": \"" << a.backend << "\""
+            << ", \"width\": " << a.width
+            << ", \"height\": " << a.height
+            << ", \"steps\": " << a.steps
+            << ", \"max_error\": " << a.maxError
+            << ", \"rms_error\": " << a.rmsError
+            << ", \"amplitude\": " << a.amplitude
+            << " }";
+    }
+    out << "\n  ]\n}\n";
+}
+
+
+
+// ============================================================================
+//
+//   CPU suites
+//
+// ============================================================================
+
+struct CPUUpdate : WaterBench::Operation
+// ----------------------------------------------------------------------------
+//   One solver step on each of a set of CPU waters
+// ----------------------------------------------------------------------------
+{
+    CPUUpdate(std::vector<WaterCPU *> &waters): waters(waters) {}
+    virtual void run()
+    {
+        for (unsigned i = 0; i < waters.size(); i++)
+            waters[i]->update(0.95f);
+    }
+    std::vector<WaterCPU *> &waters;
+};
+
+
+struct CPUDrop : WaterBench::Operation
+// ----------------------------------------------------------------------------
+//   One drop on a CPU water, moving across the surface
+// ----------------------------------------------------------------------------
+{
+    CPUDrop(WaterCPU *water): water(water), index(0) {}
+    virtual void run()
+    {
+        index++;
+        double x = (index * 37 % 200) / 100.0 - 1.0;
+        double y = (index * 91 % 200) / 100.0 - 1.0;
+        water->drop(x, y, 1.0, (index & 1) ? 1.0 : -1.0);
+    }
+    WaterCPU *water;
+    long      index;
+};
+
+
+struct CPUTileUpdate : WaterBench::Operation
+// ----------------------------------------------------------------------------
+//   One solver step on the tiles covered by a single drop
+// ----------------------------------------------------------------------------
+//   Tiles grow, are retired and are measured as in Water::update, so that
+//   the cost of tracking them is timed as well. A new drop falls in the
+//   center once the previous one died out.
+{
+    enum { QUIET_CHECK = 16 };
+
+    CPUTileUpdate(WaterCPU *water): water(water), steps(0)
+    {
+        water->clear();
+        tiles.resize(water->width, water->height);
+        tiles.clear();
+    }
+    virtual void run()
+    {
+        if (tiles.empty())
+        {
+            water->drop(0.0, 0.0, 1.0, 1.0);
+            tiles.activate(0.0, 0.0, 1.0);
+        }
+        tiles.grow(1);
+        const WaterRectList &retired = tiles.retired();
+        for (uint r = 0; r < retired.size(); r++)
+            water->clear(retired[r]);
+        water->update(0.95f, tiles.rects());
+        if (++steps % QUIET_CHECK == 0)
+            settle();
+    }
+    void settle()
+    {
+        const WaterRectList &rects = tiles.rects();
+        maxima.assign(tiles.columns * tiles.rows, 0.0f);
+        for (uint r = 0; r < rects.size(); r++)
+        {
+            WaterRect tile = rects[r];
+            int ty = tile.y0 / tiles.size;
+            for (int x = rects[r].x0; x < rects[r].x1; x += tiles.size)
+            {
+                tile.x0 = x;
+                tile.x1 = std::min(x + tiles.size, water->width);
+                maxima[ty * tiles.columns + x / tiles.size] =
+                    water->amplitude(tile);
+            }
+        }
+        tiles.sample();
+        tiles.settle(&maxima[0], 1e-5f);
+    }
+    WaterCPU *         water;
+    WaterTiles         tiles;
+    std::vector<float> maxima;
+    long               steps;
+};
+
+
+struct CPUCrossing : WaterBench::Operation
+// ----------------------------------------------------------------------------
+//   Steps from a drop in the center until waves reach a quarter of the grid
+// ----------------------------------------------------------------------------
+//   Solvers do not move waves at the same speed: this compares them for
+//   the same visible result, a wave travelling the same distance.
+{
+    CPUCrossing(WaterCPU *water): water(water) {}
+    virtual void run()
+    {
+        int x = water->width * 3 / 4, y = water->height / 2;
+        water->clear();
+        water->drop(0.0, 0.0, 4.0, 10.0);
+        for (int s = 0; s < water->width; s++)
+        {
+            if (fabsf(water->heightAt(x, y)) > 1e-4f)
+                break;
+            water->update(0.99f);
+        }
+    }
+    WaterCPU *water;
+};
+
+
+struct CPUOcean : WaterBench::Operation
+// ----------------------------------------------------------------------------
+//   One frame of the ocean: spectrum at the next time, then inverse FFT
+// ----------------------------------------------------------------------------
+{
+    CPUOcean(WaterOcean *ocean): ocean(ocean) {}
+    virtual void run()
+    {
+        ocean->time += 1.0 / 60;
+        ocean->compute();
+    }
+    WaterOcean *ocean;
+};
+
+
+static void surface(const WaterCPU &water, std::vector<float> &heights)
+// ----------------------------------------------------------------------------
+//   Copy the heights of a CPU water, in float or fixed point, in rows
+// ----------------------------------------------------------------------------
+{
+    heights.resize(water.width * water.height);
+    for (int y = 0; y < water.height; y++)
+        for (int x = 0; x < water.width; x++)
+            heights[y * water.width + x] = water.heightAt(x, y);
+}
+
+
+void WaterBench::cpu()
+// ----------------------------------------------------------------------------
+//   Run the CPU benchmark suites
+// ----------------------------------------------------------------------------
+{
+    // Update steps and drops per second for each grid size
+    for (const int *s = sizes; *s; s++)
+    {
+        std::vector<WaterCPU *> waters(1, new WaterCPU(*s, *s));
+        CPUDrop drop(waters[0]);
+        measure("drop", "cpu", *s, *s, 1, drop);
+        CPUUpdate update(waters);
+        measure("update", "cpu", *s, *s, 1, update);
+        CPUTileUpdate tiled(waters[0]);
+        measure("update_one_drop", "cpu_tiles", *s, *s, 1, tiled);
+        waters[0]->useFixed(true);
+        measure("update", "cpu_int16", *s, *s, 1, update);
+        waters[0]->useFixed(false);
+        waters[0]->shallow = true;
+        measure("update", "cpu_swe", *s, *s, 1, update);
+        delete waters[0];
+    }
+
+    // Time for a wave to travel the same distance with each solver
+    for (const int *s = sizes; *s && *s <= 256; s++)
+    {
+        WaterCPU water(*s, *s);
+        CPUCrossing crossing(&water);
+        measure("crossing", "cpu", *s, *s, 1, crossing);
+        water.shallow = true;
+        measure("crossing", "cpu_swe", *s, *s, 1, crossing);
+    }
+
+    // Error of the int16 solver, for the same drops as the float solver
+    for (const int *s = sizes; *s && *s <= 512; s++)
+    {
+        WaterCPU reference(*s, *s), fixed(*s, *s);
+        std::vector<float> heights, expected;
+        fixed.useFixed(true);
+        for (int i = 0; i < 20; i++)
+        {
+            double x = (i * 37 % 200) / 100.0 - 1.0;
+            double y = (i * 91 % 200) / 100.0 - 1.0;
+            double strength = (i & 1) ? 1.0 : -1.0;
+            reference.drop(x, y, 2.0, strength);
+            fixed.drop(x, y, 2.0, strength);
+        }
+        for (int steps = 0; steps < 1000; )
+        {
+            int next = steps ? steps * 10 : 10;
+            for (; steps < next; steps++)
+            {
+                reference.update(0.99f);
+                fixed.update(0.99f);
+            }
+            surface(fixed, heights);
+            surface(reference, expected);
+            accuracy("cpu_int16", *s, *s, steps, &heights[0],
+                     &expected[0], *s);
+        }
+    }
+
+    // Ocean frames, whose cost does not depend on the waves
+    for (const int *s = sizes; *s && *s <= 1024; s++)
+    {
+        WaterOcean ocean(*s, *s);
+        CPUOcean frame(&ocean);
+        measure("ocean", "cpu_fft", *s, *s, 1, frame);
+    }
+
+    // Update steps per second for many small waters
+    for (const int *c = counts; *c; c++)
+    {
+        std::vector<WaterCPU *> waters;
+        for (int i = 0; i < *c; i++)
+        {
+            waters.push_back(new WaterCPU(64, 64));
+            waters.back()->drop(0.0, 0.0, 10.0, 1.0);
+        }
+        CPUUpdate update(waters);
+        measure("update", "cpu", 64, 64, *c, update);
+        for (int i = 0; i < *c; i++)
+            waters[i]->useFixed(true);
+        measure("update", "cpu_int16", 64, 64, *c, update);
+        for (int i = 0; i < *c; i++)
+            delete waters[i];
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef WATER_BENCH_H
+#define WATER_BENCH_H
+// *****************************************************************************
+// water_bench.h                                                   Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//      Benchmarks of the water simulation.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2014,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+class WaterBench
+// ----------------------------------------------------------------------------
+//   Measure the throughput of water operations and report it as JSON
+// ----------------------------------------------------------------------------
+//   The CPU suites only depend on the solver and also run in the standalone
+//   water_bench program. The GL suites need a Tao GL context and are only
+//   available from the module, through the water_bench primitive.
+{
+public:
+    struct Operation
+    {
+        virtual ~Operation() {}
+        virtual void run() = 0;     // One iteration of the measured work
+        virtual void finish() {}    // Wait for asynchronous work to complete
+    };
+
+public:
+    WaterBench(double minTime = 0.2);
+
+    // Benchmark suites
+    void        cpu();
+    void        gl();
+
+    // Run 'op' until at least minTime seconds elapsed, return iterations/s
+    double      measure(std::string name, std::string backend,
+                        int width, int height, int waters, Operation &op);
+
+    // Record the difference of heights with the float solver after 'steps'
+    void        accuracy(std::string backend, int width, int height,
+                         int steps, const float *heights,
+                         const float *reference, int stride);
+    void        json(std::ostream &out);
+
+public:
+    static const int sizes[];   // Grid sizes, terminated by 0
+    static const int counts[];  // Numbers of waters, terminated by 0
+
+private:
+    struct Result
+    {
+        std::string     name, backend;
+        int             width, height, waters;
+        long            iterations;
+        double          seconds;
+    };
+    struct Accuracy
+    {
+        std::string     backend;
+        int             width, height, steps;
+        double          maxError, rmsError, amplitude;
+    };
+    std::vector<Result> results;
+    std::vector<Accuracy> accuracies;
+    double              minTime;
+};
+
+#endif
@@ -0,0 +1,54 @@
+# ******************************************************************************
+# water_bench.pro                                                  Tao3D project
+# ******************************************************************************
+#
+# File description:
+# Qt build file for the standalone benchmark of the water solver
+#
+#   Build with: qmake water_bench.pro && make
+#   Run with:   ./water_bench > results.json
+#
+#
+#
+#
+# ******************************************************************************
+# This software is licensed under the GNU General Public License v3
+# (C) 2012-2015,2019, Christophe de Dinechin <christophe@dinechin.org>
+# ******************************************************************************
+# This file is part of Tao3D
+#
+# Tao3D is free software: you can r redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Tao3D is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Tao3D, in a file named COPYING.
+# If not, see <https://www.gnu.org/licenses/>.
+# ******************************************************************************
+
+TEMPLATE = app
+TARGET   = water_bench
+CONFIG  += console release
+CONFIG  -= app_bundle
+QT       = core
+
+HEADERS = \
+    water_bench.h \
+    water_cpu.h \
+    water_ocean.h \
+    water_pool.h \
+    water_tiles.h
+
+SOURCES = \
+    water_bench_main.cpp \
+    water_bench.cpp \
+    water_cpu.cpp \
+    water_ocean.cpp \
+    water_pool.cpp \
+    water_tiles.cpp
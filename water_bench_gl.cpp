@@ -0,0 +1,332 @@
+// *****************************************************************************
+// water_bench_gl.cpp                                              Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//   GL benchmark suites for the water simulation.
+//
+//   These suites drive the Water and WaterFactory classes, and therefore
+//   need the GL context of Tao. They run from the water_bench primitive.
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2015,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+#include "water_bench.h"
+#include "water_atlas.h"
+#include "water_factory.h"
+#include "water_pass.h"
+#include "tao/graphic_state.h"
+#include <sstream>
+
+
+
+// ============================================================================
+//
+//   Operations on waters
+//
+// ============================================================================
+
+struct GLOperation : WaterBench::Operation
+// ----------------------------------------------------------------------------
+//   An operation that must wait for the GPU to complete
+// ----------------------------------------------------------------------------
+{
+    GLOperation(Water *water): water(water), index(0) {}
+    virtual void finish()
+    {
+        GL.Sync();
+        glFinish();
+    }
+    Water *water;
+    long   index;
+};
+
+
+struct GLUpdate : GLOperation
+// ----------------------------------------------------------------------------
+//   One solver step
+// ----------------------------------------------------------------------------
+{
+    GLUpdate(Water *water): GLOperation(water) {}
+    virtual void run()  { water->update(1); }
+};
+
+
+struct GLDrop : GLOperation
+// ----------------------------------------------------------------------------
+//   One drop, moving across the surface
+// ----------------------------------------------------------------------------
+{
+    GLDrop(Water *water): GLOperation(water) {}
+    virtual void run()
+    {
+        index++;
+        double x = (index * 37 % 200) / 100.0 - 1.0;
+        double y = (index * 91 % 200) / 100.0 - 1.0;
+        water->drop(x, y, 1.0, (index & 1) ? 1.0 : -1.0);
+    }
+};
+
+
+struct GLDraw : GLOperation
+// ----------------------------------------------------------------------------
+//   Bind the water texture, uploading it first for CPU waters
+// ----------------------------------------------------------------------------
+{
+    GLDraw(Water *water, bool upload): GLOperation(water), upload(upload) {}
+    virtual void run()
+    {
+        if (upload)
+            water->drop(0.0, 0.0, 1.0, (++index & 1) ? 1.0 : -1.0);
+        water->Draw();
+    }
+    bool upload;
+};
+
+
+struct GLUpdateMany : GLOperation
+// ----------------------------------------------------------------------------
+//   One solver step of many waters, then bind each of them for drawing
+// ----------------------------------------------------------------------------
+//   Waters are drawn like by water_mesh, which lets them join an atlas, but
+//   with an empty mesh so that rasterizing is not timed.
+{
+    GLUpdateMany(std::vector<Water *> &waters)
+        : GLOperation(NULL), waters(waters) {}
+    virtual void run()
+    {
+        for (uint w = 0; w < waters.size(); w++)
+            waters[w]->update(1);
+        for (uint w = 0; w < waters.size(); w++)
+        {
+            waters[w]->Draw();
+            waters[w]->drawMesh(0.0, 0.0);
+        }
+    }
+    std::vector<Water *> &waters;
+};
+
+
+struct PassAttrib : GLOperation
+// ----------------------------------------------------------------------------
+//   Empty render pass saving the state with glPushAttrib, as we used to
+// ----------------------------------------------------------------------------
+{
+    PassAttrib(): GLOperation(NULL) {}
+    virtual void run()
+    {
+        GL.Sync();
+        glPushAttrib(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT |
+                     GL_TEXTURE_BIT | GL_VIEWPORT_BIT);
+        GL.BindFramebuffer(GL_FRAMEBUFFER, 0);
+        GL.Viewport(0, 0, 64, 64);
+        GL.UseProgram(0);
+        GL.BindTexture(GL_TEXTURE_2D, 0);
+        GL.Disable(GL_TEXTURE_2D);
+        GL.BindFramebuffer(GL_FRAMEBUFFER, 0);
+        glPopAttrib();
+    }
+};
+
+
+struct PassTracked : GLOperation
+// ----------------------------------------------------------------------------
+//   Empty render pass saving only the state it changes
+// ----------------------------------------------------------------------------
+{
+    PassTracked(): GLOperation(NULL) {}
+    virtual void run()
+    {
+        WaterPass pass(0, 64, 64, 0);
+    }
+};
+
+
+
+// ============================================================================
+//
+//   Operations on the factory
+//
+// ============================================================================
+
+struct FactoryLookup : WaterBench::Operation
+// ----------------------------------------------------------------------------
+//   Look up all waters by name
+// ----------------------------------------------------------------------------
+{
+    FactoryLookup(std::vector<text> &names): names(names) {}
+    virtual void run()
+    {
+        WaterFactory *factory = WaterFactory::instance();
+        for (unsigned i = 0; i < names.size(); i++)
+            factory->water(names[i]);
+    }
+    std::vector<text> &names;
+};
+
+
+struct FactoryHandle : WaterBench::Operation
+// ----------------------------------------------------------------------------
+//   Look up all waters by handle
+// ----------------------------------------------------------------------------
+{
+    FactoryHandle(std::vector<int> &handles): handles(handles) {}
+    virtual void run()
+    {
+        WaterFactory *factory = WaterFactory::instance();
+        for (unsigned i = 0; i < handles.size(); i++)
+            factory->water(handles[i]);
+    }
+    std::vector<int> &handles;
+};
+
+
+struct FactoryCreate : WaterBench::Operation
+// ----------------------------------------------------------------------------
+//   Create then remove small waters
+// ----------------------------------------------------------------------------
+{
+    FactoryCreate(std::vector<text> &names): names(names) {}
+    virtual void run()
+    {
+        Integer_p size = new Integer(64);
+        for (unsigned i = 0; i < names.size(); i++)
+            WaterFactory::water_resolution(names[i], size, size);
+        for (unsigned i = 0; i < names.size(); i++)
+            WaterFactory::water_remove(names[i]);
+    }
+    std::vector<text> &names;
+};
+
+
+
+// ============================================================================
+//
+//   GL suites
+//
+// ============================================================================
+
+void WaterBench::gl()
+// ----------------------------------------------------------------------------
+//   Run the benchmark suites that need a GL context
+// ----------------------------------------------------------------------------
+{
+    // Water operations for each grid size, on shaders and on the CPU
+    for (const int *s = sizes; *s; s++)
+    {
+        // Time full solver steps, not a water that fell asleep
+        Water gpu(*s, *s);
+        gpu.sleepy = false;
+        GLDrop drop(&gpu);
+        measure("drop", "gpu", *s, *s, 1, drop);
+        GLUpdate update(&gpu);
+        measure("update", "gpu", *s, *s, 1, update);
+        GLDraw draw(&gpu, false);
+        measure("draw", "gpu", *s, *s, 1, draw);
+
+        Water swe(*s, *s);
+        swe.sleepy = false;
+        swe.useSolver("swe");
+        GLUpdate shallow(&swe);
+        measure("update", "gpu_swe", *s, *s, 1, shallow);
+
+        Water cpu(*s, *s);
+        cpu.useCPU(true);
+        GLDraw upload(&cpu, true);
+        measure("draw", "cpu", *s, *s, 1, upload);
+    }
+
+    // Solver step for each texture format
+    static const char *formats[] = { "rgba16f", "rg16f", "rg32f", NULL };
+    for (const int *s = sizes; *s; s++)
+    {
+        for (const char **f = formats; *f; f++)
+        {
+            Water water(*s, *s);
+            water.sleepy = false;
+            water.useFormat(*f);
+            water.drop(0.0, 0.0, 1.0, 1.0);
+            GLUpdate update(&water);
+            measure("update_format", water.formatName(), *s, *s, 1, update);
+        }
+    }
+
+    // Many small waters, each with its own textures or all in an atlas
+    for (const int *c = counts; *c; c++)
+    {
+        std::vector<Water *> waters;
+        for (int i = 0; i < *c; i++)
+        {
+            waters.push_back(new Water(32, 32));
+            waters.back()->sleepy = false;
+            waters.back()->drop(0.0, 0.0, 1.0, 1.0);
+        }
+        GLUpdateMany solo(waters);
+        measure("update_many", "gpu", 32, 32, *c, solo);
+
+        WaterAtlas atlas(2048);
+        for (int i = 0; i < *c; i++)
+            atlas.attach(waters[i]);
+        GLUpdateMany packed(waters);
+        measure("update_many", "atlas", 32, 32, *c, packed);
+
+        for (int i = 0; i < *c; i++)
+            delete waters[i];
+    }
+
+    // Overhead of the state save and restore of a render pass
+    PassAttrib attrib;
+    measure("pass", "pushattrib", 64, 64, 1, attrib);
+    PassTracked tracked;
+    measure("pass", "tracked", 64, 64, 1, tracked);
+
+    // Factory lookup and creation for increasing numbers of waters
+    for (const int *c = counts; *c; c++)
+    {
+        std::vector<text> names;
+        for (int i = 0; i < *c; i++)
+        {
+            std::ostringstream name;
+            name << "water_bench_" << i;
+            names.push_back(name.str());
+        }
+
+        FactoryCreate create(names);
+        measure("factory_create", "gpu", 64, 64, *c, create);
+
+        Integer_p size = new Integer(64);
+        for (int i = 0; i < *c; i++)
+            WaterFactory::water_resolution(names[i], size, size);
+        FactoryLookup lookup(names);
+        measure("factory_lookup", "gpu", 64, 64, *c, lookup);
+
+        std::vector<int> handles;
+        for (int i = 0; i < *c; i++)
+            handles.push_back(WaterFactory::instance()->handle(names[i]));
+        FactoryHandle byHandle(handles);
+        measure("factory_handle", "gpu", 64, 64, *c, byHandle);
+        for (int i = 0; i < *c; i++)
+            WaterFactory::water_remove(names[i]);
+    }
+}
@@ -0,0 +1,67 @@
+// *****************************************************************************
+// water_bench_main.cpp                                            Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//   Standalone benchmark of the CPU water solver.
+//
+//   Usage: water_bench [-t threads] [-m min_seconds] > results.json
+//   The GL suites need Tao, use the water_bench primitive for them.
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2015,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+#include "water_bench.h"
+#include "water_pool.h"
+#include <cstdlib>
+#include <cstring>
+
+
+int main(int argc, char **argv)
+// ----------------------------------------------------------------------------
+//   Run the CPU suites and print the results as JSON on standard output
+// ----------------------------------------------------------------------------
+{
+    int threads = 0;
+    double minTime = 0.2;
+    for (int a = 1; a < argc; a++)
+    {
+        if (!strcmp(argv[a], "-t") && a + 1 < argc)
+            threads = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-m") && a + 1 < argc)
+            minTime = atof(argv[++a]);
+        else
+        {
+            std::cerr << "Usage: " << argv[0]
+                      << " [-t threads] [-m min_seconds]\n";
+            return 1;
+        }
+    }
+
+    WaterPool::setThreads(threads);
+    WaterBench bench(minTime);
+    bench.cpu();
+    bench.json(std::cout);
+    WaterPool::destroy();
+    return 0;
+}
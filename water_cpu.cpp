@@ -0,0 +1,1270 @@
+// *****************************************************************************
+// water_cpu.cpp                                                   Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//   CPU reference solver for the water simulation.
+//
+//   The kernels below reproduce the drop and update shaders of water.cpp
+//   texel for texel, including the clamp-to-edge behaviour of the textures.
+//   The update kernel is vectorized with AVX, SSE2 or NEON depending on the
+//   instruction set the module is compiled for, with a scalar fallback.
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2013, Baptiste Soulisse <baptiste.soulisse@taodyne.com>
+// (C) 2012-2015,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+#include "water_cpu.h"
+#include "water_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define WATER_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define WATER_NEON
+#endif
+
+
+
+// ============================================================================
+//
+//   Row kernels
+//
+// ============================================================================
+
+static inline void updateTexel(float left, float down, float right, float up,
+                               float height, float &velocity, float &out,
+                               float ratio)
+// ----------------------------------------------------------------------------
+//   Scalar version of the update shader for a single texel
+// ----------------------------------------------------------------------------
+{
+    float average = (left + down + right + up) * 0.25f;
+    velocity = (velocity + (average - height) * 2.0f) * ratio;
+    out = height + velocity;
+}
+
+
+static void updateRow(const float *down, const float *row, const float *up,
+                      float *velocity, float *out, int width,
+                      int x0, int x1, float ratio, bool wrap)
+// ----------------------------------------------------------------------------
+//   Update texels [x0, x1) of a row, reading neighbours in 'down' and 'up'
+// ----------------------------------------------------------------------------
+//   Edges are clamped, or read the other edge if 'wrap' is set
+{
+    int last = width - 1;
+    if (last == 0)
+    {
+        updateTexel(row[0], down[0], row[0], up[0], row[0],
+                    velocity[0], out[0], ratio);
+        return;
+    }
+
+    // Left edge, clamped or wrapped
+    int x = x0;
+    if (x == 0)
+    {
+        updateTexel(wrap ? row[last] : row[0], down[0], row[1], up[0], row[0],
+                    velocity[0], out[0], ratio);
+        x = 1;
+    }
+
+    int end = std::min(x1, last);
+#if defined(__AVX__)
+    const __m256 quarter = _mm256_set1_ps(0.25f);
+    const __m256 two     = _mm256_set1_ps(2.0f);
+    const __m256 r       = _mm256_set1_ps(ratio);
+    for (; x + 8 <= end; x += 8)
+    {
+        __m256 c   = _mm256_loadu_ps(row + x);
+        __m256 sum = _mm256_add_ps(_mm256_loadu_ps(row + x - 1),
+                                   _mm256_loadu_ps(down + x));
+        sum = _mm256_add_ps(sum, _mm256_loadu_ps(row + x + 1));
+        sum = _mm256_add_ps(sum, _mm256_loadu_ps(up + x));
+        __m256 avg = _mm256_mul_ps(sum, quarter);
+        __m256 v   = _mm256_loadu_ps(velocity + x);
+        v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_sub_ps(avg, c), two));
+        v = _mm256_mul_ps(v, r);
+        _mm256_storeu_ps(velocity + x, v);
+        _mm256_storeu_ps(out + x, _mm256_add_ps(c, v));
+    }
+#elif defined(WATER_SSE2)
+    const __m128 quarter = _mm_set1_ps(0.25f);
+    const __m128 two     = _mm_set1_ps(2.0f);
+    const __m128 r       = _mm_set1_ps(ratio);
+    for (; x + 4 <= end; x += 4)
+    {
+        __m128 c   = _mm_loadu_ps(row + x);
+        __m128 sum = _mm_add_ps(_mm_loadu_ps(row + x - 1),
+                                _mm_loadu_ps(down + x));
+        sum = _mm_add_ps(sum, _mm_loadu_ps(row + x + 1));
+        sum = _mm_add_ps(sum, _mm_loadu_ps(up + x));
+        __m128 avg = _mm_mul_ps(sum, quarter);
+        __m128 v   = _mm_loadu_ps(velocity + x);
+        v = _mm_add_ps(v, _mm_mul_ps(_mm_sub_ps(avg, c), two));
+        v = _mm_mul_ps(v, r);
+        _mm_storeu_ps(velocity + x, v);
+        _mm_storeu_ps(out + x, _mm_add_ps(c, v));
+    }
+#elif defined(WATER_NEON)
+    const float32x4_t quarter = vdupq_n_f32(0.25f);
+    const float32x4_t two     = vdupq_n_f32(2.0f);
+    const float32x4_t r       = vdupq_n_f32(ratio);
+    for (; x + 4 <= end; x += 4)
+    {
+        float32x4_t c   = vld1q_f32(row + x);
+        float32x4_t sum = vaddq_f32(vld1q_f32(row + x - 1),
+                                    vld1q_f32(down + x));
+        sum = vaddq_f32(sum, vld1q_f32(row + x + 1));
+        sum = vaddq_f32(sum, vld1q_f32(up + x));
+        float32x4_t avg = vmulq_f32(sum, quarter);
+        float32x4_t v   = vld1q_f32(velocity + x);
+        v = vaddq_f32(v, vmulq_f32(vsubq_f32(avg, c), two));
+        v = vmulq_f32(v, r);
+        vst1q_f32(velocity + x, v);
+        vst1q_f32(out + x, vaddq_f32(c, v));
+    }
+#endif
+
+    // Remaining texels, then right edge, clamped or wrapped
+    for (; x < end; x++)
+        updateTexel(row[x-1], down[x], row[x+1], up[x], row[x],
+                    velocity[x], out[x], ratio);
+    if (x1 == width)
+        updateTexel(row[last-1], down[last], wrap ? row[0] : row[last],
+                    up[last], row[last], velocity[last], out[last], ratio);
+}
+
+
+
+// ============================================================================
+//
+//   Fixed-point row kernels
+//
+// ============================================================================
+//   Heights and velocities are int16. Each operation saturates like the
+//   SIMD instructions, and halving and damping round toward zero, so that
+//   the scalar and SIMD kernels give the same bits, and small waves die out
+//   instead of drifting. The damping ratio is a 16-bit fraction.
+
+static inline qint16 saturate(int v)
+// ----------------------------------------------------------------------------
+//   Clamp to the range of int16, like saturating SIMD instructions
+// ----------------------------------------------------------------------------
+{
+    return v < -32768 ? -32768 : v > 32767 ? 32767 : v;
+}
+
+
+static inline qint16 toFixed(float v)
+// ----------------------------------------------------------------------------
+//   Round a float height or velocity to the nearest fixed-point unit
+// ----------------------------------------------------------------------------
+{
+    return saturate((int) floor(v * WaterCPU::FIXED_SCALE + 0.5f));
+}
+
+
+static inline void updateTexel(qint16 left, qint16 down, qint16 right,
+                               qint16 up, qint16 height, qint16 &velocity,
+                               qint16 &out, int ratio)
+// ----------------------------------------------------------------------------
+//   Fixed-point version of the update shader, reference of the SIMD kernels
+// ----------------------------------------------------------------------------
+{
+    int sum = saturate(left - height);
+    sum = saturate(sum + saturate(down - height));
+    sum = saturate(sum + saturate(right - height));
+    sum = saturate(sum + saturate(up - height));
+    int force = (sum + (sum < 0)) >> 1;         // 2 * (average - height)
+    int v = saturate(velocity + force);
+    int damped = (abs(v) * ratio) >> 16;
+    velocity = v < 0 ? -damped : damped;
+    out = saturate(height + velocity);
+}
+
+
+#if defined(__AVX2__)
+// Sixteen texels at a time
+typedef __m256i FixedVector;
+typedef __m256i FixedRatio;
+enum { FIXED_LANES = 16 };
+#define WATER_FIXED_SIMD
+
+static inline FixedRatio fixedRatio(int ratio)
+// ----------------------------------------------------------------------------
+//   Damping ratio in all lanes
+// ----------------------------------------------------------------------------
+{
+    return _mm256_set1_epi16((short) ratio);
+}
+
+
+static inline void updateVector(const qint16 *down, const qint16 *row,
+                                const qint16 *up, const qint16 *velocity,
+                                int x, FixedRatio r,
+                                FixedVector &v, FixedVector &out)
+// ----------------------------------------------------------------------------
+//   Update texels [x, x + FIXED_LANES), returning velocities and heights
+// ----------------------------------------------------------------------------
+{
+    __m256i c = _mm256_loadu_si256((const __m256i *) (row + x));
+    __m256i l = _mm256_loadu_si256((const __m256i *) (row + x - 1));
+    __m256i d = _mm256_loadu_si256((const __m256i *) (down + x));
+    __m256i n = _mm256_loadu_si256((const __m256i *) (row + x + 1));
+    __m256i u = _mm256_loadu_si256((const __m256i *) (up + x));
+    __m256i s = _mm256_subs_epi16(l, c);
+    s = _mm256_adds_epi16(s, _mm256_subs_epi16(d, c));
+    s = _mm256_adds_epi16(s, _mm256_subs_epi16(n, c));
+    s = _mm256_adds_epi16(s, _mm256_subs_epi16(u, c));
+    s = _mm256_srai_epi16(_mm256_add_epi16(s, _mm256_srli_epi16(s, 15)), 1);
+    v = _mm256_loadu_si256((const __m256i *) (velocity + x));
+    v = _mm256_adds_epi16(v, s);
+    __m256i sign = _mm256_srai_epi16(v, 15);
+    __m256i a = _mm256_sub_epi16(_mm256_xor_si256(v, sign), sign);
+    a = _mm256_mulhi_epu16(a, r);
+    v = _mm256_sub_epi16(_mm256_xor_si256(a, sign), sign);
+    out = _mm256_adds_epi16(c, v);
+}
+
+
+static inline void storeVector(qint16 *dst, FixedVector v)
+// ----------------------------------------------------------------------------
+//   Store FIXED_LANES texels
+// ----------------------------------------------------------------------------
+{
+    _mm256_storeu_si256((__m256i *) dst, v);
+}
+
+#elif defined(__SSE2__) || defined(_M_X64)
+typedef __m128i FixedVector;
+typedef __m128i FixedRatio;
+enum { FIXED_LANES = 8 };
+#define WATER_FIXED_SIMD
+
+static inline FixedRatio fixedRatio(int ratio)
+// ----------------------------------------------------------------------------
+//   Damping ratio in all lanes
+// ----------------------------------------------------------------------------
+{
+    return _mm_set1_epi16((short) ratio);
+}
+
+
+static inline void updateVector(const qint16 *down, const qint16 *row,
+                                const qint16 *up, const qint16 *velocity,
+                                int x, FixedRatio r,
+                                FixedVector &v, FixedVector &out)
+// ----------------------------------------------------------------------------
+//   Update texels [x, x + FIXED_LANES), returning velocities and heights
+// ----------------------------------------------------------------------------
+{
+    __m128i c = _mm_loadu_si128((const __m128i *) (row + x));
+    __m128i l = _mm_loadu_si128((const __m128i *) (row + x - 1));
+    __m128i d = _mm_loadu_si128((const __m128i *) (down + x));
+    __m128i n = _mm_loadu_si128((const __m128i *) (row + x + 1));
+    __m128i u = _mm_loadu_si128((const __m128i *) (up + x));
+    __m128i s = _mm_subs_epi16(l, c);
+    s = _mm_adds_epi16(s, _mm_subs_epi16(d, c));
+    s = _mm_adds_epi16(s, _mm_subs_epi16(n, c));
+    s = _mm_adds_epi16(s, _mm_subs_epi16(u, c));
+    s = _mm_srai_epi16(_mm_add_epi16(s, _mm_srli_epi16(s, 15)), 1);
+    v = _mm_loadu_si128((const __m128i *) (velocity + x));
+    v = _mm_adds_epi16(v, s);
+    __m128i sign = _mm_srai_epi16(v, 15);
+    __m128i a = _mm_sub_epi16(_mm_xor_si128(v, sign), sign);
+    a = _mm_mulhi_epu16(a, r);
+    v = _mm_sub_epi16(_mm_xor_si128(a, sign), sign);
+    out = _mm_adds_epi16(c, v);
+}
+
+
+static inline void storeVector(qint16 *dst, FixedVector v)
+// ----------------------------------------------------------------------------
+//   Store FIXED_LANES texels
+// ----------------------------------------------------------------------------
+{
+    _mm_storeu_si128((__m128i *) dst, v);
+}
+
+#elif defined(WATER_NEON)
+typedef int16x8_t FixedVector;
+typedef uint16x4_t FixedRatio;
+enum { FIXED_LANES = 8 };
+#define WATER_FIXED_SIMD
+
+static inline FixedRatio fixedRatio(int ratio)
+// ----------------------------------------------------------------------------
+//   Damping ratio in all lanes
+// ----------------------------------------------------------------------------
+{
+    return vdup_n_u16((uint16_t) ratio);
+}
+
+
+static inline void updateVector(const qint16 *down, const qint16 *row,
+                                const qint16 *up, const qint16 *velocity,
+                                int x, FixedRatio r,
+                                FixedVector &v, FixedVector &out)
+// ----------------------------------------------------------------------------
+//   Update texels [x, x + FIXED_LANES), returning velocities and heights
+// ----------------------------------------------------------------------------
+{
+    int16x8_t c = vld1q_s16(row + x);
+    int16x8_t s = vqsubq_s16(vld1q_s16(row + x - 1), c);
+    s = vqaddq_s16(s, vqsubq_s16(vld1q_s16(down + x), c));
+    s = vqaddq_s16(s, vqsubq_s16(vld1q_s16(row + x + 1), c));
+    s = vqaddq_s16(s, vqsubq_s16(vld1q_s16(up + x), c));
+    int16x8_t neg = vreinterpretq_s16_u16(
+        vshrq_n_u16(vreinterpretq_u16_s16(s), 15));
+    s = vshrq_n_s16(vaddq_s16(s, neg), 1);
+    v = vqaddq_s16(vld1q_s16(velocity + x), s);
+    int16x8_t sign = vshrq_n_s16(v, 15);
+    uint16x8_t a = vreinterpretq_u16_s16(
+        vsubq_s16(veorq_s16(v, sign), sign));
+    uint16x8_t t = vcombine_u16(
+        vshrn_n_u32(vmull_u16(vget_low_u16(a), r), 16),
+        vshrn_n_u32(vmull_u16(vget_high_u16(a), r), 16));
+    v = vsubq_s16(veorq_s16(vreinterpretq_s16_u16(t), sign), sign);
+    out = vqaddq_s16(c, v);
+}
+
+
+static inline void storeVector(qint16 *dst, FixedVector v)
+// ----------------------------------------------------------------------------
+//   Store FIXED_LANES texels
+// ----------------------------------------------------------------------------
+{
+    vst1q_s16(dst, v);
+}
+#endif
+
+
+static void updateRow(const qint16 *down, const qint16 *row, const qint16 *up,
+                      qint16 *velocity, qint16 *out, int width,
+                      int x0, int x1, int ratio, bool wrap)
+// ----------------------------------------------------------------------------
+//   Update texels [x0, x1) of a fixed-point row, like the float version
+// ----------------------------------------------------------------------------
+//   Rows of small waters would spend most of their time in the scalar tail,
+//   so the last vector of the run is computed first and overlaps the others.
+//   Its texels are computed from the same inputs, which gives the same bits.
+{
+    int last = width - 1;
+    if (last == 0)
+    {
+        updateTexel(row[0], down[0], row[0], up[0], row[0],
+                    velocity[0], out[0], ratio);
+        return;
+    }
+
+    // Left edge, clamped or wrapped
+    int x = x0;
+    if (x == 0)
+    {
+        updateTexel(wrap ? row[last] : row[0], down[0], row[1], up[0], row[0],
+                    velocity[0], out[0], ratio);
+        x = 1;
+    }
+
+    int end = std::min(x1, last);
+#if defined(WATER_FIXED_SIMD)
+    if (x + FIXED_LANES <= end)
+    {
+        // Velocities are updated in place: read the tail before the loop
+        int tail = end - FIXED_LANES;
+        FixedRatio r = fixedRatio(ratio);
+        FixedVector tv, th, v, h;
+        updateVector(down, row, up, velocity, tail, r, tv, th);
+        for (; x + FIXED_LANES <= end; x += FIXED_LANES)
+        {
+            updateVector(down, row, up, velocity, x, r, v, h);
+            storeVector(velocity + x, v);
+            storeVector(out + x, h);
+        }
+        storeVector(velocity + tail, tv);
+        storeVector(out + tail, th);
+        x = end;
+    }
+#endif
+
+    // Remaining texels, then right edge, clamped or wrapped
+    for (; x < end; x++)
+        updateTexel(row[x-1], down[x], row[x+1], up[x], row[x],
+                    velocity[x], out[x], ratio);
+    if (x1 == width)
+        updateTexel(row[last-1], down[last], wrap ? row[0] : row[last],
+                    up[last], row[last], velocity[last], out[last], ratio);
+}
+
+
+
+// ============================================================================
+//
+//   Shallow water kernel
+//
+// ============================================================================
+
+static inline void shallowFlux(const float u[3], int axis, float gravity,
+                               float f[3])
+// ----------------------------------------------------------------------------
+//   Flux of depth and momentum along x (axis 1) or y (axis 2)
+// ----------------------------------------------------------------------------
+//   u holds the depth h, then the momentum hu and hv
+{
+    float q = u[axis];
+    float speed = q / u[0];
+    f[0] = q;
+    f[1] = u[1] * speed;
+    f[2] = u[2] * speed;
+    f[axis] += 0.5f * gravity * u[0] * u[0];
+}
+
+
+static inline void shallowFace(const float a[3], const float b[3], int axis,
+                               float gravity, float f[3])
+// ----------------------------------------------------------------------------
+//   Rusanov flux across the face between texels a and b along an axis
+// ----------------------------------------------------------------------------
+//   The average of both fluxes, plus a diffusion set by the fastest wave,
+//   which keeps the scheme stable as long as waves move less than half a
+//   texel per step. Both texels compute the same flux, so mass and momentum
+//   leaving one texel enter its neighbour.
+{
+    float fa[3], fb[3];
+    shallowFlux(a, axis, gravity, fa);
+    shallowFlux(b, axis, gravity, fb);
+    float sa = fabsf(a[axis] / a[0]) + sqrtf(gravity * a[0]);
+    float sb = fabsf(b[axis] / b[0]) + sqrtf(gravity * b[0]);
+    float s = std::max(sa, sb);
+    for (int i = 0; i < 3; i++)
+        f[i] = 0.5f * (fa[i] + fb[i]) - 0.5f * s * (b[i] - a[i]);
+}
+
+
+
+// ============================================================================
+//
+//   Multithreaded update
+//
+// ============================================================================
+
+// Size of the working set of a band of rows, chosen to stay in L2 cache
+static const int BAND_BYTES = 128 * 1024;
+
+
+struct WaterUpdateJob : WaterPool::Job
+// ----------------------------------------------------------------------------
+//   Update one band of a CPU water
+// ----------------------------------------------------------------------------
+//   Heights are double-buffered, so the rows just above and below a band
+//   are read directly from the source buffer and need no halo copy.
+{
+    WaterUpdateJob(WaterCPU *cpu, float ratio)
+        : cpu(cpu), ratio(ratio) {}
+
+    virtual void run(int band)
+    {
+        cpu->updateRect(bands[band], ratio);
+    }
+
+    // Split rectangles in bands of rows whose working set fits in cache
+    void split(const WaterRectList &rects)
+    {
+        for (uint i = 0; i < rects.size(); i++)
+        {
+            const WaterRect &r = rects[i];
+            int texel = cpu->fixed() ? sizeof(qint16) : sizeof(float);
+            int bytes = 3 * (r.x1 - r.x0) * texel;
+            int rows = std::max(4, BAND_BYTES / std::max(bytes, 1));
+            for (int y = r.y0; y < r.y1; y += rows)
+            {
+                WaterRect band = r;
+                band.y0 = y;
+                band.y1 = std::min(y + rows, r.y1);
+                bands.push_back(band);
+            }
+        }
+    }
+
+    WaterCPU *    cpu;
+    float         ratio;
+    WaterRectList bands;
+};
+
+
+
+// ============================================================================
+//
+//   WaterCPU
+//
+// ============================================================================
+
+WaterCPU::WaterCPU(int w, int h)
+// ----------------------------------------------------------------------------
+//   Allocate aligned, zero-initialized arrays
+// ----------------------------------------------------------------------------
+    : width(w), height(h), stride((w + 7) & ~7),
+      shallow(false), depth(0.01f), gravity(10.0f), periodic(false),
+      current(0)
+{
+    size_t size = size_t(stride) * height * sizeof(float);
+    heights[0] = (float *) qMallocAligned(size, 32);
+    heights[1] = (float *) qMallocAligned(size, 32);
+    velocity   = (float *) qMallocAligned(size, 32);
+    momentum[0][0] = momentum[0][1] = NULL;
+    momentum[1][0] = momentum[1][1] = NULL;
+    fixedHeights[0] = fixedHeights[1] = fixedVelocity = NULL;
+    clear();
+}
+
+
+WaterCPU::~WaterCPU()
+// ----------------------------------------------------------------------------
+//   Release arrays
+// ----------------------------------------------------------------------------
+{
+    qFreeAligned(heights[0]);
+    qFreeAligned(heights[1]);
+    qFreeAligned(velocity);
+    for (int b = 0; b < 2; b++)
+        for (int a = 0; a < 2; a++)
+            qFreeAligned(momentum[b][a]);
+    qFreeAligned(fixedHeights[0]);
+    qFreeAligned(fixedHeights[1]);
+    qFreeAligned(fixedVelocity);
+}
+
+
+void WaterCPU::reserve()
+// ----------------------------------------------------------------------------
+//   Allocate the momentum of the shallow water solver on first use
+// ----------------------------------------------------------------------------
+{
+    if (momentum[0][0])
+        return;
+
+    size_t size = size_t(stride) * height * sizeof(float);
+    for (int b = 0; b < 2; b++)
+    {
+        for (int a = 0; a < 2; a++)
+        {
+            momentum[b][a] = (float *) qMallocAligned(size, 32);
+            memset(momentum[b][a], 0, size);
+        }
+    }
+}
+
+
+void WaterCPU::clear()
+// ----------------------------------------------------------------------------
+//   Reset to a flat surface
+// ----------------------------------------------------------------------------
+{
+    size_t size = size_t(stride) * height * sizeof(float);
+    if (heights[0])
+    {
+        memset(heights[0], 0, size);
+        memset(heights[1], 0, size);
+        memset(velocity, 0, size);
+    }
+    if (momentum[0][0])
+        for (int b = 0; b < 2; b++)
+            for (int a = 0; a < 2; a++)
+                memset(momentum[b][a], 0, size);
+    if (fixedHeights[0])
+    {
+        size = size_t(stride) * height * sizeof(qint16);
+        memset(fixedHeights[0], 0, size);
+        memset(fixedHeights[1], 0, size);
+        memset(fixedVelocity, 0, size);
+    }
+    current = 0;
+}
+
+
+void WaterCPU::clear(const WaterRect &r)
+// ----------------------------------------------------------------------------
+//   Reset a rectangle to a flat surface, in both height buffers
+// ----------------------------------------------------------------------------
+{
+    size_t size = (r.x1 - r.x0) * sizeof(float);
+    for (int y = r.y0; y < r.y1; y++)
+    {
+        size_t offset = y * stride + r.x0;
+        if (heights[0])
+        {
+            memset(heights[0] + offset, 0, size);
+            memset(heights[1] + offset, 0, size);
+            memset(velocity + offset, 0, size);
+        }
+        if (momentum[0][0])
+            for (int b = 0; b < 2; b++)
+                for (int a = 0; a < 2; a++)
+                    memset(momentum[b][a] + offset, 0, size);
+        if (fixedHeights[0])
+        {
+            size_t fixedSize = (r.x1 - r.x0) * sizeof(qint16);
+            memset(fixedHeights[0] + offset, 0, fixedSize);
+            memset(fixedHeights[1] + offset, 0, fixedSize);
+            memset(fixedVelocity + offset, 0, fixedSize);
+        }
+    }
+}
+
+
+float WaterCPU::amplitude() const
+// ----------------------------------------------------------------------------
+//   Largest absolute height or velocity, to detect a calm surface
+// ----------------------------------------------------------------------------
+{
+    WaterRect all = { 0, 0, width, height };
+    return amplitude(all);
+}
+
+
+float WaterCPU::amplitude(const WaterRect &r) const
+// ----------------------------------------------------------------------------
+//   Largest absolute height or velocity in a rectangle
+// ----------------------------------------------------------------------------
+//   For the shallow water solver, the momentum along x and y is measured.
+//   In fixed point, waves stop a few units away from flat, where rounding
+//   cancels the forces, so only velocities are measured.
+{
+    if (fixedHeights[0])
+    {
+        int result = 0;
+        for (int y = r.y0; y < r.y1; y++)
+        {
+            const qint16 *vr = fixedVelocity + y * stride;
+            for (int x = r.x0; x < r.x1; x++)
+                result = std::max(result, abs(vr[x]));
+        }
+        return float(result) / FIXED_SCALE;
+    }
+
+    const float *h = heights[current];
+    bool flow = shallow && momentum[0][0];
+    const float *v = flow ? momentum[current][0] : velocity;
+    float result = 0.0f;
+    for (int y = r.y0; y < r.y1; y++)
+    {
+        const float *hr = h + y * stride;
+        const float *vr = v + y * stride;
+        for (int x = r.x0; x < r.x1; x++)
+            result = std::max(result, std::max(fabsf(hr[x]), fabsf(vr[x])));
+        if (flow)
+        {
+            const float *wr = momentum[current][1] + y * stride;
+            for (int x = r.x0; x < r.x1; x++)
+                result = std::max(result, fabsf(wr[x]));
+        }
+    }
+    return result;
+}
+
+
+void WaterCPU::drop(double x, double y, double radius, double strength)
+// ----------------------------------------------------------------------------
+//   Add the cosine drop profile of the drop shader, in place
+// ----------------------------------------------------------------------------
+//   Unlike the shader, only the texels within the drop radius are visited
+{
+    const double PI = 3.141592653589793;
+    double cx = x * 0.5 + 0.5;
+    double cy = y * 0.5 + 0.5;
+    double r = radius / 100.0;
+    if (r <= 0.0)
+        return;
+
+    int x0 = (int) floor((cx - r) * width);
+    int x1 = (int) ceil((cx + r) * width);
+    int y0 = (int) floor((cy - r) * height);
+    int y1 = (int) ceil((cy + r) * height);
+    if (periodic)
+    {
+        // Texels past the edges are those of the other side, once
+        x1 = std::min(x1, x0 + width - 1);
+        y1 = std::min(y1, y0 + height - 1);
+    }
+    else
+    {
+        x0 = std::max(0, x0);
+        x1 = std::min(width - 1, x1);
+        y0 = std::max(0, y0);
+        y1 = std::min(height - 1, y1);
+    }
+
+    float scale = strength / 1000.0;
+    for (int j = y0; j <= y1; j++)
+    {
+        double dy = (j + 0.5) / height - cy;
+        int wj = (j % height + height) % height;
+        for (int i = x0; i <= x1; i++)
+        {
+            double dx = (i + 0.5) / width - cx;
+            double d = 1.0 - sqrt(dx * dx + dy * dy) / r;
+            int wi = (i % width + width) % width;
+            if (d <= 0.0 || isDry(wi, wj))
+                continue;
+            d = 0.5 - cos(d * PI) * 0.5;
+            if (fixedHeights[0])
+            {
+                qint16 &f = fixedHeights[current][wj * stride + wi];
+                f = saturate(f + (int) floor(d * scale * FIXED_SCALE + 0.5));
+                continue;
+            }
+            heights[current][wj * stride + wi] += d * scale;
+        }
+    }
+}
+
+
+void WaterCPU::update(float ratio)
+// ----------------------------------------------------------------------------
+//   Run one step of the update shader on the whole grid
+// ----------------------------------------------------------------------------
+{
+    WaterRectList all(1);
+    WaterRect &r = all[0];
+    r.x0 = r.y0 = 0;
+    r.x1 = width;
+    r.y1 = height;
+    update(ratio, all);
+}
+
+
+void WaterCPU::update(float ratio, const WaterRectList &rects)
+// ----------------------------------------------------------------------------
+//   Run one step of the update shader on the given rectangles
+// ----------------------------------------------------------------------------
+//   Bands of rows are spread over the threads of the pool. Texels outside
+//   the rectangles are not computed, and are expected to be negligible.
+{
+    // The shallow water solver only runs in floats
+    if (shallow)
+    {
+        useFixed(false);
+        reserve();
+    }
+    WaterUpdateJob job(this, ratio);
+    job.split(rects);
+    WaterPool::instance()->run(&job, job.bands.size());
+    current ^= 1;
+}
+
+
+void WaterCPU::updateRows(int y0, int y1, float ratio)
+// ----------------------------------------------------------------------------
+//   Update rows [y0, y1) from the current heights into the other buffer
+// ----------------------------------------------------------------------------
+{
+    WaterRect r = { 0, y0, width, y1 };
+    updateRect(r, ratio);
+}
+
+
+template <typename T, typename R>
+void WaterCPU::updateCells(const WaterRect &r, const T *src, T *dst,
+                           T *vel, R ratio)
+// ----------------------------------------------------------------------------
+//   Update a rectangle with the float or the fixed-point row kernels
+// ----------------------------------------------------------------------------
+{
+    for (int y = r.y0; y < r.y1; y++)
+    {
+        const T *row  = src + y * stride;
+        const T *down = y > 0 ? row - stride : row;
+        const T *up   = y < height - 1 ? row + stride : row;
+        if (periodic && y == 0)
+            down = src + (height - 1) * stride;
+        if (periodic && y == height - 1)
+            up = src;
+        T *v = vel + y * stride;
+        T *out = dst + y * stride;
+        if (cells.empty())
+        {
+            updateRow(down, row, up, v, out, width, r.x0, r.x1, ratio,
+                      periodic);
+            continue;
+        }
+
+        // Runs of wet texels use the row kernel, dry texels stay flat,
+        // and texels of the shore read their own height for dry neighbours
+        const uchar *c = &cells[y * width];
+        int last = width - 1;
+        int downY = down == row ? y : (y > 0 ? y - 1 : height - 1);
+        int upY = up == row ? y : (y < height - 1 ? y + 1 : 0);
+        int x = r.x0;
+        while (x < r.x1)
+        {
+            if (c[x] == WET)
+            {
+                int start = x;
+                while (x < r.x1 && c[x] == WET)
+                    x++;
+                updateRow(down, row, up, v, out, width, start, x, ratio,
+                          periodic);
+                continue;
+            }
+            if (c[x] == SHORE)
+            {
+                int lx = x > 0 ? x - 1 : (periodic ? last : x);
+                int rx = x < last ? x + 1 : (periodic ? 0 : x);
+                T h = row[x];
+                T left  = isDry(lx, y) ? h : row[lx];
+                T right = isDry(rx, y) ? h : row[rx];
+                T below = isDry(x, downY) ? h : down[x];
+                T above = isDry(x, upY) ? h : up[x];
+                updateTexel(left, below, right, above, h, v[x], out[x], ratio);
+            }
+            x++;
+        }
+    }
+}
+
+
+void WaterCPU::updateRect(const WaterRect &r, float ratio)
+// ----------------------------------------------------------------------------
+//   Update a rectangle from the current heights into the other buffer
+// ----------------------------------------------------------------------------
+{
+    if (shallow)
+    {
+        updateShallow(r, ratio);
+        return;
+    }
+
+    if (fixedHeights[0])
+    {
+        int fraction = std::min(65535, (int) floor(ratio * 65536.0 + 0.5));
+        updateCells(r, fixedHeights[current], fixedHeights[current ^ 1],
+                    fixedVelocity, std::max(fraction, 0));
+        return;
+    }
+
+    updateCells(r, heights[current], heights[current ^ 1], velocity, ratio);
+}
+
+
+void WaterCPU::mask(const uchar *dry)
+// ----------------------------------------------------------------------------
+//   Classify texels as wet, on the shore of a dry texel, or dry
+// ----------------------------------------------------------------------------
+//   Dry texels are made flat. Wet texels away from the shore are updated
+//   by the row kernels, shore texels by a scalar version of the kernel.
+{
+    cells.clear();
+    if (!dry)
+        return;
+
+    cells.assign(width * height, WET);
+    int lastX = width - 1, lastY = height - 1;
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            if (dry[y * width + x])
+            {
+                cells[y * width + x] = DRY;
+                continue;
+            }
+            int lx = x > 0 ? x - 1 : (periodic ? lastX : x);
+            int rx = x < lastX ? x + 1 : (periodic ? 0 : x);
+            int dy = y > 0 ? y - 1 : (periodic ? lastY : y);
+            int uy = y < lastY ? y + 1 : (periodic ? 0 : y);
+            if (dry[y * width + lx] || dry[y * width + rx] ||
+                dry[dy * width + x] || dry[uy * width + x])
+                cells[y * width + x] = SHORE;
+        }
+    }
+
+    // Flatten runs of dry texels
+    for (int y = 0; y < height; y++)
+    {
+        int x = 0;
+        while (x < width)
+        {
+            if (cells[y * width + x] != DRY)
+            {
+                x++;
+                continue;
+            }
+            WaterRect r = { x, y, x, y + 1 };
+            while (r.x1 < width && cells[y * width + r.x1] == DRY)
+                r.x1++;
+            clear(r);
+            x = r.x1;
+        }
+    }
+}
+
+
+void WaterCPU::state(int x, int y, float u[3]) const
+// ----------------------------------------------------------------------------
+//   Depth and momentum of a texel for the shallow water solver
+// ----------------------------------------------------------------------------
+//   Texels are never completely dry, which keeps velocities finite
+{
+    int offset = y * stride + x;
+    u[0] = std::max(depth + heights[current][offset], depth * 0.01f);
+    u[1] = momentum[current][0][offset];
+    u[2] = momentum[current][1][offset];
+}
+
+
+void WaterCPU::updateShallow(const WaterRect &r, float ratio)
+// ----------------------------------------------------------------------------
+//   Update a rectangle with the shallow water equations
+// ----------------------------------------------------------------------------
+//   Same scheme as the shallow water shader. Edges are walls: a texel past
+//   the edge is a mirror of the edge texel, with opposite normal momentum.
+//   Periodic edges read the texels of the other side instead.
+//   The ratio attenuates the momentum, like the velocity of the wave solver.
+{
+    uint next = current ^ 1;
+    int lastX = width - 1, lastY = height - 1;
+    for (int y = r.y0; y < r.y1; y++)
+    {
+        for (int x = r.x0; x < r.x1; x++)
+        {
+            // Dry texels stay flat and still
+            if (isDry(x, y))
+                continue;
+
+            float c[3], left[3], right[3], down[3], up[3];
+            int lx = x > 0 ? x - 1 : (periodic ? lastX : x);
+            int rx = x < lastX ? x + 1 : (periodic ? 0 : x);
+            int dy = y > 0 ? y - 1 : (periodic ? lastY : y);
+            int uy = y < lastY ? y + 1 : (periodic ? 0 : y);
+            state(x, y, c);
+            state(lx, y, left);
+            state(rx, y, right);
+            state(x, dy, down);
+            state(x, uy, up);
+
+            // Past a wall or in a dry texel, mirror the texel itself
+            if (lx == x || isDry(lx, y))
+                left[0] = c[0], left[1] = -c[1], left[2] = c[2];
+            if (rx == x || isDry(rx, y))
+                right[0] = c[0], right[1] = -c[1], right[2] = c[2];
+            if (dy == y || isDry(x, dy))
+                down[0] = c[0], down[1] = c[1], down[2] = -c[2];
+            if (uy == y || isDry(x, uy))
+                up[0] = c[0], up[1] = c[1], up[2] = -c[2];
+
+            float fl[3], fr[3], fd[3], fu[3];
+            shallowFace(left, c, 1, gravity, fl);
+            shallowFace(c, right, 1, gravity, fr);
+            shallowFace(down, c, 2, gravity, fd);
+            shallowFace(c, up, 2, gravity, fu);
+
+            int offset = y * stride + x;
+            float h = c[0] - (fr[0] - fl[0]) - (fu[0] - fd[0]);
+            float hu = c[1] - (fr[1] - fl[1]) - (fu[1] - fd[1]);
+            float hv = c[2] - (fr[2] - fl[2]) - (fu[2] - fd[2]);
+            heights[next][offset] = std::max(h, depth * 0.01f) - depth;
+            momentum[next][0][offset] = hu * ratio;
+            momentum[next][1][offset] = hv * ratio;
+        }
+    }
+}
+
+
+template <typename T>
+void WaterCPU::packCells(float *rgba, bool gradients, float unit,
+                         const T *h, const T *v, const T *w) const
+// ----------------------------------------------------------------------------
+//   Interleave float or fixed-point heights and velocities, scaled by 'unit'
+// ----------------------------------------------------------------------------
+{
+    int last = width - 1;
+    float half = 0.5f * unit;
+    for (int y = 0; y < height; y++)
+    {
+        const T *hr = h + y * stride;
+        const T *vr = v + y * stride;
+        const T *wr = w ? w + y * stride : NULL;
+        const T *down = y > 0 ? hr - stride : hr;
+        const T *up = y < height - 1 ? hr + stride : hr;
+        if (periodic && y == 0)
+            down = h + (height - 1) * stride;
+        if (periodic && y == height - 1)
+            up = h;
+        for (int x = 0; x < width; x++)
+        {
+            *rgba++ = hr[x] * unit;
+            *rgba++ = vr[x] * unit;
+            if (wr)
+            {
+                *rgba++ = wr[x] * unit;
+                *rgba++ = 0.0f;
+            }
+            else if (gradients)
+            {
+                int left = x > 0 ? x - 1 : (periodic ? last : x);
+                int right = x < last ? x + 1 : (periodic ? 0 : x);
+                *rgba++ = (hr[right] - hr[left]) * half;
+                *rgba++ = (up[x] - down[x]) * half;
+            }
+            else
+            {
+                *rgba++ = 0.0f;
+                *rgba++ = 0.0f;
+            }
+        }
+    }
+}
+
+
+void WaterCPU::pack(float *rgba, bool gradients) const
+// ----------------------------------------------------------------------------
+//   Interleave heights, velocities and gradients as RGBA texels for upload
+// ----------------------------------------------------------------------------
+//   Gradients are central differences of heights, like in the update shader.
+//   They wrap around the edges of periodic waters, so that copies of the
+//   water show no seam. They are left to 0 when the render shader computes
+//   normals itself. The shallow water solver has its momentum along x and
+//   y in G and B. Fixed-point waters are converted as they are packed.
+{
+    if (fixedHeights[0])
+        packCells(rgba, gradients, 1.0f / FIXED_SCALE,
+                  fixedHeights[current], fixedVelocity, (qint16 *) NULL);
+    else if (shallow && momentum[0][0])
+        packCells(rgba, gradients, 1.0f, heights[current],
+                  momentum[current][0], momentum[current][1]);
+    else
+        packCells(rgba, gradients, 1.0f, heights[current], velocity,
+                  (float *) NULL);
+}
+
+
+void WaterCPU::unpack(const float *texels, int channels)
+// ----------------------------------------------------------------------------
+//   Load heights and velocities from texels read back from a texture
+// ----------------------------------------------------------------------------
+//   For the shallow water solver, G and B are the momentum along x and y.
+//   The momentum along y is 0 when texels only have R and G.
+//   Fixed-point waters are rounded as they are loaded.
+{
+    if (fixedHeights[0] && !shallow)
+    {
+        for (int y = 0; y < height; y++)
+        {
+            qint16 *hr = fixedHeights[current] + y * stride;
+            qint16 *vr = fixedVelocity + y * stride;
+            for (int x = 0; x < width; x++)
+            {
+                hr[x] = toFixed(texels[0]);
+                vr[x] = toFixed(texels[1]);
+                texels += channels;
+            }
+        }
+        return;
+    }
+
+    if (shallow)
+    {
+        useFixed(false);
+        reserve();
+    }
+
+    float *h = heights[current];
+    for (int y = 0; y < height; y++)
+    {
+        float *hr = h + y * stride;
+        float *vr = (shallow ? momentum[current][0] : velocity) + y * stride;
+        float *wr = shallow ? momentum[current][1] + y * stride : NULL;
+        for (int x = 0; x < width; x++)
+        {
+            hr[x] = texels[0];
+            vr[x] = texels[1];
+            if (wr)
+                wr[x] = channels > 2 ? texels[2] : 0.0f;
+            texels += channels;
+        }
+    }
+}
+
+
+float WaterCPU::heightAt(int x, int y) const
+// ----------------------------------------------------------------------------
+//   Current height of a texel
+// ----------------------------------------------------------------------------
+{
+    int offset = y * stride + x;
+    if (fixedHeights[0])
+        return float(fixedHeights[current][offset]) / FIXED_SCALE;
+    return heights[current][offset];
+}
+
+
+float WaterCPU::sample(double x, double y) const
+// ----------------------------------------------------------------------------
+//   Bilinear interpolation between texel centers, clamped to the edges
+// ----------------------------------------------------------------------------
+//   Coordinates are those of drops: -1 to 1 maps to the whole grid
+{
+    double fx = (x * 0.5 + 0.5) * width - 0.5;
+    double fy = (y * 0.5 + 0.5) * height - 0.5;
+    fx = std::max(0.0, std::min(fx, width - 1.0));
+    fy = std::max(0.0, std::min(fy, height - 1.0));
+
+    int x0 = (int) floor(fx);
+    int y0 = (int) floor(fy);
+    int x1 = std::min(x0 + 1, width - 1);
+    int y1 = std::min(y0 + 1, height - 1);
+    float tx = fx - x0;
+    float ty = fy - y0;
+
+    float h00 = heightAt(x0, y0), h10 = heightAt(x1, y0);
+    float h01 = heightAt(x0, y1), h11 = heightAt(x1, y1);
+    float bottom = h00 + (h10 - h00) * tx;
+    float top    = h01 + (h11 - h01) * tx;
+    return bottom + (top - bottom) * ty;
+}
+
+
+void WaterCPU::useFixed(bool enable)
+// ----------------------------------------------------------------------------
+//   Switch between float and int16 heights and velocities
+// ----------------------------------------------------------------------------
+//   The waves are carried over, rounded to the nearest fixed-point unit.
+//   Only the arrays of the current precision are kept.
+{
+    if (enable == fixed())
+        return;
+
+    if (enable)
+    {
+        size_t size = size_t(stride) * height * sizeof(qint16);
+        fixedHeights[0] = (qint16 *) qMallocAligned(size, 32);
+        fixedHeights[1] = (qint16 *) qMallocAligned(size, 32);
+        fixedVelocity   = (qint16 *) qMallocAligned(size, 32);
+        memset(fixedHeights[0], 0, size);
+        memset(fixedHeights[1], 0, size);
+        memset(fixedVelocity, 0, size);
+        compress();
+        qFreeAligned(heights[0]);
+        qFreeAligned(heights[1]);
+        qFreeAligned(velocity);
+        heights[0] = heights[1] = velocity = NULL;
+    }
+    else
+    {
+        size_t size = size_t(stride) * height * sizeof(float);
+        heights[0] = (float *) qMallocAligned(size, 32);
+        heights[1] = (float *) qMallocAligned(size, 32);
+        velocity   = (float *) qMallocAligned(size, 32);
+        memset(heights[0], 0, size);
+        memset(heights[1], 0, size);
+        memset(velocity, 0, size);
+        expand();
+        qFreeAligned(fixedHeights[0]);
+        qFreeAligned(fixedHeights[1]);
+        qFreeAligned(fixedVelocity);
+        fixedHeights[0] = fixedHeights[1] = fixedVelocity = NULL;
+    }
+}
+
+
+void WaterCPU::expand()
+// ----------------------------------------------------------------------------
+//   Convert the current fixed-point heights and velocities to floats
+// ----------------------------------------------------------------------------
+{
+    const float unit = 1.0f / FIXED_SCALE;
+    for (int y = 0; y < height; y++)
+    {
+        const qint16 *hr = fixedHeights[current] + y * stride;
+        const qint16 *vr = fixedVelocity + y * stride;
+        float *h = heights[current] + y * stride;
+        float *v = velocity + y * stride;
+        for (int x = 0; x < width; x++)
+        {
+            h[x] = hr[x] * unit;
+            v[x] = vr[x] * unit;
+        }
+    }
+}
+
+
+void WaterCPU::compress()
+// ----------------------------------------------------------------------------
+//   Convert the current float heights and velocities to fixed point
+// ----------------------------------------------------------------------------
+{
+    for (int y = 0; y < height; y++)
+    {
+        const float *h = heights[current] + y * stride;
+        const float *v = velocity + y * stride;
+        qint16 *hr = fixedHeights[current] + y * stride;
+        qint16 *vr = fixedVelocity + y * stride;
+        for (int x = 0; x < width; x++)
+        {
+            hr[x] = toFixed(h[x]);
+            vr[x] = toFixed(v[x]);
+        }
+    }
+}
+
+
+const char *WaterCPU::kernel()
+// ----------------------------------------------------------------------------
+//   Return the name of the row kernel selected at compile time
+// ----------------------------------------------------------------------------
+{
+#if defined(__AVX__)
+    return "avx";
+#elif defined(WATER_SSE2)
+    return "sse2";
+#elif defined(WATER_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+
+const char *WaterCPU::fixedKernel()
+// ----------------------------------------------------------------------------
+//   Return the name of the fixed-point row kernel selected at compile time
+// ----------------------------------------------------------------------------
+{
+#if defined(__AVX2__)
+    return "avx2";
+#elif defined(__SSE2__) || defined(_M_X64)
+    return "sse2";
+#elif defined(WATER_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
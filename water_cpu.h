@@ -0,0 +1,145 @@
+#ifndef WATER_CPU_H
+#define WATER_CPU_H
+// *****************************************************************************
+// water_cpu.h                                                     Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//      CPU reference solver for the water simulation.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2013, Baptiste Soulisse <baptiste.soulisse@taodyne.com>
+// (C) 2012-2014,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+#include <QtGlobal>
+#include <vector>
+
+
+struct WaterRect
+// ----------------------------------------------------------------------------
+//   Texels [x0, x1) x [y0, y1) of a water grid
+// ----------------------------------------------------------------------------
+{
+    int x0, y0, x1, y1;
+};
+typedef std::vector<WaterRect> WaterRectList;
+
+
+struct WaterCPU
+// ----------------------------------------------------------------------------
+//   Run the water update and drop shaders on aligned float arrays
+// ----------------------------------------------------------------------------
+//   Heights are double-buffered because the update reads the neighbours,
+//   velocities only depend on the texel itself and are updated in place.
+//   Rows are padded to 'stride' floats so that each row starts aligned.
+//   With 'shallow', the shallow water equations are solved instead, and
+//   velocities are replaced by double-buffered momentum along x and y.
+//   With 'periodic', edges wrap around instead of reflecting waves.
+//   Dry texels of a mask stay flat and reflect waves like edges.
+//   In fixed point, heights and velocities of the wave solver are int16
+//   instead of floats, which halves the memory and its traffic, and steps
+//   give the same bits on all machines.
+{
+    WaterCPU(int w, int h);
+    ~WaterCPU();
+
+    void            drop(double x, double y, double radius, double strength);
+    void            update(float ratio);
+    void            update(float ratio, const WaterRectList &rects);
+    void            clear();
+    void            clear(const WaterRect &r);
+
+    // Largest absolute height or velocity, in the grid or in a rectangle
+    float           amplitude() const;
+    float           amplitude(const WaterRect &r) const;
+
+    // Interleave height, velocity and gradient into 'rgba' for upload,
+    // and load height and velocity from texels of 'channels' floats
+    void            pack(float *rgba, bool gradients) const;
+    void            unpack(const float *texels, int channels = 2);
+
+    // Texels that have no water, one byte per texel, NULL for none
+    void            mask(const uchar *dry);
+
+    // Store heights and velocities as int16, FIXED_SCALE units per height
+    enum { FIXED_SCALE = 1 << 21 };     // Heights within +/- 1/64
+    void            useFixed(bool enable);
+    bool            fixed() const       { return fixedHeights[0] != NULL; }
+
+    // Current height of a texel, or between texels in drop coordinates
+    float           heightAt(int x, int y) const;
+    float           sample(double x, double y) const;
+
+    // Update texels into the other height buffer, without swapping
+    void            updateRows(int y0, int y1, float ratio);
+    void            updateRect(const WaterRect &r, float ratio);
+    void            updateShallow(const WaterRect &r, float ratio);
+
+    // Name of the row kernels selected at compile time
+    static const char *kernel();
+    static const char *fixedKernel();
+
+public:
+    int      width, height, stride;
+
+    // Shallow water solver, heights are added to the rest depth
+    bool     shallow;
+    float    depth, gravity;
+
+    // Neighbours and drops wrap around the edges
+    bool     periodic;
+
+private:
+    void     reserve();
+    void     state(int x, int y, float u[3]) const;
+    void     expand();
+    void     compress();
+    template <typename T>
+    void     packCells(float *rgba, bool gradients, float unit,
+                       const T *h, const T *v, const T *w) const;
+    template <typename T, typename R>
+    void     updateCells(const WaterRect &r, const T *src, T *dst,
+                         T *vel, R ratio);
+    bool     isDry(int x, int y) const
+    {
+        return !cells.empty() && cells[y * width + x] == DRY;
+    }
+
+    // Texels of a mask: wet, wet next to a dry texel, dry
+    enum { WET, SHORE, DRY };
+    std::vector<uchar> cells;
+
+private:
+    float   *heights[2];        // NULL when fixed
+    float   *velocity;
+    float   *momentum[2][2];    // [buffer][axis], NULL until shallow
+    qint16  *fixedHeights[2];   // NULL unless fixed
+    qint16  *fixedVelocity;
+    uint     current;
+};
+
+#endif
@@ -36,7 +36,12 @@
 // If not, see <https://www.gnu.org/licenses/>.
 // *****************************************************************************
 #include "water_factory.h"
+#include "water_pool.h"
+#include "water_bench.h"
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdint.h>
 
 
 const Tao::ModuleApi *WaterFactory::tao = NULL;
@@ -47,25 +52,51 @@ WaterFactory::WaterFactory()
 // ----------------------------------------------------------------------------
 //   Create water factory
 // ----------------------------------------------------------------------------
+//   Handle 0 is never given to a water, and denotes an invalid handle
+    : waters(1, (Water *) NULL), atlas(NULL)
 {
 }
 
 
-Water* WaterFactory::water(text name)
+WaterFactory::~WaterFactory()
 // ----------------------------------------------------------------------------
-//   Return water instance according to its name
+//   Delete the atlas, waters return to their own textures
 // ----------------------------------------------------------------------------
 {
-    Water* water = NULL;
-    water_map::iterator found = waters.find(name);
-    if(found != waters.end())
-    {
-        water = (*found).second;
-    }
-    else
+    delete atlas;
+}
+
+
+int WaterFactory::handle(text name)
+// ----------------------------------------------------------------------------
+//   Return the handle of a water name, allocating one on first use
+// ----------------------------------------------------------------------------
+//   The handle of a name never changes, even if the water is removed
+{
+    handle_map::iterator found = handles.find(name);
+    if (found != handles.end())
+        return (*found).second;
+
+    int handle = waters.size();
+    handles[name] = handle;
+    waters.push_back(NULL);
+    return handle;
+}
+
+
+Water* WaterFactory::water(int handle)
+// ----------------------------------------------------------------------------
+//   Return water instance according to its handle, creating it if needed
+// ----------------------------------------------------------------------------
+{
+    if (handle <= 0 || handle >= (int) waters.size())
+        return NULL;
+
+    Water* water = waters[handle];
+    if (!water)
     {
         water = new Water();
-        waters[name] = water;
+        waters[handle] = water;
     }
     return water;
 }
@@ -99,10 +130,10 @@ void WaterFactory::render_callback(void *arg)
 //   Find water by name and draw it
 // ----------------------------------------------------------------------------
 {
-    text name = text((const char *)arg);
-    Water * water = WaterFactory::instance()->water(name);
-    if (water)
-        water->Draw();
+    WaterFactory *f = WaterFactory::instance();
+    uint handle = (uintptr_t) arg;
+    if (handle < f->waters.size() && f->waters[handle])
+        f->waters[handle]->Draw();
 }
 
 
@@ -117,89 +148,210 @@ void WaterFactory::identify_callback(void *arg)
 
 void WaterFactory::delete_callback(void *arg)
 // ----------------------------------------------------------------------------
-//   Delete water name
+//   Nothing to delete, the argument is a water handle
 // ----------------------------------------------------------------------------
 {
-    free(arg);
+    (void) arg;
 }
 
 
-Real_p WaterFactory::water_strength(text name)
+struct WaterMeshArgs
+// ----------------------------------------------------------------------------
+//   What the layout records to draw the mesh of a water
+// ----------------------------------------------------------------------------
+{
+    WaterMeshArgs(int handle, double w, double h)
+        : handle(handle), w(w), h(h) {}
+    uint   handle;
+    double w, h;
+};
+
+
+void WaterFactory::mesh_callback(void *arg)
+// ----------------------------------------------------------------------------
+//   Draw the mesh of a water, also used to identify it for selection
+// ----------------------------------------------------------------------------
+{
+    WaterFactory *f = WaterFactory::instance();
+    WaterMeshArgs *args = (WaterMeshArgs *) arg;
+    if (args->handle < f->waters.size() && f->waters[args->handle])
+        f->waters[args->handle]->drawMesh(args->w, args->h);
+}
+
+
+void WaterFactory::mesh_delete_callback(void *arg)
+// ----------------------------------------------------------------------------
+//   Delete the arguments recorded by water_mesh
+// ----------------------------------------------------------------------------
+{
+    delete (WaterMeshArgs *) arg;
+}
+
+
+Integer_p WaterFactory::water_handle(text name)
+// ----------------------------------------------------------------------------
+//   Return the integer handle of a water name
+// ----------------------------------------------------------------------------
+{
+    return new Integer(instance()->handle(name));
+}
+
+
+Real_p WaterFactory::water_strength(int handle)
 // ----------------------------------------------------------------------------
 //   Strength of water
 // ----------------------------------------------------------------------------
 {
-    Water* water = instance()->water(name);
+    Water* water = instance()->water(handle);
+    if (!water)
+        return new Real(0.0);
     return new Real(water->strength);
 }
 
 
-Name_p WaterFactory::water_show(text name)
+Text_p WaterFactory::water_stats(int handle)
+// ----------------------------------------------------------------------------
+//   Timing statistics of a water
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    if (!water)
+        return new Text("");
+    std::ostringstream out;
+    water->stats(out);
+    return new Text(out.str());
+}
+
+
+Integer_p WaterFactory::water_grid_width(int handle)
+// ----------------------------------------------------------------------------
+//   Horizontal resolution of the simulation grid
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    return new Integer(water ? water->width : 0);
+}
+
+
+Integer_p WaterFactory::water_grid_height(int handle)
+// ----------------------------------------------------------------------------
+//   Vertical resolution of the simulation grid
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    return new Integer(water ? water->height : 0);
+}
+
+
+Real_p WaterFactory::water_height_at(int handle, Real_p x, Real_p y)
+// ----------------------------------------------------------------------------
+//   Height of a water at a point, from the latest heights read back
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    if (!water)
+        return new Real(0.0);
+    return new Real(water->heightAt(x, y));
+}
+
+
+Name_p WaterFactory::water_resolution(int handle, Integer_p w, Integer_p h)
+// ----------------------------------------------------------------------------
+//   Set the resolution of the simulation grid, creating the water if needed
+// ----------------------------------------------------------------------------
+{
+    WaterFactory * f = WaterFactory::instance();
+    if (w <= 0 || h <= 0 || handle <= 0 || handle >= (int) f->waters.size())
+        return xl_false;
+
+    Water *&water = f->waters[handle];
+    if (water)
+        water->resize(w, h);
+    else
+        water = new Water(w, h);
+    return xl_true;
+}
+
+
+Name_p WaterFactory::water_show(int handle)
 // ----------------------------------------------------------------------------
 //   Show water
 // ----------------------------------------------------------------------------
+//   The layout records the handle itself, so drawing needs no allocation
 {
-    Water* water = instance()->water(name);
-    water->update();
+    WaterFactory *f = instance();
+    Water* water = f->water(handle);
+    if (!water)
+        return XL::xl_false;
+
+    // Small waters join the atlas, unless they cannot or it is full
+    if (f->atlas)
+        f->atlas->attach(water);
+    water->advance();
     instance()->tao->AddToLayout2(WaterFactory::render_callback,
                                  WaterFactory::identify_callback,
-                                 strdup(name.c_str()),
+                                 (void *) (uintptr_t) handle,
                                  WaterFactory::delete_callback);
     return XL::xl_true;
 }
 
 
-Name_p WaterFactory::water_only(text name)
+Name_p WaterFactory::water_mesh(int handle, Real_p w, Real_p h)
+// ----------------------------------------------------------------------------
+//   Draw a surface for a water, with more vertices near the camera
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    if (!water)
+        return XL::xl_false;
+    instance()->tao->AddToLayout2(WaterFactory::mesh_callback,
+                                 WaterFactory::mesh_callback,
+                                 new WaterMeshArgs(handle, w, h),
+                                 WaterFactory::mesh_delete_callback);
+    return XL::xl_true;
+}
+
+
+Name_p WaterFactory::water_only(int handle)
 // ----------------------------------------------------------------------------
 //   Purge all other waters from memory
 // ----------------------------------------------------------------------------
 {
     WaterFactory * f = WaterFactory::instance();
-    water_map::iterator n = f->waters.begin();
-    for (water_map::iterator v = f->waters.begin();
-         v != f->waters.end();
-         v = n)
+    for (int h = 1; h < (int) f->waters.size(); h++)
     {
-        if (name != (*v).first)
-        {
-            Water *w = (*v).second;
-            f->waters.erase(v);
-            delete w;
-            n = f->waters.begin();
-        }
-        else
+        if (h != handle && f->waters[h])
         {
-            n = ++v;
+            delete f->waters[h];
+            f->waters[h] = NULL;
         }
     }
     return xl_false;
 }
 
 
-Name_p WaterFactory::water_remove(text name)
+Name_p WaterFactory::water_remove(int handle)
 // ----------------------------------------------------------------------------
 //   Purge the given water from memory
 // ----------------------------------------------------------------------------
 {
     WaterFactory * f = WaterFactory::instance();
-    water_map::iterator found = f->waters.find(name);
-    if (found != f->waters.end())
+    if (handle > 0 && handle < (int) f->waters.size() && f->waters[handle])
     {
-        Water *w = (*found).second;
-        f->waters.erase(found);
-        delete w;
+        delete f->waters[handle];
+        f->waters[handle] = NULL;
         return XL::xl_true;
     }
     return XL::xl_false;
 }
 
 
-Name_p WaterFactory::water_extenuation(text name, Real_p ratio)
+Name_p WaterFactory::water_extenuation(int handle, Real_p ratio)
 // ----------------------------------------------------------------------------
 //   Set extenuation of the water surface
 // ----------------------------------------------------------------------------
 {
-    Water* water = instance()->water(name);
+    Water* water = instance()->water(handle);
     if(water)
     {
         water->extenuation(ratio);
@@ -209,36 +361,716 @@ Name_p WaterFactory::water_extenuation(text name, Real_p ratio)
 }
 
 
-Name_p WaterFactory::add_drop(text name, Real_p x, Real_p y, Real_p radius, Real_p strength)
+Name_p WaterFactory::water_steps(int handle, Integer_p steps)
 // ----------------------------------------------------------------------------
-//   Add a drop to a current water
+//   Set the number of solver steps run for each tick of the water clock
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    if(water && steps >= 0)
+    {
+        water->substeps = steps;
+        return xl_true;
+    }
+    return xl_false;
+}
+
+
+Name_p WaterFactory::water_timestep(int handle, Real_p seconds)
+// ----------------------------------------------------------------------------
+//   Set the duration of a tick of the water clock, 0 to tick on each show
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    if(water && seconds >= 0.0)
+    {
+        water->timestep = seconds;
+        return xl_true;
+    }
+    return xl_false;
+}
+
+
+Name_p WaterFactory::water_backend(int handle, text backend)
+// ----------------------------------------------------------------------------
+//   Select the solver of the water surface, "gpu" or "cpu"
 // ----------------------------------------------------------------------------
 {
-    Water* water = instance()->water(name);
+    Water* water = instance()->water(handle);
     if(water)
     {
-        water->drop(x, y, radius, strength);
+        if (backend == "cpu")
+            water->useCPU(true);
+        else if (backend == "gpu")
+            water->useCPU(false);
+        else
+            return xl_false;
         return xl_true;
     }
     return xl_false;
 }
 
 
-Name_p WaterFactory::add_random_drops(text name, Integer_p number)
+Name_p WaterFactory::water_format(int handle, text format)
 // ----------------------------------------------------------------------------
-//   Add some random drops to a water
+//   Select the texture format of the water, "rgba16f", "rg16f" or "rg32f"
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    if(water && water->useFormat(format))
+        return xl_true;
+    return xl_false;
+}
+
+
+Name_p WaterFactory::water_solver(int handle, text solver)
+// ----------------------------------------------------------------------------
+//   Select the equations solved by the water, "wave" or "swe"
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    if(water && water->useSolver(solver))
+        return xl_true;
+    return xl_false;
+}
+
+
+Name_p WaterFactory::water_depth(int handle, Real_p depth)
+// ----------------------------------------------------------------------------
+//   Set the rest depth of shallow water, in units of drop strength
+// ----------------------------------------------------------------------------
+//   A drop of strength 1 raises water by 0.001. Waves of the shallow water
+//   solver move by sqrt(gravity * depth) texels per step, which must stay
+//   under half a texel: depth is at most 25.
+{
+    Water* water = instance()->water(handle);
+    if(water && depth > 0.0 && depth <= 25.0)
+    {
+        water->depth = depth / 1000.0;
+        return xl_true;
+    }
+    return xl_false;
+}
+
+
+Name_p WaterFactory::water_ocean(int handle, Real_p wind,
+                                 Real_p direction, Real_p length)
+// ----------------------------------------------------------------------------
+//   Turn the water into an open ocean for the given wind
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    if(water && water->useOcean(wind, direction, length))
+        return xl_true;
+    return xl_false;
+}
+
+
+Name_p WaterFactory::water_boundary(int handle, text boundary)
+// ----------------------------------------------------------------------------
+//   Select the boundary of the water, "wall" or "periodic"
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    if(water && water->useBoundary(boundary))
+        return xl_true;
+    return xl_false;
+}
+
+
+Name_p WaterFactory::water_repeat(int handle, Real_p count)
+// ----------------------------------------------------------------------------
+//   Set how many times a periodic water is repeated along each side
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    if(water && count > 0.0)
+    {
+        water->repeat = count;
+        return xl_true;
+    }
+    return xl_false;
+}
+
+
+Name_p WaterFactory::water_mask(int handle, text file)
+// ----------------------------------------------------------------------------
+//   Use an image as the mask of dry texels, "" to remove the mask
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    if(water && water->useMask(file))
+        return xl_true;
+    return xl_false;
+}
+
+
+Name_p WaterFactory::water_mask_vertex(int handle, Real_p x, Real_p y)
+// ----------------------------------------------------------------------------
+//   Add a vertex to the dry polygon being built
 // ----------------------------------------------------------------------------
 {
-    Water* water = instance()->water(name);
+    Water* water = instance()->water(handle);
     if(water)
     {
-        water->randomDrops(number);
+        water->maskVertex(x, y);
+        return xl_true;
+    }
+    return xl_false;
+}
+
+
+Name_p WaterFactory::water_mask_polygon(int handle)
+// ----------------------------------------------------------------------------
+//   Add the polygon of the recorded vertices to the mask
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    if(water)
+    {
+        water->maskPolygon();
         return xl_true;
     }
     return xl_false;
 }
 
 
+Name_p WaterFactory::water_precision(int handle, text precision)
+// ----------------------------------------------------------------------------
+//   Select the storage of the CPU wave solver, "float" or "int16"
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    if(water && water->usePrecision(precision))
+        return xl_true;
+    return xl_false;
+}
+
+
+Name_p WaterFactory::water_save(int handle, text file)
+// ----------------------------------------------------------------------------
+//   Save the state of a water in a snapshot file
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    if (water && water->save(file))
+        return xl_true;
+    return xl_false;
+}
+
+
+Name_p WaterFactory::water_load(int handle, text file)
+// ----------------------------------------------------------------------------
+//   Restore the state of a water from a snapshot file
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    if (water && water->load(file))
+        return xl_true;
+    return xl_false;
+}
+
+
+Name_p WaterFactory::water_record(int handle, text file)
+// ----------------------------------------------------------------------------
+//   Log the drops and updates of a water, stop with an empty file name
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    if (water && water->record(file))
+        return xl_true;
+    return xl_false;
+}
+
+
+Name_p WaterFactory::water_replay(int handle, text file)
+// ----------------------------------------------------------------------------
+//   Replay a log of drops and updates, stop with an empty file name
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    if (water && water->replay(file))
+        return xl_true;
+    return xl_false;
+}
+
+
+Name_p WaterFactory::water_seed(int handle, Integer_p seed)
+// ----------------------------------------------------------------------------
+//   Seed the generator of random drops of a water
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    if (!water)
+        return xl_false;
+    water->seed((quint64) (longlong) seed);
+    return xl_true;
+}
+
+
+Name_p WaterFactory::water_normals(int handle, bool enable)
+// ----------------------------------------------------------------------------
+//   Select if normals are precomputed in the water texture
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    if (!water)
+        return xl_false;
+    water->normals = enable;
+    return xl_true;
+}
+
+
+Integer_p WaterFactory::water_normals(int handle)
+// ----------------------------------------------------------------------------
+//   Return 1 if the water texture holds gradients for normals, 0 otherwise
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    return new Integer(water && water->gradients() ? 1 : 0);
+}
+
+
+Name_p WaterFactory::water_threads(Integer_p threads)
+// ----------------------------------------------------------------------------
+//   Set the number of threads used by CPU solvers, 0 for one per core
+// ----------------------------------------------------------------------------
+{
+    if (threads < 0)
+        return xl_false;
+    WaterPool::setThreads(threads);
+    return xl_true;
+}
+
+
+Name_p WaterFactory::water_atlas(Integer_p size)
+// ----------------------------------------------------------------------------
+//   Pack small waters in shared textures of size x size texels, 0 to stop
+// ----------------------------------------------------------------------------
+{
+    WaterFactory *f = instance();
+    if (size < 0)
+        return xl_false;
+    if (f->atlas && f->atlas->size() == size)
+        return xl_true;
+
+    // Waters of the old atlas keep their waves in their own textures
+    if (f->atlas)
+    {
+        tao->makeGLContextCurrent();
+        delete f->atlas;
+        f->atlas = NULL;
+    }
+    if (size > 0)
+        f->atlas = new WaterAtlas(size);
+    return xl_true;
+}
+
+
+Name_p WaterFactory::water_bench(text file)
+// ----------------------------------------------------------------------------
+//   Run all benchmarks and write the results as JSON in the given file
+// ----------------------------------------------------------------------------
+{
+    std::ofstream out(file.c_str());
+    if (!out.good())
+        return xl_false;
+
+    WaterBench bench;
+    bench.cpu();
+    bench.gl();
+    bench.json(out);
+    return xl_true;
+}
+
+
+Name_p WaterFactory::add_drop(int handle, Real_p x, Real_p y, Real_p radius, Real_p strength)
+// ----------------------------------------------------------------------------
+//   Add a drop to a current water
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    if(water)
+    {
+        water->drop(x, y, radius, strength);
+        return xl_true;
+    }
+    return xl_false;
+}
+
+
+Name_p WaterFactory::add_random_drops(int handle, Integer_p number)
+// ----------------------------------------------------------------------------
+//   Add some random drops to a water
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    if(water)
+    {
+        water->randomDrops(number);
+        return xl_true;
+    }
+    return xl_false;
+}
+
+
+Name_p WaterFactory::queue_drop(int handle, Real_p x, Real_p y,
+                                Real_p radius, Real_p strength)
+// ----------------------------------------------------------------------------
+//   Queue a drop that will be added with the next batch of drops
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    if(water)
+    {
+        water->queueDrop(x, y, radius, strength);
+        return xl_true;
+    }
+    return xl_false;
+}
+
+
+Name_p WaterFactory::add_drops(int handle)
+// ----------------------------------------------------------------------------
+//   Add all queued drops to a water in a single batch
+// ----------------------------------------------------------------------------
+{
+    Water* water = instance()->water(handle);
+    if(water)
+    {
+        water->flushDrops();
+        return xl_true;
+    }
+    return xl_false;
+}
+
+
+
+// ============================================================================
+//
+//   Named waters
+//
+// ============================================================================
+
+Real_p WaterFactory::water_strength(text name)
+// ----------------------------------------------------------------------------
+//   Strength of water
+// ----------------------------------------------------------------------------
+{
+    return water_strength(instance()->handle(name));
+}
+
+
+Text_p WaterFactory::water_stats(text name)
+// ----------------------------------------------------------------------------
+//   Timing statistics of a water
+// ----------------------------------------------------------------------------
+{
+    return water_stats(instance()->handle(name));
+}
+
+
+Integer_p WaterFactory::water_grid_width(text name)
+// ----------------------------------------------------------------------------
+//   Horizontal resolution of the simulation grid
+// ----------------------------------------------------------------------------
+{
+    return water_grid_width(instance()->handle(name));
+}
+
+
+Integer_p WaterFactory::water_grid_height(text name)
+// ----------------------------------------------------------------------------
+//   Vertical resolution of the simulation grid
+// ----------------------------------------------------------------------------
+{
+    return water_grid_height(instance()->handle(name));
+}
+
+
+Real_p WaterFactory::water_height_at(text name, Real_p x, Real_p y)
+// ----------------------------------------------------------------------------
+//   Height of a water at a point, from the latest heights read back
+// ----------------------------------------------------------------------------
+{
+    return water_height_at(instance()->handle(name), x, y);
+}
+
+
+Name_p WaterFactory::water_resolution(text name, Integer_p w, Integer_p h)
+// ----------------------------------------------------------------------------
+//   Set the resolution of the simulation grid
+// ----------------------------------------------------------------------------
+{
+    return water_resolution(instance()->handle(name), w, h);
+}
+
+
+Name_p WaterFactory::water_show(text name)
+// ----------------------------------------------------------------------------
+//   Show water
+// ----------------------------------------------------------------------------
+{
+    return water_show(instance()->handle(name));
+}
+
+
+Name_p WaterFactory::water_mesh(text name, Real_p w, Real_p h)
+// ----------------------------------------------------------------------------
+//   Draw a surface for a water, with more vertices near the camera
+// ----------------------------------------------------------------------------
+{
+    return water_mesh(instance()->handle(name), w, h);
+}
+
+
+Name_p WaterFactory::water_only(text name)
+// ----------------------------------------------------------------------------
+//   Purge all other waters from memory
+// ----------------------------------------------------------------------------
+{
+    return water_only(instance()->handle(name));
+}
+
+
+Name_p WaterFactory::water_remove(text name)
+// ----------------------------------------------------------------------------
+//   Purge the given water from memory
+// ----------------------------------------------------------------------------
+{
+    return water_remove(instance()->handle(name));
+}
+
+
+Name_p WaterFactory::water_extenuation(text name, Real_p ratio)
+// ----------------------------------------------------------------------------
+//   Set extenuation of the water surface
+// ----------------------------------------------------------------------------
+{
+    return water_extenuation(instance()->handle(name), ratio);
+}
+
+
+Name_p WaterFactory::water_steps(text name, Integer_p steps)
+// ----------------------------------------------------------------------------
+//   Set the number of solver steps run for each tick of the water clock
+// ----------------------------------------------------------------------------
+{
+    return water_steps(instance()->handle(name), steps);
+}
+
+
+Name_p WaterFactory::water_timestep(text name, Real_p seconds)
+// ----------------------------------------------------------------------------
+//   Set the duration of a tick of the water clock, 0 to tick on each show
+// ----------------------------------------------------------------------------
+{
+    return water_timestep(instance()->handle(name), seconds);
+}
+
+
+Name_p WaterFactory::water_backend(text name, text backend)
+// ----------------------------------------------------------------------------
+//   Select the solver of the water surface
+// ----------------------------------------------------------------------------
+{
+    return water_backend(instance()->handle(name), backend);
+}
+
+
+Name_p WaterFactory::water_format(text name, text format)
+// ----------------------------------------------------------------------------
+//   Select the texture format of the water
+// ----------------------------------------------------------------------------
+{
+    return water_format(instance()->handle(name), format);
+}
+
+
+Name_p WaterFactory::water_solver(text name, text solver)
+// ----------------------------------------------------------------------------
+//   Select the equations solved by the water
+// ----------------------------------------------------------------------------
+{
+    return water_solver(instance()->handle(name), solver);
+}
+
+
+Name_p WaterFactory::water_depth(text name, Real_p depth)
+// ----------------------------------------------------------------------------
+//   Set the rest depth of shallow water
+// ----------------------------------------------------------------------------
+{
+    return water_depth(instance()->handle(name), depth);
+}
+
+
+Name_p WaterFactory::water_ocean(text name, Real_p wind,
+                                 Real_p direction, Real_p length)
+// ----------------------------------------------------------------------------
+//   Turn the water into an open ocean for the given wind
+// ----------------------------------------------------------------------------
+{
+    return water_ocean(instance()->handle(name), wind, direction, length);
+}
+
+
+Name_p WaterFactory::water_boundary(text name, text boundary)
+// ----------------------------------------------------------------------------
+//   Select the boundary of the water
+// ----------------------------------------------------------------------------
+{
+    return water_boundary(instance()->handle(name), boundary);
+}
+
+
+Name_p WaterFactory::water_repeat(text name, Real_p count)
+// ----------------------------------------------------------------------------
+//   Set how many times a periodic water is repeated along each side
+// ----------------------------------------------------------------------------
+{
+    return water_repeat(instance()->handle(name), count);
+}
+
+
+Name_p WaterFactory::water_mask(text name, text file)
+// ----------------------------------------------------------------------------
+//   Use an image as the mask of dry texels
+// ----------------------------------------------------------------------------
+{
+    return water_mask(instance()->handle(name), file);
+}
+
+
+Name_p WaterFactory::water_mask_vertex(text name, Real_p x, Real_p y)
+// ----------------------------------------------------------------------------
+//   Add a vertex to the dry polygon being built
+// ----------------------------------------------------------------------------
+{
+    return water_mask_vertex(instance()->handle(name), x, y);
+}
+
+
+Name_p WaterFactory::water_mask_polygon(text name)
+// ----------------------------------------------------------------------------
+//   Add the polygon of the recorded vertices to the mask
+// ----------------------------------------------------------------------------
+{
+    return water_mask_polygon(instance()->handle(name));
+}
+
+
+Name_p WaterFactory::water_precision(text name, text precision)
+// ----------------------------------------------------------------------------
+//   Select the storage of the CPU wave solver
+// ----------------------------------------------------------------------------
+{
+    return water_precision(instance()->handle(name), precision);
+}
+
+
+Name_p WaterFactory::water_save(text name, text file)
+// ----------------------------------------------------------------------------
+//   Save the state of a water in a snapshot file
+// ----------------------------------------------------------------------------
+{
+    return water_save(instance()->handle(name), file);
+}
+
+
+Name_p WaterFactory::water_load(text name, text file)
+// ----------------------------------------------------------------------------
+//   Restore the state of a water from a snapshot file
+// ----------------------------------------------------------------------------
+{
+    return water_load(instance()->handle(name), file);
+}
+
+
+Name_p WaterFactory::water_record(text name, text file)
+// ----------------------------------------------------------------------------
+//   Log the drops and updates of a water, stop with an empty file name
+// ----------------------------------------------------------------------------
+{
+    return water_record(instance()->handle(name), file);
+}
+
+
+Name_p WaterFactory::water_replay(text name, text file)
+// ----------------------------------------------------------------------------
+//   Replay a log of drops and updates, stop with an empty file name
+// ----------------------------------------------------------------------------
+{
+    return water_replay(instance()->handle(name), file);
+}
+
+
+Name_p WaterFactory::water_seed(text name, Integer_p seed)
+// ----------------------------------------------------------------------------
+//   Seed the generator of random drops of a water
+// ----------------------------------------------------------------------------
+{
+    return water_seed(instance()->handle(name), seed);
+}
+
+
+Name_p WaterFactory::water_normals(text name, bool enable)
+// ----------------------------------------------------------------------------
+//   Select if normals are precomputed in the water texture
+// ----------------------------------------------------------------------------
+{
+    return water_normals(instance()->handle(name), enable);
+}
+
+
+Integer_p WaterFactory::water_normals(text name)
+// ----------------------------------------------------------------------------
+//   Return 1 if the water texture holds gradients for normals, 0 otherwise
+// ----------------------------------------------------------------------------
+{
+    return water_normals(instance()->handle(name));
+}
+
+
+Name_p WaterFactory::add_drop(text name, Real_p x, Real_p y,
+                              Real_p radius, Real_p strength)
+// ----------------------------------------------------------------------------
+//   Add a drop to a water
+// ----------------------------------------------------------------------------
+{
+    return add_drop(instance()->handle(name), x, y, radius, strength);
+}
+
+
+Name_p WaterFactory::add_random_drops(text name, Integer_p number)
+// ----------------------------------------------------------------------------
+//   Add some random drops to a water
+// ----------------------------------------------------------------------------
+{
+    return add_random_drops(instance()->handle(name), number);
+}
+
+
+Name_p WaterFactory::queue_drop(text name, Real_p x, Real_p y,
+                                Real_p radius, Real_p strength)
+// ----------------------------------------------------------------------------
+//   Queue a drop that will be added with the next batch of drops
+// ----------------------------------------------------------------------------
+{
+    return queue_drop(instance()->handle(name), x, y, radius, strength);
+}
+
+
+Name_p WaterFactory::add_drops(text name)
+// ----------------------------------------------------------------------------
+//   Add all queued drops to a water in a single batch
+// ----------------------------------------------------------------------------
+{
+    return add_drops(instance()->handle(name));
+}
+
+
+
 XL_DEFINE_TRACES
 
 int module_init(const Tao::ModuleApi *api, const Tao::ModuleInfo *)
@@ -248,6 +1080,9 @@ int module_init(const Tao::ModuleApi *api, const Tao::ModuleInfo *)
 {
     XL_INIT_TRACES();
     WaterFactory::instance()->tao = api;
+    WaterTimer::gpuTimers = api->isGLExtensionAvailable("GL_ARB_timer_query");
+    WaterReadback::fences = api->isGLExtensionAvailable("GL_ARB_sync");
+    Water::rgFormats = api->isGLExtensionAvailable("GL_ARB_texture_rg");
 
     // Check if we support floating textures to use correctly this module.
     // If not, do not create the water surface to avoid GL errors. Refs #2690.
@@ -267,5 +1102,7 @@ int module_exit()
 {
     WaterFactory::water_only("");
     WaterFactory::destroy();
+    WaterPool::destroy();
+    WaterResources::purge();
     return 0;
 }
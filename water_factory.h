@@ -43,6 +43,7 @@
 #include "base.h"
 #include "tao/module_api.h"
 #include "water.h"
+#include "water_atlas.h"
 
 using namespace XL;
 
@@ -51,9 +52,11 @@ class WaterFactory
 {
 public:
     WaterFactory();
-    virtual ~WaterFactory() {}
+    virtual ~WaterFactory();
 
-    Water*  water(text name);
+    int     handle(text name);
+    Water*  water(int handle);
+    Water*  water(text name)    { return water(handle(name)); }
 
 public:
     static WaterFactory* instance();
@@ -63,24 +66,106 @@ public:
     static void          render_callback(void *arg);
     static void          identify_callback(void *arg);
     static void          delete_callback(void *arg);
+    static void          mesh_callback(void *arg);
+    static void          mesh_delete_callback(void *arg);
 
-    // XL interface
-    static Real_p        water_strength(text);
+    // XL interface, waters are identified by handle
+    static Integer_p     water_handle(text name);
+    static Real_p        water_strength(int handle);
+    static Text_p        water_stats(int handle);
+    static Integer_p     water_grid_width(int handle);
+    static Integer_p     water_grid_height(int handle);
+    static Real_p        water_height_at(int handle, Real_p x, Real_p y);
+    static Name_p        water_resolution(int handle, Integer_p w, Integer_p h);
+    static Name_p        water_show(int handle);
+    static Name_p        water_mesh(int handle, Real_p w, Real_p h);
+    static Name_p        water_only(int handle);
+    static Name_p        water_remove(int handle);
+    static Name_p        water_extenuation(int handle, Real_p ratio);
+    static Name_p        water_steps(int handle, Integer_p steps);
+    static Name_p        water_timestep(int handle, Real_p seconds);
+    static Name_p        water_backend(int handle, text backend);
+    static Name_p        water_format(int handle, text format);
+    static Name_p        water_solver(int handle, text solver);
+    static Name_p        water_depth(int handle, Real_p depth);
+    static Name_p        water_ocean(int handle, Real_p wind,
+                                     Real_p direction, Real_p length);
+    static Name_p        water_boundary(int handle, text boundary);
+    static Name_p        water_repeat(int handle, Real_p count);
+    static Name_p        water_mask(int handle, text file);
+    static Name_p        water_mask_vertex(int handle, Real_p x, Real_p y);
+    static Name_p        water_mask_polygon(int handle);
+    static Name_p        water_precision(int handle, text precision);
+    static Name_p        water_save(int handle, text file);
+    static Name_p        water_load(int handle, text file);
+    static Name_p        water_record(int handle, text file);
+    static Name_p        water_replay(int handle, text file);
+    static Name_p        water_seed(int handle, Integer_p seed);
+    static Name_p        water_normals(int handle, bool enable);
+    static Integer_p     water_normals(int handle);
+    static Name_p        water_threads(Integer_p threads);
+    static Name_p        water_atlas(Integer_p size);
+    static Name_p        water_bench(text file);
+    static Name_p        add_drop(int handle, Real_p x, Real_p y,
+                                  Real_p radius, Real_p strength);
+    static Name_p        add_random_drops(int handle, Integer_p number);
+    static Name_p        queue_drop(int handle, Real_p x, Real_p y,
+                                    Real_p radius, Real_p strength);
+    static Name_p        add_drops(int handle);
+
+    // XL interface, waters are identified by name
+    static Real_p        water_strength(text name);
+    static Text_p        water_stats(text name);
+    static Integer_p     water_grid_width(text name);
+    static Integer_p     water_grid_height(text name);
+    static Real_p        water_height_at(text name, Real_p x, Real_p y);
+    static Name_p        water_resolution(text name, Integer_p w, Integer_p h);
     static Name_p        water_show(text name);
+    static Name_p        water_mesh(text name, Real_p w, Real_p h);
     static Name_p        water_only(text name);
     static Name_p        water_remove(text name);
     static Name_p        water_extenuation(text name, Real_p ratio);
+    static Name_p        water_steps(text name, Integer_p steps);
+    static Name_p        water_timestep(text name, Real_p seconds);
+    static Name_p        water_backend(text name, text backend);
+    static Name_p        water_format(text name, text format);
+    static Name_p        water_solver(text name, text solver);
+    static Name_p        water_depth(text name, Real_p depth);
+    static Name_p        water_ocean(text name, Real_p wind,
+                                     Real_p direction, Real_p length);
+    static Name_p        water_boundary(text name, text boundary);
+    static Name_p        water_repeat(text name, Real_p count);
+    static Name_p        water_mask(text name, text file);
+    static Name_p        water_mask_vertex(text name, Real_p x, Real_p y);
+    static Name_p        water_mask_polygon(text name);
+    static Name_p        water_precision(text name, text precision);
+    static Name_p        water_save(text name, text file);
+    static Name_p        water_load(text name, text file);
+    static Name_p        water_record(text name, text file);
+    static Name_p        water_replay(text name, text file);
+    static Name_p        water_seed(text name, Integer_p seed);
+    static Name_p        water_normals(text name, bool enable);
+    static Integer_p     water_normals(text name);
     static Name_p        add_drop(text name, Real_p x, Real_p y,
                                   Real_p radius, Real_p strength);
     static Name_p        add_random_drops(text name, Integer_p number);
+    static Name_p        queue_drop(text name, Real_p x, Real_p y,
+                                    Real_p radius, Real_p strength);
+    static Name_p        add_drops(text name);
 
 public:
     // Pointer to Tao functions
     static const Tao::ModuleApi *tao;
 
 protected:
-    typedef std::map<text, Water *>  water_map;
-    water_map    waters;
+    // Names are interned once, handles index a flat list of waters
+    typedef std::map<text, int>      handle_map;
+    typedef std::vector<Water *>     water_list;
+    handle_map   handles;
+    water_list   waters;            // Indexed by handle, NULL if removed
+
+    // Shared textures of small waters, NULL unless enabled by water_atlas
+    WaterAtlas * atlas;
 
 protected:
     static WaterFactory * factory;
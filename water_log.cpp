@@ -0,0 +1,184 @@
+// *****************************************************************************
+// water_log.cpp                                                   Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//   Recording and replay of water events.
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2015,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+#include "water_log.h"
+#include "basics.h" // XLR
+#include <cstring>
+
+
+static const char    WATER_LOG_MAGIC[8] = { 'T','A','O','W','L','O','G','1' };
+
+
+
+// ============================================================================
+//
+//   WaterLog
+//
+// ============================================================================
+
+WaterLog::WaterLog()
+// ----------------------------------------------------------------------------
+//   Create an idle log
+// ----------------------------------------------------------------------------
+    : mode(IDLE), data(NULL), size(0), offset(0)
+{}
+
+
+WaterLog::~WaterLog()
+// ----------------------------------------------------------------------------
+//   Close the file of the log
+// ----------------------------------------------------------------------------
+{
+    stop();
+}
+
+
+bool WaterLog::record(std::string name)
+// ----------------------------------------------------------------------------
+//   Start writing events in the given file
+// ----------------------------------------------------------------------------
+{
+    stop();
+    file.setFileName(QString::fromStdString(name));
+    if (!file.open(QIODevice::WriteOnly) ||
+        file.write(WATER_LOG_MAGIC, sizeof(WATER_LOG_MAGIC)) !=
+        sizeof(WATER_LOG_MAGIC))
+    {
+        stop();
+        return false;
+    }
+    mode = RECORD;
+    return true;
+}
+
+
+bool WaterLog::replay(std::string name)
+// ----------------------------------------------------------------------------
+//   Map a log file to read its events
+// ----------------------------------------------------------------------------
+{
+    stop();
+    file.setFileName(QString::fromStdString(name));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    size = file.size();
+    if (size >= (qint64) sizeof(WATER_LOG_MAGIC))
+        data = file.map(0, size);
+    if (!data || memcmp(data, WATER_LOG_MAGIC, sizeof(WATER_LOG_MAGIC)) != 0)
+    {
+        stop();
+        return false;
+    }
+    offset = sizeof(WATER_LOG_MAGIC);
+    mode = REPLAY;
+    return true;
+}
+
+
+void WaterLog::stop()
+// ----------------------------------------------------------------------------
+//   Stop recording or replaying
+// ----------------------------------------------------------------------------
+{
+    if (data)
+        file.unmap((uchar *) data);
+    if (file.isOpen())
+        file.close();
+    mode = IDLE;
+    data = NULL;
+    size = offset = 0;
+}
+
+
+void WaterLog::drops(quint64 step, const float *drops, uint count)
+// ----------------------------------------------------------------------------
+//   Record a batch of drops
+// ----------------------------------------------------------------------------
+{
+    WaterEvent event = { WaterEvent::DROPS, count, step };
+    file.write((const char *) &event, sizeof(event));
+    file.write((const char *) drops, 4 * count * sizeof(float));
+}
+
+
+void WaterLog::update(quint64 step, int steps)
+// ----------------------------------------------------------------------------
+//   Record an update, including those with no step that mark a frame
+// ----------------------------------------------------------------------------
+{
+    WaterEvent event = { WaterEvent::UPDATE, (quint32) steps, step };
+    file.write((const char *) &event, sizeof(event));
+}
+
+
+bool WaterLog::next(WaterEvent &event, const float *&drops)
+// ----------------------------------------------------------------------------
+//   Read the next event, return false and stop at the end of the log
+// ----------------------------------------------------------------------------
+{
+    drops = NULL;
+    if (mode != REPLAY || offset + (qint64) sizeof(event) > size)
+    {
+        stop();
+        return false;
+    }
+
+    memcpy(&event, data + offset, sizeof(event));
+    offset += sizeof(event);
+    if (event.kind == WaterEvent::DROPS)
+    {
+        qint64 bytes = 4 * (qint64) event.count * sizeof(float);
+        if (offset + bytes > size)
+        {
+            IFTRACE(water_surface)
+                    debug() << "Truncated log" << "\n";
+            stop();
+            return false;
+        }
+        drops = (const float *) (data + offset);
+        offset += bytes;
+    }
+    return true;
+}
+
+
+std::ostream & WaterLog::debug()
+// ----------------------------------------------------------------------------
+//   Convenience method to log with a common prefix
+// ----------------------------------------------------------------------------
+{
+    std::cerr << "[WaterLog] " << (void*)this << " ";
+    return std::cerr;
+}
@@ -0,0 +1,93 @@
+#ifndef WATER_LOG_H
+#define WATER_LOG_H
+// *****************************************************************************
+// water_log.h                                                     Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//      Recording and replay of water events.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2014,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include <QFile>
+#include <iostream>
+#include <string>
+
+
+struct WaterEvent
+// ----------------------------------------------------------------------------
+//   One call recorded in a water log
+// ----------------------------------------------------------------------------
+//   A DROPS event is followed by 'count' drops of four floats each, laid
+//   out like the drops given to the drop shader.
+{
+    enum Kind { DROPS = 1, UPDATE = 2 };
+    quint32     kind;
+    quint32     count;          // Number of drops, or of solver steps
+    quint64     step;           // Solver steps run before the call
+};
+
+
+class WaterLog
+// ----------------------------------------------------------------------------
+//   Binary log of the drops and updates of a water
+// ----------------------------------------------------------------------------
+//   Events are appended as they happen while recording. A log is replayed
+//   from a memory mapping of the file, one event at a time.
+{
+public:
+    WaterLog();
+    ~WaterLog();
+
+    bool                record(std::string file);
+    bool                replay(std::string file);
+    void                stop();
+    bool                recording()     { return mode == RECORD; }
+    bool                replaying()     { return mode == REPLAY; }
+
+    // Recording
+    void                drops(quint64 step, const float *drops, uint count);
+    void                update(quint64 step, int steps);
+
+    // Replay, 'drops' points into the mapped file until the next call
+    bool                next(WaterEvent &event, const float *&drops);
+
+private:
+    std::ostream &      debug();
+
+private:
+    enum Mode { IDLE, RECORD, REPLAY };
+
+    Mode                mode;
+    QFile               file;
+    const uchar *       data;           // Mapped file when replaying
+    qint64              size, offset;
+};
+
+#endif
@@ -0,0 +1,153 @@
+// *****************************************************************************
+// water_mask.cpp                                                  Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//   Dry texels of a water, from an image or from polygons.
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2015,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+#include "water_mask.h"
+#include <algorithm>
+#include <cmath>
+
+
+
+// ============================================================================
+//
+//   WaterMask
+//
+// ============================================================================
+
+WaterMask::WaterMask()
+// ----------------------------------------------------------------------------
+//   Create an empty mask, where all texels are wet
+// ----------------------------------------------------------------------------
+    : width(0), height(0)
+{}
+
+
+bool WaterMask::load(std::string file)
+// ----------------------------------------------------------------------------
+//   Use an image as the mask, dark texels are dry
+// ----------------------------------------------------------------------------
+{
+    QImage loaded(QString::fromStdString(file));
+    if (loaded.isNull())
+        return false;
+    image = loaded;
+    return true;
+}
+
+
+void WaterMask::polygon(const std::vector<float> &xy)
+// ----------------------------------------------------------------------------
+//   Add a polygon of dry texels, from x, y pairs
+// ----------------------------------------------------------------------------
+{
+    if (xy.size() >= 6)
+        polygons.push_back(xy);
+}
+
+
+void WaterMask::clear()
+// ----------------------------------------------------------------------------
+//   Remove all sources, all texels are wet again
+// ----------------------------------------------------------------------------
+{
+    image = QImage();
+    polygons.clear();
+    dry.clear();
+}
+
+
+bool WaterMask::empty() const
+// ----------------------------------------------------------------------------
+//   Check if the mask has no source
+// ----------------------------------------------------------------------------
+{
+    return image.isNull() && polygons.empty();
+}
+
+
+void WaterMask::rasterize(int w, int h)
+// ----------------------------------------------------------------------------
+//   Compute the dry texels of a w x h grid
+// ----------------------------------------------------------------------------
+//   The image is scaled to the grid, its top row being the top of the
+//   water, that is the last row of the textures. Polygons are filled at
+//   texel centers, with the crossings of each row with their edges.
+{
+    width = w;
+    height = h;
+    dry.clear();
+    if (empty())
+        return;
+    dry.assign(w * h, 0);
+
+    if (!image.isNull())
+    {
+        QImage scaled = image.scaled(w, h, Qt::IgnoreAspectRatio,
+                                     Qt::SmoothTransformation);
+        for (int y = 0; y < h; y++)
+            for (int x = 0; x < w; x++)
+                if (qGray(scaled.pixel(x, h - 1 - y)) < 128)
+                    dry[y * w + x] = 1;
+    }
+
+    std::vector<double> crossings;
+    for (uint p = 0; p < polygons.size(); p++)
+    {
+        const std::vector<float> &xy = polygons[p];
+        uint n = xy.size() / 2;
+        for (int y = 0; y < h; y++)
+        {
+            double yc = (y + 0.5) / h * 2.0 - 1.0;
+            crossings.clear();
+            for (uint i = 0, j = n - 1; i < n; j = i++)
+            {
+                double x0 = xy[2*j], y0 = xy[2*j+1];
+                double x1 = xy[2*i], y1 = xy[2*i+1];
+                if ((y0 <= yc) != (y1 <= yc))
+                    crossings.push_back(x0 + (yc - y0) / (y1 - y0) * (x1 - x0));
+            }
+            std::sort(crossings.begin(), crossings.end());
+
+            // Texels whose center is between two crossings are inside
+            for (uint c = 0; c + 1 < crossings.size(); c += 2)
+            {
+                int first = (int) ceil((crossings[c] + 1.0) * 0.5 * w - 0.5);
+                int last = (int) ceil((crossings[c+1] + 1.0) * 0.5 * w - 0.5);
+                first = std::max(first, 0);
+                last = std::min(last, w);
+                for (int x = first; x < last; x++)
+                    dry[y * w + x] = 1;
+            }
+        }
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef WATER_MASK_H
+#define WATER_MASK_H
+// *****************************************************************************
+// water_mask.h                                                    Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//      Dry texels of a water, from an image or from polygons.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2014,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include <QImage>
+#include <string>
+#include <vector>
+
+
+struct WaterMask
+// ----------------------------------------------------------------------------
+//   Shape of islands, piers and shores where a water has no water
+// ----------------------------------------------------------------------------
+//   Sources are kept, so that the mask is rasterized again for each grid
+//   size. Dark texels of the image and texels inside polygons are dry.
+//   Polygons are in the coordinates of add_drop, filled with the even-odd
+//   rule. 'dry' has one byte per texel, row by row, 1 where dry.
+{
+    WaterMask();
+
+    bool                load(std::string file);
+    void                polygon(const std::vector<float> &xy);
+    void                clear();
+    bool                empty() const;
+
+    // Compute 'dry' for a w x h grid
+    void                rasterize(int w, int h);
+
+public:
+    std::vector<uchar>  dry;
+    int                 width, height;
+
+private:
+    QImage              image;
+    std::vector< std::vector<float> > polygons;
+};
+
+#endif // WATER_MASK_H
@@ -0,0 +1,329 @@
+// *****************************************************************************
+// water_mesh.cpp                                                  Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//   Level of detail mesh of water surfaces.
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2015,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+#include "water_mesh.h"
+#include "tao/graphic_state.h"
+#include "basics.h" // XLR
+#include <algorithm>
+#include <cmath>
+
+
+WaterMesh::WaterMesh()
+// ----------------------------------------------------------------------------
+//   Create an empty mesh, GL buffers are created on first draw
+// ----------------------------------------------------------------------------
+    : context(NULL), uploaded(false),
+      columns(0), rows(0), first(0), levels(0)
+{
+    buffers[0] = buffers[1] = 0;
+    std::fill(centers, centers + 2 * MAX_LEVELS, 0);
+}
+
+
+WaterMesh::~WaterMesh()
+// ----------------------------------------------------------------------------
+//   Delete GL buffers if their context is still current
+// ----------------------------------------------------------------------------
+{
+    if (context && context == QGLContext::currentContext())
+        glDeleteBuffers(2, buffers);
+}
+
+
+void WaterMesh::draw(int c, int r, double w, double h)
+// ----------------------------------------------------------------------------
+//   Draw the rings around the camera, rebuilding them if it moved
+// ----------------------------------------------------------------------------
+//   Like a plane, the mesh spans w x h around the origin, but vertices
+//   range from -1 to 1, as vertex shaders expect to sample the water.
+{
+    GL.PushMatrix();
+    GL.Scale(w / 2, h / 2, 1.0);
+    GL.Sync();
+
+    const QGLContext *current = QGLContext::currentContext();
+    if (context != current)
+    {
+        context = current;
+        glGenBuffers(2, buffers);
+        uploaded = false;
+    }
+
+    // Position of the camera in texels, from the inverse of the modelview
+    GLdouble m[16];
+    glGetDoublev(GL_MODELVIEW_MATRIX, m);
+    double a = m[5] * m[10] - m[9] * m[6];
+    double b = m[9] * m[2] - m[1] * m[10];
+    double d = m[1] * m[6] - m[5] * m[2];
+    double det = m[0] * a + m[4] * b + m[8] * d;
+    if (det != 0.0 && w != 0.0 && h != 0.0)
+    {
+        double ex = -(a * m[12] +
+                      (m[8] * m[6] - m[4] * m[10]) * m[13] +
+                      (m[4] * m[9] - m[8] * m[5]) * m[14]) / det;
+        double ey = -(b * m[12] +
+                      (m[0] * m[10] - m[8] * m[2]) * m[13] +
+                      (m[8] * m[1] - m[0] * m[9]) * m[14]) / det;
+        double ez = -(d * m[12] +
+                      (m[4] * m[2] - m[0] * m[6]) * m[13] +
+                      (m[0] * m[5] - m[4] * m[1]) * m[14]) / det;
+        if (place(ex * c / 2, ey * r / 2, ez * c / w, c, r))
+        {
+            build();
+            uploaded = false;
+        }
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[1]);
+    if (!uploaded)
+    {
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float),
+                     vertices.empty() ? NULL : &vertices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint),
+                     indices.empty() ? NULL : &indices[0], GL_STATIC_DRAW);
+        uploaded = true;
+    }
+
+    // Texture coordinates match those of a plane, for units 0 and 1
+    GLsizei stride = 4 * sizeof(float);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(2, GL_FLOAT, stride, (void *) 0);
+    for (uint unit = 0; unit < 2; unit++)
+    {
+        glClientActiveTexture(GL_TEXTURE0 + unit);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glTexCoordPointer(2, GL_FLOAT, stride, (void *) (2 * sizeof(float)));
+    }
+
+    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, (void *) 0);
+
+    for (uint unit = 0; unit < 2; unit++)
+    {
+        glClientActiveTexture(GL_TEXTURE0 + unit);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    }
+    glClientActiveTexture(GL_TEXTURE0);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    GL.PopMatrix();
+}
+
+
+void WaterMesh::reset()
+// ----------------------------------------------------------------------------
+//   Forget GL buffers, which belong to a context that no longer exists
+// ----------------------------------------------------------------------------
+{
+    context = NULL;
+    uploaded = false;
+}
+
+
+bool WaterMesh::place(double ex, double ey, double ez, int c, int r)
+// ----------------------------------------------------------------------------
+//   Compute the levels and centers of rings, return true if they changed
+// ----------------------------------------------------------------------------
+//   A level is only skipped when the camera is FAR times farther than the
+//   next level is wide. Seen from the camera, cells of the next level are
+//   then smaller than 1/(2*FAR*RING) radian, about the size of those of the
+//   150x150 plane formerly drawn. Levels are added until one of them covers
+//   the water.
+{
+    // Rings centered outside of the water would only be clamped
+    ex = std::max(-c / 2.0, std::min(ex, c / 2.0));
+    ey = std::max(-r / 2.0, std::min(ey, r / 2.0));
+
+    uint f = 0;
+    while (f + 1 < MAX_LEVELS && (FAR * 2 * RING << (f + 1)) <= fabs(ez))
+        f++;
+
+    int layout[2 * MAX_LEVELS];
+    uint n = 0;
+    while (f + n < MAX_LEVELS)
+    {
+        int l = f + n;
+        double unit = 2 << l;
+        int cx = unit * floor(ex / unit + 0.5);
+        int cy = unit * floor(ey / unit + 0.5);
+        layout[2 * n] = cx;
+        layout[2 * n + 1] = cy;
+        n++;
+
+        int extent = RING << l;
+        if (2 * (cx - extent) <= -c && 2 * (cx + extent) >= c &&
+            2 * (cy - extent) <= -r && 2 * (cy + extent) >= r)
+            break;
+    }
+
+    if (c == columns && r == rows && f == first && n == levels &&
+        std::equal(layout, layout + 2 * n, centers))
+        return false;
+
+    columns = c;
+    rows = r;
+    first = f;
+    levels = n;
+    std::copy(layout, layout + 2 * n, centers);
+    return true;
+}
+
+
+void WaterMesh::build()
+// ----------------------------------------------------------------------------
+//   Build the vertices and triangles of all rings
+// ----------------------------------------------------------------------------
+{
+    vertices.clear();
+    indices.clear();
+    for (uint k = 0; k < levels; k++)
+        ring(k);
+
+    IFTRACE(water_surface)
+            debug() << "Build levels " << first << "-" << first + levels - 1
+                    << ", " << vertexCount() << " vertices, "
+                    << indices.size() / 3 << " triangles" << "\n";
+}
+
+
+uint WaterMesh::vertex(double x, double y)
+// ----------------------------------------------------------------------------
+//   Add a vertex at x, y in texels from the center, clamped to the water
+// ----------------------------------------------------------------------------
+{
+    float u = std::max(-1.0, std::min(2.0 * x / columns, 1.0));
+    float v = std::max(-1.0, std::min(2.0 * y / rows, 1.0));
+    vertices.push_back(u);
+    vertices.push_back(v);
+    vertices.push_back(u * 0.5f + 0.5f);
+    vertices.push_back(v * 0.5f + 0.5f);
+    return vertices.size() / 4 - 1;
+}
+
+
+void WaterMesh::ring(uint k)
+// ----------------------------------------------------------------------------
+//   Add the cells of level first+k, except those in the hole of level k-1
+// ----------------------------------------------------------------------------
+//   Cells are indexed from -RING to RING-1 around the center of the level.
+//   The hole is offset by at most one cell, since the finer level is
+//   centered on multiples of the cell size of this level.
+{
+    int cell = 1 << (first + k);
+    int cx = centers[2 * k];
+    int cy = centers[2 * k + 1];
+
+    bool hole = k > 0;
+    int hx0 = 0, hx1 = 0, hy0 = 0, hy1 = 0;
+    if (hole)
+    {
+        hx0 = (centers[2 * k - 2] - cx) / cell - RING / 2;
+        hy0 = (centers[2 * k - 1] - cy) / cell - RING / 2;
+        hx1 = hx0 + RING;
+        hy1 = hy0 + RING;
+    }
+
+    // Vertices of the grid are created the first time a cell uses them
+    const int size = 2 * RING + 1;
+    std::vector<int> grid(size * size, -1);
+    double half = cell / 2.0;
+
+    for (int b = -RING; b < RING; b++)
+    {
+        for (int a = -RING; a < RING; a++)
+        {
+            bool inX = hole && a >= hx0 && a < hx1;
+            bool inY = hole && b >= hy0 && b < hy1;
+            if (inX && inY)
+                continue;
+
+            int x0 = cx + a * cell;
+            int y0 = cy + b * cell;
+            if (2 * (x0 + cell) <= -columns || 2 * x0 >= columns ||
+                2 * (y0 + cell) <= -rows || 2 * y0 >= rows)
+                continue;
+
+            // Corners in counter-clockwise order from bottom left
+            static const int dx[4] = { 0, 1, 1, 0 };
+            static const int dy[4] = { 0, 0, 1, 1 };
+            GLuint q[4];
+            for (uint i = 0; i < 4; i++)
+            {
+                int &index = grid[(b + RING + dy[i]) * size + a + RING + dx[i]];
+                if (index < 0)
+                    index = vertex(x0 + dx[i] * cell, y0 + dy[i] * cell);
+                q[i] = index;
+            }
+
+            // Rotate corners so that an edge along the hole is q[2]-q[3]
+            uint turn = 4;
+            if (inX && b + 1 == hy0)
+                turn = 0;
+            else if (inY && a == hx1)
+                turn = 1;
+            else if (inX && b == hy1)
+                turn = 2;
+            else if (inY && a + 1 == hx0)
+                turn = 3;
+
+            if (turn == 4)
+            {
+                GLuint t[6] = { q[0], q[1], q[2], q[0], q[2], q[3] };
+                indices.insert(indices.end(), t, t + 6);
+                continue;
+            }
+
+            // Split the cell at the middle of the edge along the hole
+            static const int mx[4] = { 1, 0, 1, 2 };
+            static const int my[4] = { 2, 1, 0, 1 };
+            GLuint m = vertex(x0 + mx[turn] * half, y0 + my[turn] * half);
+            GLuint p0 = q[turn], p1 = q[(turn + 1) % 4];
+            GLuint p2 = q[(turn + 2) % 4], p3 = q[(turn + 3) % 4];
+            GLuint t[9] = { p0, p1, m, p0, m, p3, p1, p2, m };
+            indices.insert(indices.end(), t, t + 9);
+        }
+    }
+}
+
+
+std::ostream & WaterMesh::debug()
+// ----------------------------------------------------------------------------
+//   Convenience method to log with a common prefix
+// ----------------------------------------------------------------------------
+{
+    std::cerr << "[WaterMesh] " << (void*)this << " ";
+    return std::cerr;
+}
@@ -0,0 +1,91 @@
+#ifndef WATER_MESH_H
+#define WATER_MESH_H
+// *****************************************************************************
+// water_mesh.h                                                    Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//      Level of detail mesh of water surfaces.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2014,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "tao/tao_gl.h"
+#include <QGLContext>
+#include <iostream>
+#include <vector>
+
+
+class WaterMesh
+// ----------------------------------------------------------------------------
+//   Nested square rings of vertices around the camera, finer near it
+// ----------------------------------------------------------------------------
+//   Level 0 is a grid of 2*RING x 2*RING cells of one texel, centered on
+//   the camera. Each next level doubles the cell size, and is a ring around
+//   the previous one, so that the vertex count grows with the logarithm of
+//   the extent of the water. The center of level l is snapped to multiples
+//   of 2^(l+1) texels, so that the hole of a ring is always aligned on its
+//   own cells, and cells along the hole are split to share the vertices of
+//   the finer level, which avoids cracks. Vertices are clamped to the water.
+//
+//   Vertices and indices are kept in GL buffers, and only rebuilt when the
+//   camera moves by a couple of texels or the grid is resized.
+{
+public:
+    WaterMesh();
+    ~WaterMesh();
+
+    // Draw over w x h, for a grid of columns x rows texels
+    void                draw(int columns, int rows, double w, double h);
+    void                reset();
+    uint                vertexCount()   { return vertices.size() / 4; }
+
+private:
+    bool                place(double ex, double ey, double ez, int c, int r);
+    void                build();
+    uint                vertex(double x, double y);
+    void                ring(uint level);
+    std::ostream &      debug();
+
+private:
+    enum { RING = 32, MAX_LEVELS = 16, FAR = 16 };
+
+    const QGLContext *  context;        // Context owning the buffers
+    GLuint              buffers[2];     // Vertices, indices
+    bool                uploaded;
+
+    // Layout of the rings for the current camera and grid
+    int                 columns, rows;
+    uint                first, levels;
+    int                 centers[2 * MAX_LEVELS];
+
+    std::vector<float>  vertices;       // x, y in [-1, 1], texture u, v
+    std::vector<GLuint> indices;
+};
+
+#endif
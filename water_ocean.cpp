@@ -0,0 +1,420 @@
+// *****************************************************************************
+// water_ocean.cpp                                                 Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//   Open ocean computed from a wave spectrum with an inverse FFT.
+//
+//   The spectrum follows Tessendorf, "Simulating Ocean Water": a Phillips
+//   spectrum drawn from the wind, where each wave turns at the frequency of
+//   deep water waves. The 2D inverse FFT runs along columns, so that each
+//   butterfly processes contiguous texels of two rows, vectorized with AVX,
+//   SSE2 or NEON. Rows are transformed as the columns of the transposed grid.
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2013, Baptiste Soulisse <baptiste.soulisse@taodyne.com>
+// (C) 2012-2015,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+#include "water_ocean.h"
+#include "water_pool.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define WATER_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define WATER_NEON
+#endif
+
+
+static const double PI      = 3.141592653589793;
+static const double GRAVITY = 9.81;             // m/s^2
+
+// Columns or rows handled by each band of the multithreaded passes
+static const int BAND_TEXELS = 16;
+
+
+
+// ============================================================================
+//
+//   FFT kernels
+//
+// ============================================================================
+
+static void butterflies(float *ar, float *ai, float *br, float *bi,
+                        float wr, float wi, int x0, int x1)
+// ----------------------------------------------------------------------------
+//   Radix-2 butterflies between texels [x0, x1) of rows a and b
+// ----------------------------------------------------------------------------
+//   b is multiplied by the twiddle factor w, then a, b = a + b, a - b
+{
+    int x = x0;
+#if defined(__AVX__)
+    const __m256 vwr = _mm256_set1_ps(wr);
+    const __m256 vwi = _mm256_set1_ps(wi);
+    for (; x + 8 <= x1; x += 8)
+    {
+        __m256 vbr = _mm256_loadu_ps(br + x);
+        __m256 vbi = _mm256_loadu_ps(bi + x);
+        __m256 tr  = _mm256_sub_ps(_mm256_mul_ps(vbr, vwr),
+                                   _mm256_mul_ps(vbi, vwi));
+        __m256 ti  = _mm256_add_ps(_mm256_mul_ps(vbr, vwi),
+                                   _mm256_mul_ps(vbi, vwr));
+        __m256 var = _mm256_loadu_ps(ar + x);
+        __m256 vai = _mm256_loadu_ps(ai + x);
+        _mm256_storeu_ps(br + x, _mm256_sub_ps(var, tr));
+        _mm256_storeu_ps(bi + x, _mm256_sub_ps(vai, ti));
+        _mm256_storeu_ps(ar + x, _mm256_add_ps(var, tr));
+        _mm256_storeu_ps(ai + x, _mm256_add_ps(vai, ti));
+    }
+#elif defined(WATER_SSE2)
+    const __m128 vwr = _mm_set1_ps(wr);
+    const __m128 vwi = _mm_set1_ps(wi);
+    for (; x + 4 <= x1; x += 4)
+    {
+        __m128 vbr = _mm_loadu_ps(br + x);
+        __m128 vbi = _mm_loadu_ps(bi + x);
+        __m128 tr  = _mm_sub_ps(_mm_mul_ps(vbr, vwr), _mm_mul_ps(vbi, vwi));
+        __m128 ti  = _mm_add_ps(_mm_mul_ps(vbr, vwi), _mm_mul_ps(vbi, vwr));
+        __m128 var = _mm_loadu_ps(ar + x);
+        __m128 vai = _mm_loadu_ps(ai + x);
+        _mm_storeu_ps(br + x, _mm_sub_ps(var, tr));
+        _mm_storeu_ps(bi + x, _mm_sub_ps(vai, ti));
+        _mm_storeu_ps(ar + x, _mm_add_ps(var, tr));
+        _mm_storeu_ps(ai + x, _mm_add_ps(vai, ti));
+    }
+#elif defined(WATER_NEON)
+    const float32x4_t vwr = vdupq_n_f32(wr);
+    const float32x4_t vwi = vdupq_n_f32(wi);
+    for (; x + 4 <= x1; x += 4)
+    {
+        float32x4_t vbr = vld1q_f32(br + x);
+        float32x4_t vbi = vld1q_f32(bi + x);
+        float32x4_t tr  = vsubq_f32(vmulq_f32(vbr, vwr), vmulq_f32(vbi, vwi));
+        float32x4_t ti  = vaddq_f32(vmulq_f32(vbr, vwi), vmulq_f32(vbi, vwr));
+        float32x4_t var = vld1q_f32(ar + x);
+        float32x4_t vai = vld1q_f32(ai + x);
+        vst1q_f32(br + x, vsubq_f32(var, tr));
+        vst1q_f32(bi + x, vsubq_f32(vai, ti));
+        vst1q_f32(ar + x, vaddq_f32(var, tr));
+        vst1q_f32(ai + x, vaddq_f32(vai, ti));
+    }
+#endif
+
+    for (; x < x1; x++)
+    {
+        float tr = br[x] * wr - bi[x] * wi;
+        float ti = br[x] * wi + bi[x] * wr;
+        br[x] = ar[x] - tr;
+        bi[x] = ai[x] - ti;
+        ar[x] += tr;
+        ai[x] += ti;
+    }
+}
+
+
+void WaterOcean::columns(float *re, float *im, int w, int h, int x0, int x1)
+// ----------------------------------------------------------------------------
+//   Inverse FFT of complex values along columns [x0, x1) of h rows
+// ----------------------------------------------------------------------------
+//   Iterative radix-2 transform: rows are put in bit-reversed order, then
+//   each stage combines pairs of rows. The result is not divided by h.
+{
+    int bits = 0;
+    while ((1 << bits) < h)
+        bits++;
+
+    for (int i = 0; i < h; i++)
+    {
+        int j = 0;
+        for (int b = 0; b < bits; b++)
+            if (i & (1 << b))
+                j |= 1 << (bits - 1 - b);
+        if (i < j)
+        {
+            std::swap_ranges(re + i * w + x0, re + i * w + x1, re + j * w + x0);
+            std::swap_ranges(im + i * w + x0, im + i * w + x1, im + j * w + x0);
+        }
+    }
+
+    for (int len = 2; len <= h; len <<= 1)
+    {
+        int half = len / 2;
+        double step = 2.0 * PI / len;
+        for (int k = 0; k < half; k++)
+        {
+            float wr = cos(step * k);
+            float wi = sin(step * k);
+            for (int a = k; a < h; a += len)
+            {
+                int b = a + half;
+                butterflies(re + a * w, im + a * w, re + b * w, im + b * w,
+                            wr, wi, x0, x1);
+            }
+        }
+    }
+}
+
+
+
+// ============================================================================
+//
+//   Multithreaded passes
+//
+// ============================================================================
+
+struct WaterOceanJob : WaterPool::Job
+// ----------------------------------------------------------------------------
+//   Run one pass of the ocean computation, by bands of rows or columns
+// ----------------------------------------------------------------------------
+{
+    enum Phase { SPECTRUM, COLUMNS, TRANSPOSE, ROWS, HEIGHTS };
+
+    WaterOceanJob(WaterOcean *ocean): ocean(ocean), phase(SPECTRUM) {}
+
+    void start(Phase p, int texels)
+    {
+        phase = p;
+        int bands = (texels + BAND_TEXELS - 1) / BAND_TEXELS;
+        WaterPool::instance()->run(this, bands);
+    }
+
+    virtual void run(int band)
+    {
+        WaterOcean &o = *ocean;
+        int w = o.width, h = o.height;
+        int t0 = band * BAND_TEXELS;
+        switch(phase)
+        {
+        case SPECTRUM:
+            spectrum(t0, std::min(t0 + BAND_TEXELS, h));
+            break;
+        case COLUMNS:
+            WaterOcean::columns(&o.re[0], &o.im[0], w, h,
+                                t0, std::min(t0 + BAND_TEXELS, w));
+            break;
+        case TRANSPOSE:
+            transpose(&o.re[0], &o.tre[0], w, h, t0);
+            transpose(&o.im[0], &o.tim[0], w, h, t0);
+            break;
+        case ROWS:
+            WaterOcean::columns(&o.tre[0], &o.tim[0], h, w,
+                                t0, std::min(t0 + BAND_TEXELS, h));
+            break;
+        case HEIGHTS:
+            transpose(&o.tre[0], &o.heights[0], h, w, t0);
+            break;
+        }
+    }
+
+    void spectrum(int y0, int y1)
+    // Spectrum at the current time for rows [y0, y1)
+    {
+        WaterOcean &o = *ocean;
+        int w = o.width, h = o.height;
+        for (int y = y0; y < y1; y++)
+        {
+            int my = (h - y) % h;
+            for (int x = 0; x < w; x++)
+            {
+                // h0(k) e^(i w t) + conj(h0(-k)) e^(-i w t), real heights
+                int k = y * w + x;
+                int mk = my * w + (w - x) % w;
+                double phase = o.omega[k] * o.time;
+                float c = cos(phase), s = sin(phase);
+                float hr = o.h0re[k], hi = o.h0im[k];
+                float mr = o.h0re[mk], mi = o.h0im[mk];
+                o.re[k] = (hr + mr) * c - (hi + mi) * s;
+                o.im[k] = (hr - mr) * s + (hi - mi) * c;
+            }
+        }
+    }
+
+    void transpose(const float *src, float *dst, int w, int h, int y0)
+    // Write rows [y0, y0 + BAND_TEXELS) of a w x h grid as columns of dst
+    {
+        int y1 = std::min(y0 + BAND_TEXELS, h);
+        for (int x = 0; x < w; x++)
+            for (int y = y0; y < y1; y++)
+                dst[x * h + y] = src[y * w + x];
+    }
+
+    WaterOcean *ocean;
+    Phase       phase;
+};
+
+
+
+// ============================================================================
+//
+//   Ocean
+//
+// ============================================================================
+
+WaterOcean::WaterOcean(int w, int h)
+// ----------------------------------------------------------------------------
+//   Create a calm ocean, with a moderate breeze over a 250m patch
+// ----------------------------------------------------------------------------
+    : width(w), height(h), time(0.0),
+      wind(10.0f), direction(0.0f), length(250.0f),
+      h0re(w * h), h0im(w * h), omega(w * h),
+      re(w * h), im(w * h), tre(w * h), tim(w * h), heights(w * h)
+{
+    spectrum(1);
+}
+
+
+bool WaterOcean::fits(int w, int h)
+// ----------------------------------------------------------------------------
+//   The FFT needs a power of two in each direction
+// ----------------------------------------------------------------------------
+{
+    return w >= 2 && h >= 2 && (w & (w - 1)) == 0 && (h & (h - 1)) == 0;
+}
+
+
+static double gaussian(quint64 &generator)
+// ----------------------------------------------------------------------------
+//   Normal random number, Box-Muller on the xorshift64* generator of waters
+// ----------------------------------------------------------------------------
+{
+    double u[2];
+    for (int i = 0; i < 2; i++)
+    {
+        generator ^= generator >> 12;
+        generator ^= generator << 25;
+        generator ^= generator >> 27;
+        quint64 bits = generator * 0x2545F4914F6CDD1DULL;
+        u[i] = ((bits >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+    }
+    return sqrt(-2.0 * log(u[0])) * cos(2.0 * PI * u[1]);
+}
+
+
+void WaterOcean::spectrum(quint64 seed)
+// ----------------------------------------------------------------------------
+//   Draw the amplitude and phase of each wave from the Phillips spectrum
+// ----------------------------------------------------------------------------
+//   The spectrum gives the shape, the amplitude is then scaled so that the
+//   significant wave height matches a fully developed sea for this wind,
+//   0.21 wind^2 / g (Pierson-Moskowitz). Waves against the wind are weak,
+//   and waves much shorter than the largest one are filtered out.
+{
+    quint64 generator = seed ? seed : 0x9E3779B97F4A7C15ULL;
+    double largest = wind * wind / GRAVITY;
+    double smallest = largest / 1000.0;
+    double wx = cos(direction), wy = sin(direction);
+    double sum = 0.0;
+
+    for (int y = 0; y < height; y++)
+    {
+        int m = y < height / 2 ? y : y - height;
+        for (int x = 0; x < width; x++)
+        {
+            int n = x < width / 2 ? x : x - width;
+            int k = y * width + x;
+            double kx = 2.0 * PI * n / length;
+            double ky = 2.0 * PI * m / length;
+            double k2 = kx * kx + ky * ky;
+            h0re[k] = h0im[k] = omega[k] = 0.0f;
+            if (k2 == 0.0 || largest == 0.0)
+                continue;
+
+            double cosine = (kx * wx + ky * wy) / sqrt(k2);
+            double phillips = exp(-1.0 / (k2 * largest * largest))
+                / (k2 * k2) * cosine * cosine
+                * exp(-k2 * smallest * smallest);
+            if (cosine < 0.0)
+                phillips *= 0.07;
+
+            double amplitude = sqrt(phillips * 0.5);
+            h0re[k] = gaussian(generator) * amplitude;
+            h0im[k] = gaussian(generator) * amplitude;
+            omega[k] = sqrt(GRAVITY * sqrt(k2));
+            sum += h0re[k] * h0re[k] + h0im[k] * h0im[k];
+        }
+    }
+
+    // Each wave contributes its own amplitude and that of its opposite
+    double rms = 0.21 * wind * wind / GRAVITY / 4.0 / length;
+    if (sum > 0.0)
+    {
+        float scale = rms / sqrt(2.0 * sum);
+        for (int k = 0; k < width * height; k++)
+        {
+            h0re[k] *= scale;
+            h0im[k] *= scale;
+        }
+    }
+}
+
+
+void WaterOcean::compute()
+// ----------------------------------------------------------------------------
+//   Compute heights at the current time
+// ----------------------------------------------------------------------------
+//   The 2D inverse FFT is a pass along columns, then a pass along the
+//   columns of the transposed grid. Each pass is spread over the pool.
+{
+    WaterOceanJob job(this);
+    job.start(WaterOceanJob::SPECTRUM, height);
+    job.start(WaterOceanJob::COLUMNS, width);
+    job.start(WaterOceanJob::TRANSPOSE, height);
+    job.start(WaterOceanJob::ROWS, height);
+    job.start(WaterOceanJob::HEIGHTS, width);
+}
+
+
+void WaterOcean::pack(float *rgba, bool gradients) const
+// ----------------------------------------------------------------------------
+//   Interleave heights, 0 velocities and gradients into RGBA texels
+// ----------------------------------------------------------------------------
+//   The patch is periodic, so gradients wrap around the edges
+{
+    const float *h = &heights[0];
+    for (int y = 0; y < height; y++)
+    {
+        const float *row = h + y * width;
+        const float *down = h + ((y + height - 1) % height) * width;
+        const float *up = h + ((y + 1) % height) * width;
+        for (int x = 0; x < width; x++)
+        {
+            *rgba++ = row[x];
+            *rgba++ = 0.0f;
+            if (gradients)
+            {
+                float left = row[(x + width - 1) % width];
+                float right = row[(x + 1) % width];
+                *rgba++ = (right - left) * 0.5f;
+                *rgba++ = (up[x] - down[x]) * 0.5f;
+            }
+            else
+            {
+                *rgba++ = 0.0f;
+                *rgba++ = 0.0f;
+            }
+        }
+    }
+}
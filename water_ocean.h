@@ -0,0 +1,90 @@
+#ifndef WATER_OCEAN_H
+#define WATER_OCEAN_H
+// *****************************************************************************
+// water_ocean.h                                                   Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//      Open ocean computed from a wave spectrum with an inverse FFT.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2013, Baptiste Soulisse <baptiste.soulisse@taodyne.com>
+// (C) 2012-2014,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+#include <QtGlobal>
+#include <vector>
+
+
+struct WaterOcean
+// ----------------------------------------------------------------------------
+//   Heights of an open sea patch, from a Phillips spectrum evolved in time
+// ----------------------------------------------------------------------------
+//   The spectrum is drawn once from the wind. Each wave vector then turns
+//   at the angular frequency of deep water waves, and heights at any time
+//   are the inverse FFT of the spectrum at that time. The cost only depends
+//   on the size of the grid, which must be a power of two in each direction.
+//   Heights are in units of the patch size, like texture coordinates.
+{
+    WaterOcean(int w, int h);
+
+    // Regenerate the spectrum for the current wind and patch size
+    void            spectrum(quint64 seed);
+
+    // Compute heights at the current time
+    void            compute();
+
+    // Interleave height, 0 velocity and gradient into 'rgba' for upload
+    void            pack(float *rgba, bool gradients) const;
+
+    // Current heights, in rows of 'width' floats
+    const float *   surface() const     { return &heights[0]; }
+
+    // Check if the FFT can run on a w x h grid
+    static bool     fits(int w, int h);
+
+    // Inverse FFT of complex values along columns [x0, x1) of the rows
+    static void     columns(float *re, float *im, int w, int h,
+                            int x0, int x1);
+
+public:
+    int      width, height;
+    double   time;              // Seconds
+    float    wind;              // Wind speed in m/s
+    float    direction;         // Direction the wind blows to, in radians
+    float    length;            // Size of the patch in meters
+
+private:
+    std::vector<float> h0re, h0im;    // Spectrum at time 0
+    std::vector<float> omega;         // Angular frequency of each wave
+    std::vector<float> re, im;        // Spectrum at 'time', then heights
+    std::vector<float> tre, tim;      // Transposed for the row pass
+    std::vector<float> heights;
+
+    friend struct WaterOceanJob;
+};
+
+#endif // WATER_OCEAN_H
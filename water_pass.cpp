@@ -0,0 +1,100 @@
+// *****************************************************************************
+// water_pass.cpp                                                  Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//   Render passes of the water shaders.
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2013, Baptiste Soulisse <baptiste.soulisse@taodyne.com>
+// (C) 2012-2013, Catherine Burvelle <catherine@taodyne.com>
+// (C) 2012-2015,2019, Christophe de Dinechin <christophe@dinechin.org>
+// (C) 2012-2013, Jérôme Forissier <jerome@taodyne.com>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+#include "water_pass.h"
+#include "tao/graphic_state.h"
+
+
+int  WaterPass::depth  = 0;
+bool WaterPass::synced = false;
+
+
+
+// ============================================================================
+//
+//   WaterPass
+//
+// ============================================================================
+
+WaterPass::WaterPass(uint frame, int width, int height, uint program)
+// ----------------------------------------------------------------------------
+//   Save the state we change, then bind the FBO and program of the pass
+// ----------------------------------------------------------------------------
+{
+    // Assure we have a correct state before make changes, once per batch
+    if (!synced)
+    {
+        GL.Sync();
+        synced = true;
+    }
+    depth++;
+
+    // Save current settings
+    GL.Get(GL_FRAMEBUFFER_BINDING, &savedFrame);
+    GL.Get(GL_VIEWPORT, savedViewport);
+    GL.Get(GL_CURRENT_PROGRAM, &savedProgram);
+    GL.Get(GL_ACTIVE_TEXTURE, &savedActive);
+    GL.ActiveTexture(GL_TEXTURE0);
+    GL.Get(GL_TEXTURE_BINDING_2D, &savedTexture);
+    GL.Get(GL_TEXTURE_2D, &savedTexturing);
+
+    // Prepare to draw into buffer
+    GL.BindFramebuffer(GL_FRAMEBUFFER, frame);
+    GL.Viewport(0, 0, width, height);
+    GL.UseProgram(program);
+}
+
+
+WaterPass::~WaterPass()
+// ----------------------------------------------------------------------------
+//   Restore the state saved by the constructor
+// ----------------------------------------------------------------------------
+{
+    GL.UseProgram(savedProgram);
+    GL.BindTexture(GL_TEXTURE_2D, savedTexture);
+    if (savedTexturing)
+        GL.Enable(GL_TEXTURE_2D);
+    else
+        GL.Disable(GL_TEXTURE_2D);
+    GL.ActiveTexture(savedActive);
+    GL.BindFramebuffer(GL_FRAMEBUFFER, savedFrame);
+    GL.Viewport(savedViewport[0], savedViewport[1],
+                savedViewport[2], savedViewport[3]);
+
+    if (!--depth)
+        synced = false;
+}
@@ -0,0 +1,73 @@
+#ifndef WATER_PASS_H
+#define WATER_PASS_H
+// *****************************************************************************
+// water_pass.h                                                    Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//      Render passes of the water shaders.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2013, Baptiste Soulisse <baptiste.soulisse@taodyne.com>
+// (C) 2012-2014,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+#include "tao/tao_gl.h"
+
+
+class WaterPass
+// ----------------------------------------------------------------------------
+//   Render into a water FBO, restoring only the state we change
+// ----------------------------------------------------------------------------
+//   A pass saves and restores the FBO binding, the viewport, the program
+//   and texture unit 0 through the graphic state cache of Tao, instead of
+//   pushing and popping whole attribute groups.
+//   The cache is synchronised by the first pass of a batch only: passes
+//   opened while a Batch or another pass is alive do not sync again.
+{
+public:
+    WaterPass(uint frame, int width, int height, uint program);
+    ~WaterPass();
+
+    struct Batch
+    {
+        Batch()         { depth++; }
+        ~Batch()        { if (!--depth) synced = false; }
+    };
+
+private:
+    GLint       savedFrame;
+    GLint       savedViewport[4];
+    GLint       savedProgram;
+    GLint       savedActive;
+    GLint       savedTexture;
+    GLint       savedTexturing;
+
+    static int  depth;
+    static bool synced;
+};
+
+#endif
@@ -0,0 +1,236 @@
+// *****************************************************************************
+// water_pool.cpp                                                  Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//   Thread pool used by the CPU solvers.
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2015,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+#include "water_pool.h"
+
+
+WaterPool * WaterPool::pool      = NULL;
+int         WaterPool::requested = 0;
+
+
+
+// ============================================================================
+//
+//   WaterPool
+//
+// ============================================================================
+
+WaterPool::WaterPool(int threads)
+// ----------------------------------------------------------------------------
+//   Start the worker threads
+// ----------------------------------------------------------------------------
+    : remaining(0), job(NULL), generation(0), quit(false)
+{
+    if (threads < 1)
+        threads = 1;
+    for (int i = 0; i < threads; i++)
+    {
+        Queue *q = new Queue;
+        q->begin = q->end = 0;
+        q->generation = 0;
+        queues.push_back(q);
+    }
+    for (int i = 1; i < threads; i++)
+    {
+        Worker *w = new Worker(this, i);
+        workers.push_back(w);
+        w->start();
+    }
+}
+
+
+WaterPool::~WaterPool()
+// ----------------------------------------------------------------------------
+//   Stop and join the worker threads
+// ----------------------------------------------------------------------------
+{
+    mutex.lock();
+    quit = true;
+    wake.wakeAll();
+    mutex.unlock();
+
+    for (uint i = 0; i < workers.size(); i++)
+    {
+        workers[i]->wait();
+        delete workers[i];
+    }
+    for (uint i = 0; i < queues.size(); i++)
+        delete queues[i];
+}
+
+
+void WaterPool::run(Job *job, int bands)
+// ----------------------------------------------------------------------------
+//   Run all bands of the job and wait until they are all done
+// ----------------------------------------------------------------------------
+{
+    int n = queues.size();
+    if (n == 1 || bands <= 1)
+    {
+        for (int band = 0; band < bands; band++)
+            job->run(band);
+        return;
+    }
+
+    // Give each thread a contiguous range of bands
+    mutex.lock();
+    uint gen = ++generation;
+    this->job = job;
+    remaining.fetchAndStoreOrdered(bands);
+    for (int i = 0; i < n; i++)
+    {
+        Queue *q = queues[i];
+        q->lock.lock();
+        q->begin = bands * i / n;
+        q->end = bands * (i + 1) / n;
+        q->generation = gen;
+        q->lock.unlock();
+    }
+    wake.wakeAll();
+    mutex.unlock();
+
+    // Take part in the work, then wait for the stragglers
+    work(0, gen, job);
+    mutex.lock();
+    while (remaining.load() != 0)
+        done.wait(&mutex);
+    this->job = NULL;
+    mutex.unlock();
+}
+
+
+void WaterPool::loop(int self)
+// ----------------------------------------------------------------------------
+//   Body of a worker thread: wait for a new job, then work on it
+// ----------------------------------------------------------------------------
+{
+    uint seen = 0;
+    for (;;)
+    {
+        mutex.lock();
+        while (!quit && generation == seen)
+            wake.wait(&mutex);
+        if (quit)
+        {
+            mutex.unlock();
+            return;
+        }
+        seen = generation;
+        Job *current = job;
+        mutex.unlock();
+
+        work(self, seen, current);
+    }
+}
+
+
+void WaterPool::work(int self, uint gen, Job *job)
+// ----------------------------------------------------------------------------
+//   Run bands until there is nothing left to take or steal
+// ----------------------------------------------------------------------------
+{
+    int band;
+    while (take(self, gen, band))
+    {
+        job->run(band);
+        if (!remaining.deref())
+        {
+            mutex.lock();
+            done.wakeAll();
+            mutex.unlock();
+        }
+    }
+}
+
+
+bool WaterPool::take(int self, uint gen, int &band)
+// ----------------------------------------------------------------------------
+//   Take a band from our own queue, or steal one from another thread
+// ----------------------------------------------------------------------------
+//   Checking the generation prevents a late thread from taking bands
+//   of the next job with a pointer to the previous one.
+{
+    int n = queues.size();
+    for (int i = 0; i < n; i++)
+    {
+        Queue *q = queues[(self + i) % n];
+        q->lock.lock();
+        bool found = q->generation == gen && q->begin < q->end;
+        if (found)
+            band = i == 0 ? q->begin++ : --q->end;
+        q->lock.unlock();
+        if (found)
+            return true;
+    }
+    return false;
+}
+
+
+WaterPool *WaterPool::instance()
+// ----------------------------------------------------------------------------
+//   Return the shared pool, creating it on first use
+// ----------------------------------------------------------------------------
+{
+    if (!pool)
+    {
+        int threads = requested;
+        if (threads <= 0)
+            threads = QThread::idealThreadCount();
+        pool = new WaterPool(threads);
+    }
+    return pool;
+}
+
+
+void WaterPool::destroy()
+// ----------------------------------------------------------------------------
+//   Stop the shared pool
+// ----------------------------------------------------------------------------
+{
+    delete pool;
+    pool = NULL;
+}
+
+
+void WaterPool::setThreads(int threads)
+// ----------------------------------------------------------------------------
+//   Set the number of threads, 0 to use one per core
+// ----------------------------------------------------------------------------
+//   The pool is re-created lazily with the new count
+{
+    if (threads == requested)
+        return;
+    requested = threads;
+    destroy();
+}
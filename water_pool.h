@@ -0,0 +1,109 @@
+#ifndef WATER_POOL_H
+#define WATER_POOL_H
+// *****************************************************************************
+// water_pool.h                                                    Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//      Thread pool used by the CPU solvers.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2014,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+#include <vector>
+
+
+class WaterPool
+// ----------------------------------------------------------------------------
+//   Persistent threads running the bands of a job, with work stealing
+// ----------------------------------------------------------------------------
+//   Each thread starts with a contiguous range of bands, which it consumes
+//   from the front. Threads that run out of work steal bands from the back
+//   of the other ranges. The calling thread takes part in the work, and
+//   run() only returns once all bands are done, which acts as a barrier.
+{
+public:
+    struct Job
+    {
+        virtual ~Job() {}
+        virtual void run(int band) = 0;
+    };
+
+public:
+    WaterPool(int threads);
+    ~WaterPool();
+
+    void                run(Job *job, int bands);
+    int                 threads()       { return queues.size(); }
+
+public:
+    static WaterPool *  instance();
+    static void         destroy();
+    static void         setThreads(int threads);
+
+private:
+    struct Queue
+    {
+        QMutex  lock;
+        int     begin, end;
+        uint    generation;
+    };
+
+    class Worker : public QThread
+    {
+    public:
+        Worker(WaterPool *pool, int index): pool(pool), index(index) {}
+    protected:
+        virtual void run()      { pool->loop(index); }
+    private:
+        WaterPool *pool;
+        int        index;
+    };
+
+    void                loop(int self);
+    void                work(int self, uint generation, Job *job);
+    bool                take(int self, uint generation, int &band);
+
+private:
+    std::vector<Queue *>  queues;  // One per thread, 0 is the caller
+    std::vector<Worker *> workers;
+    QMutex                mutex;
+    QWaitCondition        wake, done;
+    QAtomicInt            remaining;
+    Job *                 job;
+    uint                  generation;
+    bool                  quit;
+
+    static WaterPool *    pool;
+    static int            requested;
+};
+
+#endif
@@ -0,0 +1,215 @@
+// *****************************************************************************
+// water_readback.cpp                                              Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//   Asynchronous readback of water heights.
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2015,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+#include "water_readback.h"
+#include "basics.h" // XLR
+#include <algorithm>
+#include <cmath>
+
+
+bool WaterReadback::fences = false;
+
+
+WaterReadback::WaterReadback()
+// ----------------------------------------------------------------------------
+//   Create a readback ring, GL buffers are created on first use
+// ----------------------------------------------------------------------------
+    : context(NULL), issued(0), collected(0), width(0), height(0)
+{
+    for (uint b = 0; b < BUFFERS; b++)
+    {
+        buffers[b] = 0;
+        syncs[b] = 0;
+        columns[b] = rows[b] = 0;
+    }
+}
+
+
+WaterReadback::~WaterReadback()
+// ----------------------------------------------------------------------------
+//   Delete GL buffers and fences if their context is still current
+// ----------------------------------------------------------------------------
+{
+    if (!context || context != QGLContext::currentContext())
+        return;
+    for (; collected != issued; collected++)
+        if (fences)
+            glDeleteSync(syncs[collected % BUFFERS]);
+    glDeleteBuffers(BUFFERS, buffers);
+}
+
+
+void WaterReadback::request(int w, int h)
+// ----------------------------------------------------------------------------
+//   Start reading the red channel of the current read buffer
+// ----------------------------------------------------------------------------
+//   The caller binds the frame buffer and selects the color attachment
+{
+    collect();
+
+    const QGLContext *current = QGLContext::currentContext();
+    if (context != current)
+    {
+        context = current;
+        glGenBuffers(BUFFERS, buffers);
+        for (uint b = 0; b < BUFFERS; b++)
+            columns[b] = rows[b] = 0;
+        issued = collected = 0;
+    }
+    if (issued - collected >= BUFFERS)
+        return;
+
+    uint b = issued % BUFFERS;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[b]);
+    if (columns[b] * rows[b] != w * h)
+        glBufferData(GL_PIXEL_PACK_BUFFER, w * h * sizeof(float),
+                     NULL, GL_STREAM_READ);
+    columns[b] = w;
+    rows[b] = h;
+    glReadPixels(0, 0, w, h, GL_RED, GL_FLOAT, NULL);
+    if (fences)
+        syncs[b] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    issued++;
+}
+
+
+bool WaterReadback::collect()
+// ----------------------------------------------------------------------------
+//   Copy the most recent completed read, without waiting for the GPU
+// ----------------------------------------------------------------------------
+//   Fences signal in order, so all reads older than a completed one are
+//   complete as well, and only the newest of them needs to be mapped.
+//   Return true if a read completed since the last call.
+{
+    if (!context || context != QGLContext::currentContext())
+        return false;
+
+    uint done = collected;
+    while (done != issued)
+    {
+        uint b = done % BUFFERS;
+        if (fences)
+        {
+            GLenum status = glClientWaitSync(syncs[b], 0, 0);
+            if (status == GL_TIMEOUT_EXPIRED)
+                break;
+            glDeleteSync(syncs[b]);
+        }
+        else if (issued - done < BUFFERS)
+        {
+            break;
+        }
+        done++;
+    }
+    if (done == collected)
+        return false;
+
+    uint b = (done - 1) % BUFFERS;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[b]);
+    const float *data = (const float *)
+        glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if (data)
+    {
+        width = columns[b];
+        height = rows[b];
+        heights.assign(data, data + width * height);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    collected = done;
+
+    IFTRACE(water_surface)
+            debug() << "Read " << width << "x" << height << " values" << "\n";
+    return true;
+}
+
+
+void WaterReadback::reset()
+// ----------------------------------------------------------------------------
+//   Forget GL buffers, which belong to a context that no longer exists
+// ----------------------------------------------------------------------------
+//   The last heights remain available until a new read completes
+{
+    context = NULL;
+    issued = collected = 0;
+}
+
+
+float WaterReadback::sample(double x, double y)
+// ----------------------------------------------------------------------------
+//   Height at x, y in the latest completed read, 0 if there is none yet
+// ----------------------------------------------------------------------------
+{
+    if (heights.empty())
+        return 0.0;
+    return sample(&heights[0], width, height, width, x, y);
+}
+
+
+float WaterReadback::sample(const float *data, int w, int h, int stride,
+                            double x, double y)
+// ----------------------------------------------------------------------------
+//   Bilinear interpolation between texel centers, clamped to the edges
+// ----------------------------------------------------------------------------
+//   Coordinates are those of drops: -1 to 1 maps to the whole grid
+{
+    double fx = (x * 0.5 + 0.5) * w - 0.5;
+    double fy = (y * 0.5 + 0.5) * h - 0.5;
+    fx = std::max(0.0, std::min(fx, w - 1.0));
+    fy = std::max(0.0, std::min(fy, h - 1.0));
+
+    int x0 = (int) floor(fx);
+    int y0 = (int) floor(fy);
+    int x1 = std::min(x0 + 1, w - 1);
+    int y1 = std::min(y0 + 1, h - 1);
+    float tx = fx - x0;
+    float ty = fy - y0;
+
+    const float *row0 = data + y0 * stride;
+    const float *row1 = data + y1 * stride;
+    float bottom = row0[x0] + (row0[x1] - row0[x0]) * tx;
+    float top    = row1[x0] + (row1[x1] - row1[x0]) * tx;
+    return bottom + (top - bottom) * ty;
+}
+
+
+std::ostream & WaterReadback::debug()
+// ----------------------------------------------------------------------------
+//   Convenience method to log with a common prefix
+// ----------------------------------------------------------------------------
+{
+    std::cerr << "[WaterReadback] " << (void*)this << " ";
+    return std::cerr;
+}
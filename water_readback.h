@@ -0,0 +1,91 @@
+#ifndef WATER_READBACK_H
+#define WATER_READBACK_H
+// *****************************************************************************
+// water_readback.h                                                Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//      Asynchronous readback of water heights.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2014,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "tao/tao_gl.h"
+#include <QGLContext>
+#include <iostream>
+#include <vector>
+
+
+class WaterReadback
+// ----------------------------------------------------------------------------
+//   Latest CPU copy of a height field, read from the GPU without stalling
+// ----------------------------------------------------------------------------
+//   Heights are read into a small ring of pixel buffer objects, and only
+//   mapped once a fence tells that the GPU wrote them, usually one or two
+//   frames later. A read is skipped if all buffers are pending. Without
+//   GL_ARB_sync, a buffer is mapped once BUFFERS-1 newer reads were issued.
+{
+public:
+    WaterReadback();
+    ~WaterReadback();
+
+    void                request(int width, int height);
+    bool                collect();
+    void                reset();
+    bool                ready()         { return !heights.empty(); }
+    bool                pending()       { return issued != collected; }
+
+    // Values of the latest completed read, row by row
+    const float *       values()        { return &heights[0]; }
+    uint                size()          { return heights.size(); }
+
+    // Bilinear height at x, y in [-1, 1], the coordinates of add_drop
+    float               sample(double x, double y);
+    static float        sample(const float *data, int w, int h, int stride,
+                               double x, double y);
+
+public:
+    static bool         fences;         // GL_ARB_sync is available
+
+private:
+    std::ostream &      debug();
+
+private:
+    enum { BUFFERS = 3 };
+
+    const QGLContext *  context;        // Context owning the buffers
+    GLuint              buffers[BUFFERS];
+    GLsync              syncs[BUFFERS];
+    int                 columns[BUFFERS], rows[BUFFERS];
+    uint                issued, collected;
+
+    std::vector<float>  heights;        // Latest completed read
+    int                 width, height;
+};
+
+#endif
@@ -0,0 +1,984 @@
+// *****************************************************************************
+// water_resources.cpp                                             Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//   GL resources shared by all waters of a GL context.
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2013, Baptiste Soulisse <baptiste.soulisse@taodyne.com>
+// (C) 2012-2013, Catherine Burvelle <catherine@taodyne.com>
+// (C) 2012-2015,2019, Christophe de Dinechin <christophe@dinechin.org>
+// (C) 2012-2013, Jérôme Forissier <jerome@taodyne.com>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+#include "water_resources.h"
+#include "tao/graphic_state.h"
+#include "basics.h" // XLR
+#include <QOpenGLContext>
+
+
+WaterResources::registry_map WaterResources::registry;
+uint                         WaterResources::serials = 0;
+
+
+
+// ============================================================================
+//
+//   Registry
+//
+// ============================================================================
+
+WaterResources *WaterResources::current()
+// ----------------------------------------------------------------------------
+//   Return the resources of the current context, building them if needed
+// ----------------------------------------------------------------------------
+{
+    const QGLContext *context = QGLContext::currentContext();
+    registry_map::iterator found = registry.find(context);
+    if (found != registry.end())
+        return (*found).second;
+
+    WaterResources *resources = new WaterResources(context);
+    registry[context] = resources;
+    return resources;
+}
+
+
+void WaterResources::forget(const void *owner)
+// ----------------------------------------------------------------------------
+//   Release the per-water resources of 'owner' in all contexts
+// ----------------------------------------------------------------------------
+{
+    for (registry_map::iterator r = registry.begin(); r != registry.end(); r++)
+        (*r).second->release(owner);
+}
+
+
+void WaterResources::purge()
+// ----------------------------------------------------------------------------
+//   Release resources of all contexts
+// ----------------------------------------------------------------------------
+{
+    registry_map all;
+    all.swap(registry);
+    for (registry_map::iterator r = all.begin(); r != all.end(); r++)
+        delete (*r).second;
+}
+
+
+
+// ============================================================================
+//
+//   Resources of one context
+//
+// ============================================================================
+
+WaterResources::WaterResources(const QGLContext *context)
+// ----------------------------------------------------------------------------
+//   Build programs and check capabilities of the given context
+// ----------------------------------------------------------------------------
+    : context(context), serial(++serials), failed(false),
+      dropShader(NULL), dropsLocation(-1), dropCountLocation(-1),
+      dropPeriodicLocation(-1),
+      updateShader(NULL), updateDeltaLocation(-1), updateRatioLocation(-1),
+      updateMaskLocation(-1), updateMaskedLocation(-1),
+      clearShader(NULL),
+      shallowShader(NULL), shallowDeltaLocation(-1), shallowRatioLocation(-1),
+      shallowDepthLocation(-1), shallowGravityLocation(-1),
+      shallowPeriodicLocation(-1), shallowMaskLocation(-1),
+      shallowMaskedLocation(-1),
+      reduceShader(NULL), reduceDeltaLocation(-1), reduceBlockLocation(-1),
+      reduceTexture(0), reduceFrame(0),
+      atlasUpdateShader(NULL), atlasDeltaLocation(-1),
+      atlasDropShader(NULL), atlasDropsLocation(-1), atlasDropCountLocation(-1)
+{
+    IFTRACE(water_surface)
+            debug() << "Create resources" << "\n";
+
+    // Synchronise state
+    GL.Sync();
+
+    // Check if graphic card has really two color attachments
+    // because we need it to make ping-pong technics
+    GLint max_color_attachments = 0;
+    GL.Get(GL_MAX_COLOR_ATTACHMENTS, &max_color_attachments);
+    if(max_color_attachments < 2)
+    {
+        failed = true;
+        IFTRACE(water_surface)
+                    debug() << "No enough color attachments available for this module. " << "\n";
+    }
+
+    createShaders();
+    createReduceBuffer();
+
+    // Release everything with the context
+    if (context && context->contextHandle())
+        connect(context->contextHandle(), SIGNAL(aboutToBeDestroyed()),
+                this, SLOT(contextDestroyed()), Qt::DirectConnection);
+}
+
+
+WaterResources::~WaterResources()
+// ----------------------------------------------------------------------------
+//   Delete programs, and FBOs if the context is current
+// ----------------------------------------------------------------------------
+{
+    IFTRACE(water_surface)
+            debug() << "Release resources" << "\n";
+
+    if (context == QGLContext::currentContext())
+    {
+        for (framebuffer_map::iterator f = framebuffers.begin();
+             f != framebuffers.end(); f++)
+            GL.DeleteFramebuffers(1, &(*f).second);
+        if (reduceFrame)
+            GL.DeleteFramebuffers(1, &reduceFrame);
+        if (reduceTexture)
+            GL.DeleteTextures(1, &reduceTexture);
+    }
+
+    delete dropShader;
+    delete updateShader;
+    delete clearShader;
+    delete shallowShader;
+    delete reduceShader;
+    delete atlasUpdateShader;
+    delete atlasDropShader;
+}
+
+
+void WaterResources::contextDestroyed()
+// ----------------------------------------------------------------------------
+//   Qt is about to destroy our context: remove it from the registry
+// ----------------------------------------------------------------------------
+{
+    registry.erase(context);
+    deleteLater();
+}
+
+
+uint WaterResources::framebuffer(const void *owner)
+// ----------------------------------------------------------------------------
+//   Return the FBO of 'owner' in this context, creating it on first use
+// ----------------------------------------------------------------------------
+{
+    framebuffer_map::iterator found = framebuffers.find(owner);
+    if (found != framebuffers.end())
+        return (*found).second;
+
+    uint frame = 0;
+    GL.GenFramebuffers(1, &frame);
+    framebuffers[owner] = frame;
+    return frame;
+}
+
+
+void WaterResources::release(const void *owner)
+// ----------------------------------------------------------------------------
+//   Delete the FBO of 'owner' in this context
+// ----------------------------------------------------------------------------
+{
+    framebuffer_map::iterator found = framebuffers.find(owner);
+    if (found == framebuffers.end())
+        return;
+    if (context == QGLContext::currentContext())
+        GL.DeleteFramebuffers(1, &(*found).second);
+    framebuffers.erase(found);
+}
+
+
+void WaterResources::createShaders()
+// ----------------------------------------------------------------------------
+//   Create shader programs
+// ----------------------------------------------------------------------------
+{
+    IFTRACE(water_surface)
+                debug() << "Create shaders" << "\n";
+
+    createDropShader();
+    createUpdateShader();
+    createShallowShader();
+    createClearShader();
+    createReduceShader();
+    createAtlasUpdateShader();
+    createAtlasDropShader();
+}
+
+
+void WaterResources::createDropShader()
+// ----------------------------------------------------------------------------
+//   Create shader used to add drops
+// ----------------------------------------------------------------------------
+{
+    if(!failed)
+    {
+        IFTRACE(water_surface)
+                debug() << "Create drop shader" << "\n";
+
+        dropShader = new QGLShaderProgram(context);
+        bool ok = false;
+
+        // Basic vertex shader
+        static std::string vSrc =
+                "/********************************************************************************\n"
+                "**                                                                               \n"
+                "** Copyright (C) 2011 Taodyne.                                                   \n"
+                "** All rights reserved.                                                          \n"
+                "** Contact: Taodyne (contact@taodyne.com)                                        \n"
+                "**                                                                               \n"
+                "** This file is part of the Tao3D application, developped by Taodyne.\n"
+                "** It can be only used in the software and these modules.                        \n"
+                "**                                                                               \n"
+                "** If you have questions regarding the use of this file, please contact          \n"
+                "** Taodyne at contact@taodyne.com.                                               \n"
+                "**                                                                               \n"
+                "********************************************************************************/\n"
+                "varying vec2 coord;"
+                "void main()"
+                "{"
+                "   coord = gl_Vertex.xy * 0.5 + 0.5;"
+                "   gl_Position = vec4(gl_Vertex.xyz, 1.0);"
+                "}";
+
+        static std::string fSrc =
+                "/********************************************************************************\n"
+                "**                                                                               \n"
+                "** Copyright (C) 2011 Taodyne.                                                   \n"
+                "** All rights reserved.                                                          \n"
+                "** Contact: Taodyne (contact@taodyne.com)                                        \n"
+                "**                                                                               \n"
+                "** This file is part of the Tao3D application, developped by Taodyne.\n"
+                "** It can be only used in the software and these modules.                        \n"
+                "**                                                                               \n"
+                "** If you have questions regarding the use of this file, please contact          \n"
+                "** Taodyne at contact@taodyne.com.                                               \n"
+                "**                                                                               \n"
+                "********************************************************************************/\n"
+                "const float PI = 3.141592653589793;"
+                "const int MAX_DROPS = 32;" /* WaterResources::DROPS_PER_PASS */
+                "uniform sampler2D texture;"
+                "uniform vec4  drops[MAX_DROPS];" /* center, radius, strength */
+                "uniform float count;"
+                "uniform float periodic;" /* 1 if drops wrap around edges */
+                "varying vec2 coord;"
+                "void main() {"
+                "   vec4 info = texture2D(texture, coord);"
+                "   for (int i = 0; i < MAX_DROPS; i++) {"
+                "      if (float(i) >= count)"
+                "         break;"
+                "      vec4 d = drops[i];"
+                "      vec2 to = d.xy * 0.5 + 0.5 - coord;"
+                "      to -= periodic * floor(to + 0.5);"
+                "      float drop = max(0.0, 1.0 - length(to) / (d.z / 100.0));"
+                "      drop = 0.5 - cos(drop * PI) * 0.5;"
+                "      info.r += drop * (d.w / 1000.0);"
+                "   }"
+                "   gl_FragColor = info;"
+                "}";
+
+
+        if (dropShader->addShaderFromSourceCode(QGLShader::Vertex, vSrc.c_str()))
+        {
+            if (dropShader->addShaderFromSourceCode(QGLShader::Fragment, fSrc.c_str()))
+            {
+                ok = true;
+            }
+            else
+            {
+                std::cerr << "Drop shader" << "\n";
+                std::cerr << "Error loading fragment shader code: " << "\n";
+                std::cerr << dropShader->log().toStdString();
+            }
+        }
+        else
+        {
+            std::cerr << "Drop shader" << "\n";
+            std::cerr << "Error loading vertex shader code: " << "\n";
+            std::cerr << dropShader->log().toStdString();
+        }
+
+        if (!ok)
+        {
+            delete dropShader;
+            dropShader = NULL;
+            failed = true;
+        }
+        else
+        {
+            dropShader->link();
+
+            // Save uniform locations
+            uint id = dropShader->programId();
+            dropsLocation     = GL.GetUniformLocation(id, "drops");
+            dropCountLocation = GL.GetUniformLocation(id, "count");
+            dropPeriodicLocation = GL.GetUniformLocation(id, "periodic");
+        }
+    }
+}
+
+
+void WaterResources::createUpdateShader()
+// ----------------------------------------------------------------------------
+//   Create shader used to update water
+// ----------------------------------------------------------------------------
+{
+    if(!failed)
+    {
+        IFTRACE(water_surface)
+                debug() << "Create update shader" << "\n";
+
+        updateShader = new QGLShaderProgram(context);
+        bool ok = false;
+
+        // Basic vertex shader
+        static std::string vSrc =
+                "/********************************************************************************\n"
+                "**                                                                               \n"
+                "** Copyright (C) 2011 Taodyne.                                                   \n"
+                "** All rights reserved.                                                          \n"
+                "** Contact: Taodyne (contact@taodyne.com)                                        \n"
+                "**                                                                               \n"
+                "** This file is part of the Tao3D application, developped by Taodyne.\n"
+                "** It can be only used in the software and these modules.                        \n"
+                "**                                                                               \n"
+                "** If you have questions regarding the use of this file, please contact          \n"
+                "** Taodyne at contact@taodyne.com.                                               \n"
+                "**                                                                               \n"
+                "********************************************************************************/\n"
+                "varying vec2 coord;"
+                "void main()"
+                "{"
+                "   coord = gl_Vertex.xy * 0.5 + 0.5;"
+                "   gl_Position = vec4(gl_Vertex.xyz, 1.0);"
+                "}";
+
+        static std::string fSrc =
+                "/********************************************************************************\n"
+                "**                                                                               \n"
+                "** Copyright (C) 2011 Taodyne.                                                   \n"
+                "** All rights reserved.                                                          \n"
+                "** Contact: Taodyne (contact@taodyne.com)                                        \n"
+                "**                                                                               \n"
+                "** This file is part of the Tao3D application, developped by Taodyne.\n"
+                "** It can be only used in the software and these modules.                        \n"
+                "**                                                                               \n"
+                "** If you have questions regarding the use of this file, please contact          \n"
+                "** Taodyne at contact@taodyne.com.                                               \n"
+                "**                                                                               \n"
+                "********************************************************************************/\n"
+                "uniform sampler2D texture;"
+                "uniform sampler2D mask;"
+                "uniform float masked;"
+                "uniform float ratio;"
+                "uniform vec2 delta;"
+                ""
+                "varying vec2 coord;"
+                "bool dry(vec2 at) {"
+                "  return texture2D(mask, at).r > 0.5;"
+                "}"
+                "void main() {"
+                "  /* get vertex info */"
+                "  vec4 info = texture2D(texture, coord);"
+                "  "
+                "  /* calculate average neighbor height */"
+                "  vec2 dx = vec2(delta.x, 0.0);"
+                "  vec2 dy = vec2(0.0, delta.y);"
+                "  float left  = texture2D(texture, coord - dx).r;"
+                "  float down  = texture2D(texture, coord - dy).r;"
+                "  float right = texture2D(texture, coord + dx).r;"
+                "  float up    = texture2D(texture, coord + dy).r;"
+                "  "
+                "  /* dry texels stay flat, and reflect waves like edges */"
+                "  if (masked > 0.5) {"
+                "    if (dry(coord)) {"
+                "      gl_FragColor = vec4(0.0);"
+                "      return;"
+                "    }"
+                "    if (dry(coord - dx)) left  = info.r;"
+                "    if (dry(coord - dy)) down  = info.r;"
+                "    if (dry(coord + dx)) right = info.r;"
+                "    if (dry(coord + dy)) up    = info.r;"
+                "  }"
+                "  float average = (left + down + right + up) * 0.25;"
+                "  "
+                "  /* change the velocity to move toward the average */"
+                "  info.g += (average - info.r) * 2.0;"
+                "  "
+                "  /* attenuate the velocity a little so waves do not last forever */"
+                "  info.g *= ratio;"
+                "  "
+                "  /* move the vertex along the velocity */"
+                "  info.r += info.g;"
+                "  "
+                "  /* keep the gradient for the render shader, one step late */"
+                "  info.ba = vec2(right - left, up - down) * 0.5;"
+                ""
+                "  gl_FragColor = info;"
+                "}";
+
+
+        if (updateShader->addShaderFromSourceCode(QGLShader::Vertex, vSrc.c_str()))
+        {
+            if (updateShader->addShaderFromSourceCode(QGLShader::Fragment, fSrc.c_str()))
+            {
+                ok = true;
+            }
+            else
+            {
+                std::cerr << "Update shader" << "\n";
+                std::cerr << "Error loading fragment shader code: " << "\n";
+                std::cerr << updateShader->log().toStdString();
+            }
+        }
+        else
+        {
+            std::cerr << "Update shader" << "\n";
+            std::cerr << "Error loading vertex shader code: " << "\n";
+            std::cerr << updateShader->log().toStdString();
+        }
+
+        if (!ok)
+        {
+            delete updateShader;
+            updateShader = NULL;
+            failed = true;
+        }
+        else
+        {
+            updateShader->link();
+
+            // Save uniform locations
+            uint id = updateShader->programId();
+            updateDeltaLocation = GL.GetUniformLocation(id, "delta");
+            updateRatioLocation = GL.GetUniformLocation(id, "ratio");
+            updateMaskLocation = GL.GetUniformLocation(id, "mask");
+            updateMaskedLocation = GL.GetUniformLocation(id, "masked");
+        }
+    }
+}
+
+
+
+
+
+void WaterResources::createShallowShader()
+// ----------------------------------------------------------------------------
+//   Create shader updating water with the shallow water equations
+// ----------------------------------------------------------------------------
+//   Texels hold the height above the rest depth in red, and the momentum
+//   along x and y in green and blue. Each step moves depth and momentum
+//   across the faces between texels with a Rusanov flux, so that what
+//   leaves a texel enters its neighbour. Reads past the edge are clamped,
+//   and their normal momentum is reversed, which makes edges walls, unless
+//   the water is periodic and its textures repeat. Dry texels of the mask
+//   stay flat and are walls for their neighbours.
+//   Same scheme as WaterCPU::updateShallow.
+{
+    if(!failed)
+    {
+        IFTRACE(water_surface)
+                debug() << "Create shallow water shader" << "\n";
+
+        shallowShader = new QGLShaderProgram(context);
+        bool ok = false;
+
+        static std::string vSrc =
+                "varying vec2 coord;"
+                "void main()"
+                "{"
+                "   coord = gl_Vertex.xy * 0.5 + 0.5;"
+                "   gl_Position = vec4(gl_Vertex.xyz, 1.0);"
+                "}";
+
+        static std::string fSrc =
+                "uniform sampler2D texture;"
+                "uniform sampler2D mask;"
+                "uniform float masked;"
+                "uniform float ratio;"
+                "uniform float depth;"
+                "uniform float gravity;"
+                "uniform float periodic;"
+                "uniform vec2 delta;"
+                "varying vec2 coord;"
+                ""
+                "bool dry(vec2 at) {"
+                "  return texture2D(mask, at).r > 0.5;"
+                "}"
+                ""
+                "/* depth and momentum, never completely dry */"
+                "vec3 state(vec2 at) {"
+                "  vec4 info = texture2D(texture, at);"
+                "  return vec3(max(depth + info.r, depth * 0.01), info.gb);"
+                "}"
+                "vec3 fluxX(vec3 u) {"
+                "  float s = u.y / u.x;"
+                "  return vec3(u.y, u.y * s + 0.5 * gravity * u.x * u.x, u.z * s);"
+                "}"
+                "vec3 fluxY(vec3 u) {"
+                "  float s = u.z / u.x;"
+                "  return vec3(u.z, u.y * s, u.z * s + 0.5 * gravity * u.x * u.x);"
+                "}"
+                "vec3 faceX(vec3 a, vec3 b) {"
+                "  float s = max(abs(a.y / a.x) + sqrt(gravity * a.x),"
+                "                abs(b.y / b.x) + sqrt(gravity * b.x));"
+                "  return 0.5 * (fluxX(a) + fluxX(b)) - 0.5 * s * (b - a);"
+                "}"
+                "vec3 faceY(vec3 a, vec3 b) {"
+                "  float s = max(abs(a.z / a.x) + sqrt(gravity * a.x),"
+                "                abs(b.z / b.x) + sqrt(gravity * b.x));"
+                "  return 0.5 * (fluxY(a) + fluxY(b)) - 0.5 * s * (b - a);"
+                "}"
+                ""
+                "void main() {"
+                "  vec2 dx = vec2(delta.x, 0.0);"
+                "  vec2 dy = vec2(0.0, delta.y);"
+                "  vec3 c     = state(coord);"
+                "  vec3 left  = state(coord - dx);"
+                "  vec3 down  = state(coord - dy);"
+                "  vec3 right = state(coord + dx);"
+                "  vec3 up    = state(coord + dy);"
+                ""
+                "  /* walls: the edge texel mirrors itself */"
+                "  if (periodic < 0.5) {"
+                "    if (coord.x - delta.x < 0.0) left.y  = -c.y;"
+                "    if (coord.x + delta.x > 1.0) right.y = -c.y;"
+                "    if (coord.y - delta.y < 0.0) down.z  = -c.z;"
+                "    if (coord.y + delta.y > 1.0) up.z    = -c.z;"
+                "  }"
+                "  if (masked > 0.5) {"
+                "    if (dry(coord)) {"
+                "      gl_FragColor = vec4(0.0);"
+                "      return;"
+                "    }"
+                "    if (dry(coord - dx)) left  = vec3(c.x, -c.y, c.z);"
+                "    if (dry(coord + dx)) right = vec3(c.x, -c.y, c.z);"
+                "    if (dry(coord - dy)) down  = vec3(c.xy, -c.z);"
+                "    if (dry(coord + dy)) up    = vec3(c.xy, -c.z);"
+                "  }"
+                ""
+                "  vec3 next = c - (faceX(c, right) - faceX(left, c))"
+                "                - (faceY(c, up) - faceY(down, c));"
+                "  next.x = max(next.x, depth * 0.01);"
+                ""
+                "  /* attenuate the momentum so waves do not last forever */"
+                "  gl_FragColor = vec4(next.x - depth, next.yz * ratio, 0.0);"
+                "}";
+
+        if (shallowShader->addShaderFromSourceCode(QGLShader::Vertex, vSrc.c_str()))
+        {
+            if (shallowShader->addShaderFromSourceCode(QGLShader::Fragment, fSrc.c_str()))
+            {
+                ok = true;
+            }
+            else
+            {
+                std::cerr << "Shallow water shader" << "\n";
+                std::cerr << "Error loading fragment shader code: " << "\n";
+                std::cerr << shallowShader->log().toStdString();
+            }
+        }
+        else
+        {
+            std::cerr << "Shallow water shader" << "\n";
+            std::cerr << "Error loading vertex shader code: " << "\n";
+            std::cerr << shallowShader->log().toStdString();
+        }
+
+        // Shallow waters run on the CPU without it
+        if (!ok)
+        {
+            delete shallowShader;
+            shallowShader = NULL;
+        }
+        else
+        {
+            shallowShader->link();
+
+            // Save uniform locations
+            uint id = shallowShader->programId();
+            shallowDeltaLocation = GL.GetUniformLocation(id, "delta");
+            shallowRatioLocation = GL.GetUniformLocation(id, "ratio");
+            shallowDepthLocation = GL.GetUniformLocation(id, "depth");
+            shallowGravityLocation = GL.GetUniformLocation(id, "gravity");
+            shallowPeriodicLocation = GL.GetUniformLocation(id, "periodic");
+            shallowMaskLocation = GL.GetUniformLocation(id, "mask");
+            shallowMaskedLocation = GL.GetUniformLocation(id, "masked");
+        }
+    }
+}
+
+
+void WaterResources::createClearShader()
+// ----------------------------------------------------------------------------
+//   Create shader used to flatten parts of a water
+// ----------------------------------------------------------------------------
+{
+    if(!failed)
+    {
+        IFTRACE(water_surface)
+                debug() << "Create clear shader" << "\n";
+
+        clearShader = new QGLShaderProgram(context);
+        bool ok = false;
+
+        static std::string vSrc =
+                "void main()"
+                "{"
+                "   gl_Position = vec4(gl_Vertex.xyz, 1.0);"
+                "}";
+
+        static std::string fSrc =
+                "void main() {"
+                "   gl_FragColor = vec4(0.0);"
+                "}";
+
+        if (clearShader->addShaderFromSourceCode(QGLShader::Vertex, vSrc.c_str()))
+        {
+            if (clearShader->addShaderFromSourceCode(QGLShader::Fragment, fSrc.c_str()))
+            {
+                ok = true;
+            }
+            else
+            {
+                std::cerr << "Clear shader" << "\n";
+                std::cerr << "Error loading fragment shader code: " << "\n";
+                std::cerr << clearShader->log().toStdString();
+            }
+        }
+        else
+        {
+            std::cerr << "Clear shader" << "\n";
+            std::cerr << "Error loading vertex shader code: " << "\n";
+            std::cerr << clearShader->log().toStdString();
+        }
+
+        if (!ok)
+        {
+            delete clearShader;
+            clearShader = NULL;
+            failed = true;
+        }
+        else
+        {
+            clearShader->link();
+        }
+    }
+}
+
+
+void WaterResources::createReduceShader()
+// ----------------------------------------------------------------------------
+//   Create shader computing the largest amplitude of blocks of texels
+// ----------------------------------------------------------------------------
+//   Each output texel covers a block of input texels, starting at its own
+//   position times 'block'. Texels read past the edge are clamped, which
+//   does not change the maximum. Without it, waters never go to sleep.
+//   Blue is included for the momentum along y of shallow waters, and it is
+//   never larger than heights when it holds a gradient.
+{
+    if(!failed)
+    {
+        IFTRACE(water_surface)
+                debug() << "Create reduce shader" << "\n";
+
+        reduceShader = new QGLShaderProgram(context);
+        bool ok = false;
+
+        static std::string vSrc =
+                "void main()"
+                "{"
+                "   gl_Position = vec4(gl_Vertex.xyz, 1.0);"
+                "}";
+
+        static std::string fSrc =
+                "const int BLOCK = 64;" /* WaterResources::REDUCE_BLOCK */
+                "uniform sampler2D texture;"
+                "uniform vec2 delta;"
+                "uniform vec2 block;"
+                "void main() {"
+                "   vec2 origin = floor(gl_FragCoord.xy) * block;"
+                "   float result = 0.0;"
+                "   for (int y = 0; y < BLOCK; y++) {"
+                "      if (float(y) >= block.y)"
+                "         break;"
+                "      for (int x = 0; x < BLOCK; x++) {"
+                "         if (float(x) >= block.x)"
+                "            break;"
+                "         vec2 at = (origin + vec2(float(x), float(y)) + 0.5) * delta;"
+                "         vec4 info = texture2D(texture, at);"
+                "         result = max(result, max(abs(info.r), max(abs(info.g), abs(info.b))));"
+                "      }"
+                "   }"
+                "   gl_FragColor = vec4(result, 0.0, 0.0, 1.0);"
+                "}";
+
+        if (reduceShader->addShaderFromSourceCode(QGLShader::Vertex, vSrc.c_str()))
+        {
+            if (reduceShader->addShaderFromSourceCode(QGLShader::Fragment, fSrc.c_str()))
+            {
+                ok = true;
+            }
+            else
+            {
+                std::cerr << "Reduce shader" << "\n";
+                std::cerr << "Error loading fragment shader code: " << "\n";
+                std::cerr << reduceShader->log().toStdString();
+            }
+        }
+        else
+        {
+            std::cerr << "Reduce shader" << "\n";
+            std::cerr << "Error loading vertex shader code: " << "\n";
+            std::cerr << reduceShader->log().toStdString();
+        }
+
+        // Waters can run without it, so this is not a failure
+        if (!ok)
+        {
+            delete reduceShader;
+            reduceShader = NULL;
+        }
+        else
+        {
+            reduceShader->link();
+
+            // Save uniform locations
+            uint id = reduceShader->programId();
+            reduceDeltaLocation = GL.GetUniformLocation(id, "delta");
+            reduceBlockLocation = GL.GetUniformLocation(id, "block");
+        }
+    }
+}
+
+
+void WaterResources::createReduceBuffer()
+// ----------------------------------------------------------------------------
+//   Create the texture and FBO receiving reductions
+// ----------------------------------------------------------------------------
+{
+    if (failed || !reduceShader)
+        return;
+
+    GL.GenTextures(1, &reduceTexture);
+    GL.BindTexture(GL_TEXTURE_2D, reduceTexture);
+    GL.TexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F_ARB, REDUCE_SIZE, REDUCE_SIZE,
+                  0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    GL.TexParameter(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    GL.BindTexture(GL_TEXTURE_2D, 0);
+
+    GL.GenFramebuffers(1, &reduceFrame);
+    GL.BindFramebuffer(GL_FRAMEBUFFER, reduceFrame);
+    GL.FramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_TEXTURE_2D, reduceTexture, 0);
+    GL.BindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    IFTRACE(water_surface)
+                debug() << "Create reduce buffer: " << reduceFrame << "\n";
+}
+
+// Vertex shader of atlas passes: each quad has the inside of its water
+// in texture unit 1, and values of the water in texture unit 2
+static const char *atlasVertexSource =
+        "varying vec2 coord;"
+        "varying vec4 bounds;"
+        "varying vec4 values;"
+        "void main()"
+        "{"
+        "   coord = gl_Vertex.xy * 0.5 + 0.5;"
+        "   bounds = gl_MultiTexCoord1;"
+        "   values = gl_MultiTexCoord2;"
+        "   gl_Position = vec4(gl_Vertex.xyz, 1.0);"
+        "}";
+
+
+void WaterResources::createAtlasUpdateShader()
+// ----------------------------------------------------------------------------
+//   Create shader updating all waters of an atlas
+// ----------------------------------------------------------------------------
+//   Same as the update shader, with reads clamped to the inside of the
+//   water, which also writes its guard border as a copy of its edges.
+//   Values are the extenuation ratio, and 1 to update or 0 to copy.
+{
+    if(!failed)
+    {
+        IFTRACE(water_surface)
+                debug() << "Create atlas update shader" << "\n";
+
+        atlasUpdateShader = new QGLShaderProgram(context);
+        bool ok = false;
+
+        static std::string fSrc =
+                "uniform sampler2D texture;"
+                "uniform vec2 delta;"
+                "varying vec2 coord;"
+                "varying vec4 bounds;"
+                "varying vec4 values;"
+                "void main() {"
+                "  vec2 at = clamp(coord, bounds.xy, bounds.zw);"
+                "  vec4 info = texture2D(texture, at);"
+                "  if (values.y > 0.5) {"
+                "    vec2 dx = vec2(delta.x, 0.0);"
+                "    vec2 dy = vec2(0.0, delta.y);"
+                "    float left  = texture2D(texture, clamp(at - dx, bounds.xy, bounds.zw)).r;"
+                "    float down  = texture2D(texture, clamp(at - dy, bounds.xy, bounds.zw)).r;"
+                "    float right = texture2D(texture, clamp(at + dx, bounds.xy, bounds.zw)).r;"
+                "    float up    = texture2D(texture, clamp(at + dy, bounds.xy, bounds.zw)).r;"
+                "    float average = (left + down + right + up) * 0.25;"
+                "    info.g += (average - info.r) * 2.0;"
+                "    info.g *= values.x;"
+                "    info.r += info.g;"
+                "    info.ba = vec2(right - left, up - down) * 0.5;"
+                "  }"
+                "  gl_FragColor = info;"
+                "}";
+
+        if (atlasUpdateShader->addShaderFromSourceCode(QGLShader::Vertex, atlasVertexSource))
+        {
+            if (atlasUpdateShader->addShaderFromSourceCode(QGLShader::Fragment, fSrc.c_str()))
+            {
+                ok = true;
+            }
+            else
+            {
+                std::cerr << "Atlas update shader" << "\n";
+                std::cerr << "Error loading fragment shader code: " << "\n";
+                std::cerr << atlasUpdateShader->log().toStdString();
+            }
+        }
+        else
+        {
+            std::cerr << "Atlas update shader" << "\n";
+            std::cerr << "Error loading vertex shader code: " << "\n";
+            std::cerr << atlasUpdateShader->log().toStdString();
+        }
+
+        // Waters can run without it, each in its own textures
+        if (!ok)
+        {
+            delete atlasUpdateShader;
+            atlasUpdateShader = NULL;
+        }
+        else
+        {
+            atlasUpdateShader->link();
+
+            // Save uniform locations
+            uint id = atlasUpdateShader->programId();
+            atlasDeltaLocation = GL.GetUniformLocation(id, "delta");
+        }
+    }
+}
+
+
+void WaterResources::createAtlasDropShader()
+// ----------------------------------------------------------------------------
+//   Create shader adding drops to one water of an atlas
+// ----------------------------------------------------------------------------
+//   Values are the origin and size of the water in the atlas, to compute
+//   drops in the coordinates of the water.
+{
+    if(!failed)
+    {
+        IFTRACE(water_surface)
+                debug() << "Create atlas drop shader" << "\n";
+
+        atlasDropShader = new QGLShaderProgram(context);
+        bool ok = false;
+
+        static std::string fSrc =
+                "const float PI = 3.141592653589793;"
+                "const int MAX_DROPS = 32;" /* WaterResources::DROPS_PER_PASS */
+                "uniform sampler2D texture;"
+                "uniform vec4  drops[MAX_DROPS];" /* center, radius, strength */
+                "uniform float count;"
+                "varying vec2 coord;"
+                "varying vec4 bounds;"
+                "varying vec4 values;"
+                "void main() {"
+                "   vec2 at = clamp(coord, bounds.xy, bounds.zw);"
+                "   vec2 local = (at - values.xy) / values.zw;"
+                "   vec4 info = texture2D(texture, at);"
+                "   for (int i = 0; i < MAX_DROPS; i++) {"
+                "      if (float(i) >= count)"
+                "         break;"
+                "      vec4 d = drops[i];"
+                "      float drop = max(0.0, 1.0 - length(d.xy * 0.5 + 0.5 - local) / (d.z / 100.0));"
+                "      drop = 0.5 - cos(drop * PI) * 0.5;"
+                "      info.r += drop * (d.w / 1000.0);"
+                "   }"
+                "   gl_FragColor = info;"
+                "}";
+
+        if (atlasDropShader->addShaderFromSourceCode(QGLShader::Vertex, atlasVertexSource))
+        {
+            if (atlasDropShader->addShaderFromSourceCode(QGLShader::Fragment, fSrc.c_str()))
+            {
+                ok = true;
+            }
+            else
+            {
+                std::cerr << "Atlas drop shader" << "\n";
+                std::cerr << "Error loading fragment shader code: " << "\n";
+                std::cerr << atlasDropShader->log().toStdString();
+            }
+        }
+        else
+        {
+            std::cerr << "Atlas drop shader" << "\n";
+            std::cerr << "Error loading vertex shader code: " << "\n";
+            std::cerr << atlasDropShader->log().toStdString();
+        }
+
+        // Waters can run without it, each in its own textures
+        if (!ok)
+        {
+            delete atlasDropShader;
+            atlasDropShader = NULL;
+        }
+        else
+        {
+            atlasDropShader->link();
+
+            // Save uniform locations
+            uint id = atlasDropShader->programId();
+            atlasDropsLocation     = GL.GetUniformLocation(id, "drops");
+            atlasDropCountLocation = GL.GetUniformLocation(id, "count");
+        }
+    }
+}
+
+
+std::ostream & WaterResources::debug()
+// ----------------------------------------------------------------------------
+//   Convenience method to log with a common prefix
+// ----------------------------------------------------------------------------
+{
+    std::cerr << "[WaterResources] " << (void*)context << " ";
+    return std::cerr;
+}
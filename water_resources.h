@@ -0,0 +1,131 @@
+#ifndef WATER_RESOURCES_H
+#define WATER_RESOURCES_H
+// *****************************************************************************
+// water_resources.h                                               Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//      GL resources shared by all waters of a GL context.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2013, Baptiste Soulisse <baptiste.soulisse@taodyne.com>
+// (C) 2012-2014,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+#include "tao/tao_gl.h"
+#include <QGLContext>
+#include <QGLShaderProgram>
+#include <QObject>
+#include <iostream>
+#include <map>
+
+
+class WaterResources : public QObject
+// ----------------------------------------------------------------------------
+//   Programs, uniform locations and FBOs of waters in one GL context
+// ----------------------------------------------------------------------------
+//   Resources are built once per context, the first time a water needs
+//   them, and released when Qt is about to destroy the context.
+//   Each set of resources has a unique serial, which waters compare to
+//   detect a context change even if a new context reuses an old address.
+{
+    Q_OBJECT
+
+public:
+    WaterResources(const QGLContext *context);
+    ~WaterResources();
+
+    // Framebuffer object owned by 'owner' in this context
+    uint                framebuffer(const void *owner);
+
+public:
+    static WaterResources * current();
+    static void             forget(const void *owner);
+    static void             purge();
+
+public:
+    enum { DROPS_PER_PASS = 32 };
+
+    const QGLContext *  context;
+    uint                serial;
+    bool                failed;
+
+    QGLShaderProgram *  dropShader;
+    GLint               dropsLocation, dropCountLocation, dropPeriodicLocation;
+
+    QGLShaderProgram *  updateShader;
+    GLint               updateDeltaLocation, updateRatioLocation;
+    GLint               updateMaskLocation, updateMaskedLocation;
+
+    QGLShaderProgram *  clearShader;
+
+    // Update shader of the shallow water solver. NULL if not available.
+    QGLShaderProgram *  shallowShader;
+    GLint               shallowDeltaLocation, shallowRatioLocation;
+    GLint               shallowDepthLocation, shallowGravityLocation;
+    GLint               shallowPeriodicLocation;
+    GLint               shallowMaskLocation, shallowMaskedLocation;
+
+    // Maxima of blocks of up to REDUCE_BLOCK^2 texels of a water,
+    // written in a REDUCE_SIZE^2 texture. NULL if not available.
+    enum { REDUCE_SIZE = 64, REDUCE_BLOCK = 64 };
+    QGLShaderProgram *  reduceShader;
+    GLint               reduceDeltaLocation, reduceBlockLocation;
+    uint                reduceTexture, reduceFrame;
+
+    // Update and drop shaders of waters packed in an atlas, clamping reads
+    // to the rectangle of each water. NULL if not available.
+    QGLShaderProgram *  atlasUpdateShader;
+    GLint               atlasDeltaLocation;
+    QGLShaderProgram *  atlasDropShader;
+    GLint               atlasDropsLocation, atlasDropCountLocation;
+
+private slots:
+    void                contextDestroyed();
+
+private:
+    void                createShaders();
+    void                createDropShader();
+    void                createUpdateShader();
+    void                createShallowShader();
+    void                createClearShader();
+    void                createReduceShader();
+    void                createReduceBuffer();
+    void                createAtlasUpdateShader();
+    void                createAtlasDropShader();
+    void                release(const void *owner);
+    std::ostream &      debug();
+
+private:
+    typedef std::map<const void *, uint>        framebuffer_map;
+    framebuffer_map     framebuffers;
+
+    typedef std::map<const QGLContext *, WaterResources *> registry_map;
+    static registry_map registry;
+    static uint         serials;
+};
+
+#endif
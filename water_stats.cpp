@@ -0,0 +1,191 @@
+// *****************************************************************************
+// water_stats.cpp                                                 Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//   Timing statistics of water operations.
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2015,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+#include "water_stats.h"
+#include "basics.h" // XLR
+#include <algorithm>
+
+
+bool WaterTimer::gpuTimers = false;
+
+
+WaterTimer::WaterTimer(const char *name)
+// ----------------------------------------------------------------------------
+//   Create a timer, GL queries are created on first use
+// ----------------------------------------------------------------------------
+    : name(name), calls(0), cpuSamples(0), gpuSamples(0),
+      context(NULL), issued(0), collected(0), querying(false)
+{}
+
+
+WaterTimer::~WaterTimer()
+// ----------------------------------------------------------------------------
+//   Delete GL queries if their context is still current
+// ----------------------------------------------------------------------------
+{
+    if (context && context == QGLContext::currentContext())
+        glDeleteQueries(QUERIES, queries);
+}
+
+
+void WaterTimer::begin(bool gpu)
+// ----------------------------------------------------------------------------
+//   Start measuring a call, on the GPU if it issues GL commands
+// ----------------------------------------------------------------------------
+{
+    calls++;
+    collect();
+
+    querying = false;
+    if (gpu && gpuTimers)
+    {
+        const QGLContext *current = QGLContext::currentContext();
+        if (context != current)
+        {
+            context = current;
+            glGenQueries(QUERIES, queries);
+            issued = collected = 0;
+        }
+        if (issued - collected < QUERIES)
+        {
+            glBeginQuery(GL_TIME_ELAPSED, queries[issued % QUERIES]);
+            querying = true;
+        }
+    }
+    timer.start();
+}
+
+
+void WaterTimer::end()
+// ----------------------------------------------------------------------------
+//   Stop measuring a call
+// ----------------------------------------------------------------------------
+{
+    float ms = timer.nsecsElapsed() * 1e-6;
+    cpu[cpuSamples++ % SAMPLES] = ms;
+    if (querying)
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        issued++;
+        querying = false;
+    }
+
+    IFTRACE(water_stats)
+            debug() << "cpu " << ms << " ms" << "\n";
+}
+
+
+void WaterTimer::reset()
+// ----------------------------------------------------------------------------
+//   Forget GL queries, which belong to a context that no longer exists
+// ----------------------------------------------------------------------------
+{
+    context = NULL;
+    issued = collected = 0;
+    querying = false;
+}
+
+
+void WaterTimer::collect()
+// ----------------------------------------------------------------------------
+//   Read the results of completed GL queries, without waiting
+// ----------------------------------------------------------------------------
+{
+    if (!context || context != QGLContext::currentContext())
+        return;
+
+    while (collected != issued)
+    {
+        GLuint query = queries[collected % QUERIES];
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+        gpu[gpuSamples++ % SAMPLES] = ns * 1e-6;
+        collected++;
+
+        IFTRACE(water_stats)
+                debug() << "gpu " << ns * 1e-6 << " ms" << "\n";
+    }
+}
+
+
+void WaterTimer::report(std::ostream &out)
+// ----------------------------------------------------------------------------
+//   Print call count, average and 95th percentile of recent calls
+// ----------------------------------------------------------------------------
+{
+    collect();
+    out << name << ": " << calls << " calls";
+    summary(out, "cpu", cpu, cpuSamples);
+    summary(out, "gpu", gpu, gpuSamples);
+    out << "\n";
+}
+
+
+void WaterTimer::summary(std::ostream &out, const char *kind,
+                         const float *samples, uint count)
+// ----------------------------------------------------------------------------
+//   Print average and 95th percentile of the last SAMPLES values
+// ----------------------------------------------------------------------------
+{
+    if (count > SAMPLES)
+        count = SAMPLES;
+    if (count == 0)
+        return;
+
+    float sorted[SAMPLES];
+    std::copy(samples, samples + count, sorted);
+    std::sort(sorted, sorted + count);
+
+    double sum = 0.0;
+    for (uint i = 0; i < count; i++)
+        sum += sorted[i];
+
+    out << ", " << kind << " " << sum / count << " ms avg "
+        << sorted[(count * 95 - 1) / 100] << " ms p95";
+}
+
+
+std::ostream & WaterTimer::debug()
+// ----------------------------------------------------------------------------
+//   Convenience method to log with the name of the timer
+// ----------------------------------------------------------------------------
+{
+    std::cerr << "[WaterTimer] " << name << " ";
+    return std::cerr;
+}
@@ -0,0 +1,85 @@
+#ifndef WATER_STATS_H
+#define WATER_STATS_H
+// *****************************************************************************
+// water_stats.h                                                   Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//      Timing statistics of water operations.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2014,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+#include "tao/tao_gl.h"
+#include <QElapsedTimer>
+#include <QGLContext>
+#include <iostream>
+
+
+class WaterTimer
+// ----------------------------------------------------------------------------
+//   Rolling CPU and GPU timings of one kind of water operation
+// ----------------------------------------------------------------------------
+//   GPU time is measured with GL timer queries kept in a small ring.
+//   Results are only read once available, usually a few frames later,
+//   and a call is not measured on the GPU if all queries are pending,
+//   so that measuring never stalls the pipeline.
+{
+public:
+    WaterTimer(const char *name);
+    ~WaterTimer();
+
+    void                begin(bool gpu);
+    void                end();
+    void                reset();
+    void                report(std::ostream &out);
+
+public:
+    static bool         gpuTimers;      // GL_ARB_timer_query is available
+
+private:
+    void                collect();
+    static void         summary(std::ostream &out, const char *kind,
+                                const float *samples, uint count);
+    std::ostream &      debug();
+
+private:
+    enum { SAMPLES = 64, QUERIES = 4 };
+
+    const char *        name;
+    QElapsedTimer       timer;
+    unsigned long long  calls;
+    float               cpu[SAMPLES], gpu[SAMPLES];  // Milliseconds
+    uint                cpuSamples, gpuSamples;
+
+    const QGLContext *  context;        // Context owning the queries
+    GLuint              queries[QUERIES];
+    uint                issued, collected;
+    bool                querying;
+};
+
+#endif
@@ -43,10 +43,37 @@ include(../modules.pri)
 INCLUDEPATH += $${TAOTOPSRC}/tao/include/tao/
 HEADERS = \
           water.h \
-    water_factory.h
+    water_factory.h \
+    water_cpu.h \
+    water_pool.h \
+    water_bench.h \
+    water_stats.h \
+    water_resources.h \
+    water_pass.h \
+    water_readback.h \
+    water_mesh.h \
+    water_log.h \
+    water_tiles.h \
+    water_atlas.h \
+    water_ocean.h \
+    water_mask.h
 
 SOURCES = water.cpp \
-    water_factory.cpp
+    water_factory.cpp \
+    water_cpu.cpp \
+    water_pool.cpp \
+    water_bench.cpp \
+    water_bench_gl.cpp \
+    water_stats.cpp \
+    water_resources.cpp \
+    water_pass.cpp \
+    water_readback.cpp \
+    water_mesh.cpp \
+    water_log.cpp \
+    water_tiles.cpp \
+    water_atlas.cpp \
+    water_ocean.cpp \
+    water_mask.cpp
 
 TBL_SOURCES  = water_surface.tbl
 
@@ -0,0 +1,310 @@
+// *****************************************************************************
+// water_tiles.cpp                                                 Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//   Active tiles of a water surface.
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2015,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+#include "water_tiles.h"
+#include <algorithm>
+#include <cmath>
+
+
+
+// ============================================================================
+//
+//   WaterTiles
+//
+// ============================================================================
+
+WaterTiles::WaterTiles()
+// ----------------------------------------------------------------------------
+//   Create an empty set of tiles
+// ----------------------------------------------------------------------------
+    : width(0), height(0), size(MIN_SIZE), columns(0), rows(0),
+      periodic(false), reach(0), age(0), changed(true), moved(true)
+{}
+
+
+void WaterTiles::resize(int w, int h)
+// ----------------------------------------------------------------------------
+//   Split a new grid in tiles, all active
+// ----------------------------------------------------------------------------
+{
+    width = w;
+    height = h;
+    int longest = std::max(w, h);
+    size = std::max((int) MIN_SIZE, (longest + MAX_TILES - 1) / MAX_TILES);
+    columns = (w + size - 1) / size;
+    rows = (h + size - 1) / size;
+    dryTiles.clear();
+    activateAll();
+}
+
+
+void WaterTiles::activate(double x, double y, double radius)
+// ----------------------------------------------------------------------------
+//   Activate the tiles covered by a drop, in the coordinates of add_drop
+// ----------------------------------------------------------------------------
+{
+    double cx = x * 0.5 + 0.5;
+    double cy = y * 0.5 + 0.5;
+    double r = radius / 100.0;
+
+    int x0, x1, y0, y1;
+    if (periodic)
+    {
+        // Tiles past the edges are those of the other side, once
+        x0 = (int) floor(floor((cx - r) * width) / size);
+        x1 = (int) floor(ceil((cx + r) * width) / size);
+        y0 = (int) floor(floor((cy - r) * height) / size);
+        y1 = (int) floor(ceil((cy + r) * height) / size);
+        x1 = std::min(x1, x0 + columns - 1);
+        y1 = std::min(y1, y0 + rows - 1);
+    }
+    else
+    {
+        x0 = std::max(0, (int) floor((cx - r) * width) / size);
+        x1 = std::min(columns - 1, (int) ceil((cx + r) * width) / size);
+        y0 = std::max(0, (int) floor((cy - r) * height) / size);
+        y1 = std::min(rows - 1, (int) ceil((cy + r) * height) / size);
+    }
+    for (int ty = y0; ty <= y1; ty++)
+    {
+        for (int tx = x0; tx <= x1; tx++)
+        {
+            int t = ((ty % rows + rows) % rows) * columns +
+                    ((tx % columns + columns) % columns);
+            if (!dryTiles.empty() && dryTiles[t])
+                continue;
+            changed |= !covered[t];
+            active[t] = covered[t] = fresh[t] = 1;
+        }
+    }
+    moved = true;
+}
+
+
+void WaterTiles::activateAll()
+// ----------------------------------------------------------------------------
+//   Activate all tiles
+// ----------------------------------------------------------------------------
+{
+    active.assign(columns * rows, 1);
+    if (!dryTiles.empty())
+        for (int t = 0; t < columns * rows; t++)
+            active[t] = !dryTiles[t];
+    covered = fresh = active;
+    measured.assign(columns * rows, 0);
+    retiredRuns.clear();
+    reach = 0;
+    changed = moved = true;
+}
+
+
+void WaterTiles::clear()
+// ----------------------------------------------------------------------------
+//   Deactivate all tiles, once the whole grid was made flat
+// ----------------------------------------------------------------------------
+{
+    active.assign(columns * rows, 0);
+    covered = measured = fresh = active;
+    retiredRuns.clear();
+    reach = 0;
+    changed = moved = true;
+}
+
+
+void WaterTiles::grow(int steps)
+// ----------------------------------------------------------------------------
+//   Cover the tiles that waves may have reached since the last measure
+// ----------------------------------------------------------------------------
+//   Covered tiles are computed from the active ones, which are left as
+//   measured, so they only grow by one tile every 'size' steps.
+{
+    int longest = size * std::max(columns, rows);
+    int before = (reach + size - 1) / size;
+    reach = std::min(reach + steps, longest);
+    age = std::min(age + steps, longest);
+    int rings = (reach + size - 1) / size;
+    retiredRuns.clear();
+    if (rings == before && !moved)
+        return;
+    moved = false;
+
+    grown = active;
+    for (int ring = 0; ring < rings; ring++)
+    {
+        spread = grown;
+        for (int ty = 0; ty < rows; ty++)
+        {
+            for (int tx = 0; tx < columns; tx++)
+            {
+                if (!spread[ty * columns + tx])
+                    continue;
+                if (periodic)
+                {
+                    for (int y = ty - 1; y <= ty + 1; y++)
+                        for (int x = tx - 1; x <= tx + 1; x++)
+                            grown[((y + rows) % rows) * columns +
+                                  (x + columns) % columns] = 1;
+                    continue;
+                }
+                for (int y = std::max(ty-1, 0); y <= std::min(ty+1, rows-1); y++)
+                    for (int x = std::max(tx-1, 0); x <= std::min(tx+1, columns-1); x++)
+                        grown[y * columns + x] = 1;
+            }
+        }
+    }
+
+    // Waves do not enter dry tiles
+    if (!dryTiles.empty())
+        for (int t = 0; t < columns * rows; t++)
+            grown[t] &= !dryTiles[t];
+
+    // Tiles that were covered and are no longer are retired
+    spread = covered;
+    for (int t = 0; t < columns * rows; t++)
+        spread[t] &= !grown[t];
+    merge(spread, retiredRuns);
+
+    if (covered != grown)
+    {
+        covered.swap(grown);
+        changed = true;
+    }
+}
+
+
+void WaterTiles::sample()
+// ----------------------------------------------------------------------------
+//   Start a measure of the covered tiles
+// ----------------------------------------------------------------------------
+{
+    measured = covered;
+    fresh.assign(columns * rows, 0);
+    age = 0;
+}
+
+
+float WaterTiles::settle(const float *maxima, float quiet)
+// ----------------------------------------------------------------------------
+//   Keep active the measured tiles whose amplitude is at least 'quiet'
+// ----------------------------------------------------------------------------
+//   'maxima' holds one value per tile, row by row, as they were when the
+//   measure started. Values of tiles that were not covered then are not
+//   read, since they were not measured. Return the largest amplitude.
+{
+    float result = 0.0;
+    for (int t = 0; t < columns * rows; t++)
+    {
+        if (measured[t])
+            result = std::max(result, maxima[t]);
+        active[t] = fresh[t] || (measured[t] && maxima[t] >= quiet);
+        if (!dryTiles.empty())
+            active[t] &= !dryTiles[t];
+    }
+    reach = age;
+    moved = true;
+    return result;
+}
+
+
+void WaterTiles::mask(const uchar *dry)
+// ----------------------------------------------------------------------------
+//   Find the tiles where all texels are dry, and stop covering them
+// ----------------------------------------------------------------------------
+//   Covered tiles that became dry are retired by the next grow
+{
+    dryTiles.clear();
+    if (!dry)
+        return;
+
+    dryTiles.assign(columns * rows, 1);
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            if (!dry[y * width + x])
+                dryTiles[(y / size) * columns + x / size] = 0;
+    for (int t = 0; t < columns * rows; t++)
+        active[t] &= !dryTiles[t];
+    moved = true;
+}
+
+
+bool WaterTiles::empty()
+// ----------------------------------------------------------------------------
+//   Check if no tile is active
+// ----------------------------------------------------------------------------
+{
+    return std::find(active.begin(), active.end(), 1) == active.end();
+}
+
+
+const WaterRectList &WaterTiles::rects()
+// ----------------------------------------------------------------------------
+//   Return runs of covered tiles, rebuilt only when the set changed
+// ----------------------------------------------------------------------------
+{
+    if (changed)
+        merge(covered, coveredRuns);
+    changed = false;
+    return coveredRuns;
+}
+
+
+void WaterTiles::merge(const std::vector<uchar> &set, WaterRectList &runs)
+// ----------------------------------------------------------------------------
+//   Merge horizontal runs of tiles of a set into rectangles of texels
+// ----------------------------------------------------------------------------
+{
+    runs.clear();
+    for (int ty = 0; ty < rows; ty++)
+    {
+        int tx = 0;
+        while (tx < columns)
+        {
+            if (!set[ty * columns + tx])
+            {
+                tx++;
+                continue;
+            }
+            int start = tx;
+            while (tx < columns && set[ty * columns + tx])
+                tx++;
+
+            WaterRect r;
+            r.x0 = start * size;
+            r.x1 = std::min(tx * size, width);
+            r.y0 = ty * size;
+            r.y1 = std::min((ty + 1) * size, height);
+            runs.push_back(r);
+        }
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef WATER_TILES_H
+#define WATER_TILES_H
+// *****************************************************************************
+// water_tiles.h                                                   Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//      Active tiles of a water surface.
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// (C) 2012-2014,2019, Christophe de Dinechin <christophe@dinechin.org>
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "water_cpu.h"
+#include <vector>
+
+
+class WaterTiles
+// ----------------------------------------------------------------------------
+//   Tiles of a water grid where waves are not negligible
+// ----------------------------------------------------------------------------
+//   Waves move by at most one texel per solver step, so the tiles updated,
+//   or covered, are the active tiles grown by one tile for every 'size'
+//   steps run since the last measure. Measures of their amplitude shrink
+//   the active set and restart the count. Covered tiles that are no longer
+//   near an active tile are retired, and must be cleared in both height
+//   buffers, since stale values alternating between buffers would act as
+//   a source of waves for their neighbours.
+//   Measures may complete some steps after they started: tiles settle on
+//   the tiles covered when the measure started, and keep active the tiles
+//   activated since then.
+//   Tiles are large enough that there are at most MAX_TILES per side.
+//   On periodic waters, tiles of an edge are neighbours of the other edge.
+//   Tiles where all texels are dry are never covered.
+{
+public:
+    enum { MIN_SIZE = 32, MAX_TILES = 64 };
+
+public:
+    WaterTiles();
+
+    void                resize(int width, int height);
+    void                activate(double x, double y, double radius);
+    void                activateAll();
+    void                clear();
+    void                grow(int steps);
+    void                sample();
+    float               settle(const float *maxima, float quiet);
+
+    // Exclude the tiles whose texels are all dry, NULL if none are
+    void                mask(const uchar *dry);
+
+    bool                isCovered(int x, int y)
+    {
+        return covered[y * columns + x];
+    }
+    bool                empty();
+
+    // Covered and retired tiles merged in horizontal runs, in texels
+    const WaterRectList &rects();
+    const WaterRectList &retired()      { return retiredRuns; }
+
+public:
+    int                 width, height;
+    int                 size, columns, rows;
+    bool                periodic;
+
+private:
+    void                merge(const std::vector<uchar> &set,
+                              WaterRectList &runs);
+
+private:
+    std::vector<uchar>  active, covered, grown, spread;
+    std::vector<uchar>  measured;       // Covered when the measure started
+    std::vector<uchar>  fresh;          // Activated since it started
+    std::vector<uchar>  dryTiles;       // Empty without a mask
+    WaterRectList       coveredRuns, retiredRuns;
+    int                 reach;          // Steps since the last measure
+    int                 age;            // Steps since the pending measure
+    bool                changed;        // Covered runs must be merged again
+    bool                moved;          // Active set changed since grow
+};
+
+#endif